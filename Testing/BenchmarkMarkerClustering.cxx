@@ -0,0 +1,125 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    BenchmarkMarkerClustering.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapMarkerSet.h"
+
+#include <vtkNew.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Markers spread over the United States, a third of them in five dense
+// areas, from a fixed sequence
+void MakeMarkers(int count, std::vector<double>& latitudes,
+                 std::vector<double>& longitudes)
+{
+  unsigned int state = 12345;
+  for (int i = 0; i < count; ++i)
+    {
+    state = state * 1103515245u + 12345u;
+    double u = ((state >> 8) % 100000) / 100000.0;
+    state = state * 1103515245u + 12345u;
+    double v = ((state >> 8) % 100000) / 100000.0;
+    if (i % 3 == 0)
+      {
+      int area = i % 5;
+      latitudes.push_back(30.0 + 3.0 * area + 2.0 * u);
+      longitudes.push_back(-100.0 + 4.0 * area + 2.0 * v);
+      }
+    else
+      {
+      latitudes.push_back(25.0 + 24.0 * u);
+      longitudes.push_back(-125.0 + 58.0 * v);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Clusters count markers added one at a time, in one batch on one
+// thread and on the given number of threads, then times removing one
+// marker in a hundred.
+int BenchmarkMarkerClustering(int argc, char *argv[])
+{
+  if (argc > 1 && atoi(argv[1]) < 1)
+    {
+    std::cout << "\n"
+              << "Measure the time to cluster map markers." << "\n"
+              << "Usage: BenchmarkMarkerClustering [count] [threads]" << "\n"
+              << "  e.g. BenchmarkMarkerClustering 50000 4" << "\n"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  int count = argc > 1 ? atoi(argv[1]) : 50000;
+  int threads = argc > 2 ? atoi(argv[2]) : 4;
+  threads = threads < 1 ? 1 : threads;
+
+  std::vector<double> latitudes;
+  std::vector<double> longitudes;
+  MakeMarkers(count, latitudes, longitudes);
+
+  vtkNew<vtkMapMarkerSet> single;
+  single->ClusteringOn();
+  double start = vtksys::SystemTools::GetTime();
+  for (int i = 0; i < count; ++i)
+    {
+    single->AddMarker(latitudes[i], longitudes[i]);
+    }
+  double singleTime = vtksys::SystemTools::GetTime() - start;
+
+  vtkNew<vtkMapMarkerSet> batch;
+  batch->ClusteringOn();
+  start = vtksys::SystemTools::GetTime();
+  batch->AddMarkers(count, &latitudes[0], &longitudes[0]);
+  double batchTime = vtksys::SystemTools::GetTime() - start;
+
+  vtkNew<vtkMapMarkerSet> threaded;
+  threaded->ClusteringOn();
+  threaded->SetNumberOfThreads(threads);
+  start = vtksys::SystemTools::GetTime();
+  threaded->AddMarkers(count, &latitudes[0], &longitudes[0]);
+  double threadedTime = vtksys::SystemTools::GetTime() - start;
+
+  start = vtksys::SystemTools::GetTime();
+  int removed = 0;
+  for (int i = 0; i < count; i += 100)
+    {
+    removed += batch->RemoveMarker(i) ? 1 : 0;
+    }
+  double removeTime = vtksys::SystemTools::GetTime() - start;
+
+  const int zoom = 6;
+  std::vector<int> sizes;
+  batch->GetClusterSizes(zoom, sizes);
+  std::cout << "Markers: " << count << "\n"
+            << "Added one at a time: " << 1000.0 * singleTime << " ms\n"
+            << "Added in one batch: " << 1000.0 * batchTime << " ms\n"
+            << "Added in one batch on " << threads << " threads: "
+            << 1000.0 * threadedTime << " ms\n"
+            << "Removing " << removed << " markers: "
+            << 1000.0 * removeTime << " ms\n"
+            << "Clusters and markers drawn at zoom level " << zoom << ": "
+            << sizes.size() << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  return BenchmarkMarkerClustering(argc, argv);
+}
@@ -0,0 +1,134 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    BenchmarkTileDownload.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileDownloader.h"
+#include "vtkMapTileFileStore.h"
+#include "vtkMapTilePackStore.h"
+
+#include <vtkNew.h>
+#include <vtkSmartPointer.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------
+vtkMapTileStore *NewStore(const std::string& type)
+{
+  if (type == "pack")
+    {
+    return vtkMapTilePackStore::New();
+    }
+  return vtkMapTileFileStore::New();
+}
+
+//----------------------------------------------------------------------------
+// Downloads count tiles one at a time and reports the latency of each.
+// The first request has to open the connection, later ones reuse it.
+// Then reopens the store and times looking up all the tiles.
+int BenchmarkTileDownload(int argc, char *argv[])
+{
+  if (argc < 3)
+    {
+    std::cout << "\n"
+              << "Measure per-tile download latency against a tile server."
+              << "\n"
+              << "Usage: BenchmarkTileDownload baseUrl outputDirectory"
+              << "  [count] [file|pack]" << "\n"
+              << "  e.g. BenchmarkTileDownload http://localhost:8000 /tmp/tiles"
+              << "\n" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::string baseUrl = argv[1];
+  std::string outputDir = argv[2];
+  int count = argc > 3 ? atoi(argv[3]) : 20;
+  count = count < 1 ? 1 : count;
+  std::string storeType = argc > 4 ? argv[4] : "file";
+
+  vtkSmartPointer<vtkMapTileStore> store;
+  store.TakeReference(NewStore(storeType));
+  if (!store->Open(outputDir))
+    {
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkMapTileDownloader> downloader;
+  downloader->SetNumberOfThreads(1);
+  downloader->SetStore(store);
+
+  const int zoom = 10;
+  std::vector<double> latencies;
+  int failures = 0;
+  for (int i = 0; i < count; ++i)
+    {
+    std::ostringstream url;
+    url << baseUrl << "/" << zoom << "/" << i << "/0.png";
+
+    double start = vtksys::SystemTools::GetTime();
+    downloader->RequestTile(zoom, i, 0, url.str());
+    std::vector<vtkMapTileDownloader::Request> completed;
+    while (completed.empty())
+      {
+      vtksys::SystemTools::Delay(1);
+      downloader->GetCompletedRequests(completed);
+      }
+    latencies.push_back(vtksys::SystemTools::GetTime() - start);
+    failures += completed[0].Succeeded ? 0 : 1;
+    }
+  downloader->Stop();
+  downloader->SetStore(NULL);
+
+  // Cold start: open the store again and look up every tile
+  double start = vtksys::SystemTools::GetTime();
+  store.TakeReference(NewStore(storeType));
+  store->Open(outputDir);
+  int found = 0;
+  for (int i = 0; i < count; ++i)
+    {
+    found += store->HasTile(zoom, i, 0) ? 1 : 0;
+    }
+  double lookup = vtksys::SystemTools::GetTime() - start;
+
+  double warm = 0.0;
+  for (size_t i = 1; i < latencies.size(); ++i)
+    {
+    warm += latencies[i];
+    }
+  if (latencies.size() > 1)
+    {
+    warm /= static_cast<double>(latencies.size() - 1);
+    }
+
+  std::cout << "Tiles requested: " << count
+            << ", failed: " << failures << "\n"
+            << "First tile (cold connection): "
+            << 1000.0 * latencies[0] << " ms\n"
+            << "Other tiles (warm connection): "
+            << 1000.0 * warm << " ms average\n"
+            << "Reopening the " << storeType << " store and finding "
+            << found << " tiles: " << 1000.0 * lookup << " ms" << std::endl;
+
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  return BenchmarkTileDownload(argc, argv);
+}
@@ -0,0 +1,167 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    TestMapHashTable.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapHashTable.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+//----------------------------------------------------------------------------
+namespace
+{
+  typedef vtkMapHashTable<int> Table;
+  typedef std::map<vtkTypeUInt64, int> Reference;
+
+  // Keys from a fixed sequence. Few distinct keys, so that keys are
+  // often added again and erased while in the table, with some at the
+  // ends of the key range.
+  class KeySequence
+  {
+  public:
+    KeySequence() : State(1) {}
+    vtkTypeUInt64 Next(int distinctKeys)
+    {
+      this->State = this->State * 6364136223846793005ULL +
+        1442695040888963407ULL;
+      vtkTypeUInt64 key = (this->State >> 33) % distinctKeys;
+      // Keep clear of the reserved all-ones key
+      return key % 7 == 0 ? ~key - 1 : key;
+    }
+    vtkTypeUInt64 State;
+  };
+
+  // The table holds the same entries as the reference, which the slot
+  // iteration visits once each
+  int compare(const Table& table, const Reference& reference)
+  {
+    int errors = 0;
+    if (table.GetNumberOfEntries() != reference.size())
+      {
+      std::cerr << "The table has " << table.GetNumberOfEntries()
+                << " entries, expected " << reference.size() << std::endl;
+      ++errors;
+      }
+    size_t visited = 0;
+    for (size_t i = 0; i < table.GetNumberOfSlots(); ++i)
+      {
+      if (!table.IsSlotUsed(i))
+        {
+        continue;
+        }
+      ++visited;
+      Reference::const_iterator iter = reference.find(table.GetSlotKey(i));
+      if (iter == reference.end() || iter->second != table.GetSlotValue(i))
+        {
+        std::cerr << "Slot " << i << " holds an unexpected entry"
+                  << std::endl;
+        ++errors;
+        }
+      }
+    if (visited != reference.size())
+      {
+      std::cerr << "Visited " << visited << " entries, expected "
+                << reference.size() << std::endl;
+      ++errors;
+      }
+    Reference::const_iterator iter = reference.begin();
+    for (; iter != reference.end(); ++iter)
+      {
+      const int *value = table.Find(iter->first);
+      if (!value || *value != iter->second)
+        {
+        std::cerr << "Key " << iter->first << " not found" << std::endl;
+        ++errors;
+        }
+      }
+    return errors;
+  }
+
+  // Inserts and erases keys at random, checking each result against a
+  // std::map. Erasing shifts entries back along their probe sequence,
+  // which must keep every other key reachable.
+  int exercise(Table& table, int distinctKeys, int operations)
+  {
+    Reference reference;
+    KeySequence keys;
+    int errors = 0;
+    for (int i = 0; i < operations && errors < 10; ++i)
+      {
+      vtkTypeUInt64 key = keys.Next(distinctKeys);
+      bool present = reference.count(key) != 0;
+      if (i % 3 == 0)
+        {
+        int value = -1;
+        bool erased = table.Erase(key, &value);
+        if (erased != present || (present && value != reference[key]))
+          {
+          std::cerr << "Erasing key " << key << " failed" << std::endl;
+          ++errors;
+          }
+        reference.erase(key);
+        }
+      else
+        {
+        std::pair<int*, bool> inserted = table.Insert(key, i);
+        if (inserted.second == present ||
+            *inserted.first != (present ? reference[key] : i))
+          {
+          std::cerr << "Inserting key " << key << " failed" << std::endl;
+          ++errors;
+          }
+        reference.insert(std::make_pair(key, i));
+        }
+      if (i % 1000 == 0)
+        {
+        errors += compare(table, reference);
+        }
+      }
+    errors += compare(table, reference);
+    return errors;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Checks vtkMapHashTable against std::map, with tables kept small so that
+// probe sequences collide and wrap around the end of the table, and with
+// a table grown to thousands of entries.
+int TestMapHashTable(int, char *[])
+{
+  int errors = 0;
+
+  Table small;
+  errors += exercise(small, 24, 20000);
+
+  Table large;
+  errors += exercise(large, 5000, 50000);
+
+  // Clearing empties the table, which is usable again
+  large.Clear();
+  if (large.GetNumberOfEntries() != 0 || large.Find(1) ||
+      large.Erase(1))
+    {
+    std::cerr << "The cleared table is not empty" << std::endl;
+    ++errors;
+    }
+  errors += exercise(large, 100, 5000);
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  return TestMapHashTable(argc, argv);
+}
@@ -0,0 +1,226 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    TestMapMarkerClustering.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapMarkerSet.h"
+
+#include <vtkNew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+//----------------------------------------------------------------------------
+namespace
+{
+  const int numberOfLevels = 20;
+
+  // Groups of markers a few meters across, one degree apart, so that
+  // from zoom level 8 to 15 each group is exactly one cluster. There are
+  // enough to be clustered on two threads, and the strips are split
+  // across the groups of the middle column.
+  const int groupRows = 15;
+  const int groupColumns = 7;
+  const int groupSize = 25;
+
+  void makeGroups(std::vector<double>& latitudes,
+                  std::vector<double>& longitudes)
+  {
+    for (int k = 0; k < groupSize; ++k)
+      {
+      for (int row = 0; row < groupRows; ++row)
+        {
+        for (int column = 0; column < groupColumns; ++column)
+          {
+          double angle = 0.5 * k;
+          latitudes.push_back(row + 0.00004 * k * std::sin(angle));
+          longitudes.push_back(column + 0.00004 * k * std::cos(angle));
+          }
+        }
+      }
+  }
+
+  // Markers spread over the United States, from a fixed sequence
+  void makeSpread(int count, std::vector<double>& latitudes,
+                  std::vector<double>& longitudes)
+  {
+    unsigned int state = 12345;
+    for (int i = 0; i < count; ++i)
+      {
+      state = state * 1103515245u + 12345u;
+      latitudes.push_back(25.0 + 24.0 * ((state >> 8) % 10000) / 10000.0);
+      state = state * 1103515245u + 12345u;
+      longitudes.push_back(-125.0 + 58.0 * ((state >> 8) % 10000) / 10000.0);
+      }
+  }
+
+  std::vector<int> clusterSizes(vtkMapMarkerSet *markers, int level)
+  {
+    std::vector<int> sizes;
+    markers->GetClusterSizes(level, sizes);
+    std::sort(sizes.begin(), sizes.end());
+    return sizes;
+  }
+
+  // Every level holds all the markers, and the bottom level holds them
+  // one by one
+  int checkLevels(vtkMapMarkerSet *markers, const char *name)
+  {
+    int errors = 0;
+    for (int level = 0; level < numberOfLevels; ++level)
+      {
+      std::vector<int> sizes = clusterSizes(markers, level);
+      int total = 0;
+      for (size_t i = 0; i < sizes.size(); ++i)
+        {
+        total += sizes[i];
+        }
+      if (total != markers->GetNumberOfMarkers())
+        {
+        std::cerr << name << ": level " << level << " holds " << total
+                  << " markers, expected " << markers->GetNumberOfMarkers()
+                  << std::endl;
+        ++errors;
+        }
+      }
+    std::vector<int> bottom = clusterSizes(markers, numberOfLevels - 1);
+    if (static_cast<int>(bottom.size()) != markers->GetNumberOfMarkers() ||
+        (!bottom.empty() && bottom.back() != 1))
+      {
+      std::cerr << name << ": markers are clustered at the bottom level"
+                << std::endl;
+      ++errors;
+      }
+    return errors;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Checks that markers added in batches are clustered the same however
+// the batches are split, and like markers added one at a time where
+// the clusters are unambiguous. Then checks that batches clustered on
+// several threads match those clustered on one.
+int TestMapMarkerClustering(int vtkNotUsed(argc), char *vtkNotUsed(argv)[])
+{
+  int errors = 0;
+
+  // Groups added one at a time, in one batch and on two threads
+  std::vector<double> latitudes;
+  std::vector<double> longitudes;
+  makeGroups(latitudes, longitudes);
+  int count = static_cast<int>(latitudes.size());
+
+  vtkNew<vtkMapMarkerSet> single;
+  single->ClusteringOn();
+  for (int i = 0; i < count; ++i)
+    {
+    single->AddMarker(latitudes[i], longitudes[i]);
+    }
+  vtkNew<vtkMapMarkerSet> batch;
+  batch->ClusteringOn();
+  if (batch->AddMarkers(count, &latitudes[0], &longitudes[0]) != 0)
+    {
+    std::cerr << "The first marker id is not 0" << std::endl;
+    ++errors;
+    }
+  vtkNew<vtkMapMarkerSet> threaded;
+  threaded->ClusteringOn();
+  threaded->SetNumberOfThreads(2);
+  threaded->AddMarkers(count, &latitudes[0], &longitudes[0]);
+  errors += checkLevels(single.GetPointer(), "One at a time");
+  errors += checkLevels(batch.GetPointer(), "Batch");
+  errors += checkLevels(threaded.GetPointer(), "Threaded batch");
+
+  // The groups cut by the strip edge are merged back
+  std::vector<int> groups(groupRows * groupColumns, groupSize);
+  for (int level = 8; level <= 15; ++level)
+    {
+    if (clusterSizes(single.GetPointer(), level) != groups ||
+        clusterSizes(batch.GetPointer(), level) != groups ||
+        clusterSizes(threaded.GetPointer(), level) != groups)
+      {
+      std::cerr << "The groups are not clustered at level " << level
+                << std::endl;
+      ++errors;
+      }
+    }
+
+  // Spread markers in one batch, and in a small batch followed by a
+  // larger one, which rebuilds the clusters
+  latitudes.clear();
+  longitudes.clear();
+  makeSpread(5000, latitudes, longitudes);
+  vtkNew<vtkMapMarkerSet> whole;
+  whole->ClusteringOn();
+  whole->AddMarkers(5000, &latitudes[0], &longitudes[0]);
+  vtkNew<vtkMapMarkerSet> split;
+  split->ClusteringOn();
+  split->AddMarkers(2000, &latitudes[0], &longitudes[0]);
+  if (split->AddMarkers(3000, &latitudes[2000], &longitudes[2000]) != 2000)
+    {
+    std::cerr << "The second batch does not start at id 2000" << std::endl;
+    ++errors;
+    }
+  errors += checkLevels(whole.GetPointer(), "Whole batch");
+  errors += checkLevels(split.GetPointer(), "Split batches");
+  for (int level = 0; level < numberOfLevels; ++level)
+    {
+    if (clusterSizes(whole.GetPointer(), level) !=
+        clusterSizes(split.GetPointer(), level))
+      {
+      std::cerr << "Split batches are clustered differently at level "
+                << level << std::endl;
+      ++errors;
+      }
+    }
+
+  // On four threads, clusters only differ near the strip edges, by a
+  // handful at the levels with many clusters
+  vtkNew<vtkMapMarkerSet> parallel;
+  parallel->ClusteringOn();
+  parallel->SetNumberOfThreads(4);
+  parallel->AddMarkers(5000, &latitudes[0], &longitudes[0]);
+  errors += checkLevels(parallel.GetPointer(), "Parallel batch");
+  for (int level = 8; level < numberOfLevels; ++level)
+    {
+    int serialCount =
+      static_cast<int>(clusterSizes(whole.GetPointer(), level).size());
+    int parallelCount =
+      static_cast<int>(clusterSizes(parallel.GetPointer(), level).size());
+    if (std::abs(parallelCount - serialCount) > serialCount / 100)
+      {
+      std::cerr << "Level " << level << " has " << parallelCount
+                << " clusters on four threads, and " << serialCount
+                << " on one" << std::endl;
+      ++errors;
+      }
+    }
+
+  // A batch smaller than the set is inserted one marker at a time
+  vtkNew<vtkMapMarkerSet> inserted;
+  inserted->ClusteringOn();
+  inserted->AddMarkers(4000, &latitudes[0], &longitudes[0]);
+  inserted->AddMarkers(1000, &latitudes[4000], &longitudes[4000]);
+  errors += checkLevels(inserted.GetPointer(), "Inserted batch");
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  return TestMapMarkerClustering(argc, argv);
+}
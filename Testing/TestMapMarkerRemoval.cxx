@@ -0,0 +1,143 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    TestMapMarkerRemoval.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapMarkerSet.h"
+
+#include <vtkNew.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+//----------------------------------------------------------------------------
+namespace
+{
+  // Markers are clustered within 80 pixels, about 0.11 degrees at zoom
+  // level 10
+  const int zoom = 10;
+  const double clusterDistance = 80.0 * 360.0 / 256.0 / (1 << zoom);
+
+  // Along the equator, in cluster distances: marker 0 alone, markers 1
+  // to 4 together 0.8 away, and markers 5 to 7 together 1.5 away. At
+  // the zoom level, markers 1 to 4 hold all eight in one cluster. One
+  // zoom level in, the three groups are apart.
+  const int numberOfMarkers = 8;
+  const double positions[numberOfMarkers] =
+    { 0.0, 0.8, 0.8, 0.8, 0.8, 1.5, 1.5, 1.5 };
+
+  int checkSizes(vtkMapMarkerSet *markers, int level, const int *expected,
+                 size_t count, const char *name)
+  {
+    std::vector<int> sizes;
+    markers->GetClusterSizes(level, sizes);
+    std::sort(sizes.begin(), sizes.end());
+    if (sizes == std::vector<int>(expected, expected + count))
+      {
+      return 0;
+      }
+    std::cerr << name << ": level " << level << " has clusters of";
+    for (size_t i = 0; i < sizes.size(); ++i)
+      {
+      std::cerr << " " << sizes[i];
+      }
+    std::cerr << ", expected";
+    for (size_t i = 0; i < count; ++i)
+      {
+      std::cerr << " " << expected[i];
+      }
+    std::cerr << std::endl;
+    return 1;
+  }
+
+  // Removes markers 1 to 4, one at a time. Marker 0 ends up too far
+  // from the rest of the cluster, and must be split off from it.
+  int removeMiddle(vtkMapMarkerSet *markers, const char *name)
+  {
+    const int together[] = { 8 };
+    const int groups[] = { 1, 3, 4 };
+    int errors = checkSizes(markers, zoom, together, 1, name);
+    errors += checkSizes(markers, zoom + 1, groups, 3, name);
+
+    for (int id = 1; id <= 4; ++id)
+      {
+      if (!markers->RemoveMarker(id) ||
+          markers->GetNumberOfMarkers() != numberOfMarkers - id)
+        {
+        std::cerr << name << ": marker " << id << " was not removed"
+                  << std::endl;
+        ++errors;
+        }
+      std::vector<int> sizes;
+      markers->GetClusterSizes(zoom, sizes);
+      int total = 0;
+      for (size_t i = 0; i < sizes.size(); ++i)
+        {
+        total += sizes[i];
+        }
+      if (total != numberOfMarkers - id || sizes.size() > 2)
+        {
+        std::cerr << name << ": after removing marker " << id
+                  << ", level " << zoom << " has " << sizes.size()
+                  << " clusters of " << total << " markers" << std::endl;
+        ++errors;
+        }
+      }
+
+    // Marker 0 is still within the cluster distance of the others one
+    // zoom level out
+    const int split[] = { 1, 3 };
+    const int merged[] = { 4 };
+    errors += checkSizes(markers, zoom, split, 2, name);
+    errors += checkSizes(markers, zoom + 1, split, 2, name);
+    errors += checkSizes(markers, zoom - 1, merged, 1, name);
+    return errors;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Removes markers from a cluster until it splits, for markers added one
+// at a time and in a batch, and checks the cluster sizes on the way.
+int TestMapMarkerRemoval(int vtkNotUsed(argc), char *vtkNotUsed(argv)[])
+{
+  std::vector<double> latitudes(numberOfMarkers, 0.0);
+  std::vector<double> longitudes;
+  for (int i = 0; i < numberOfMarkers; ++i)
+    {
+    longitudes.push_back(positions[i] * clusterDistance);
+    }
+
+  int errors = 0;
+  vtkNew<vtkMapMarkerSet> single;
+  single->ClusteringOn();
+  for (int i = 0; i < numberOfMarkers; ++i)
+    {
+    single->AddMarker(latitudes[i], longitudes[i]);
+    }
+  errors += removeMiddle(single.GetPointer(), "One at a time");
+
+  vtkNew<vtkMapMarkerSet> batch;
+  batch->ClusteringOn();
+  batch->AddMarkers(numberOfMarkers, &latitudes[0], &longitudes[0]);
+  errors += removeMiddle(batch.GetPointer(), "Batch");
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  return TestMapMarkerRemoval(argc, argv);
+}
@@ -0,0 +1,145 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    TestMapTileCache.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileCache.h"
+
+#include <vtksys/SystemTools.hxx>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+//----------------------------------------------------------------------------
+namespace
+{
+  const vtkTypeInt64 tileSize = 100000;
+
+  std::string tileKey(int i)
+  {
+    std::ostringstream key;
+    key << "10/" << i << "/0";
+    return key.str();
+  }
+
+  // Write the file of a tile and report it to the cache
+  void addTile(vtkMapTileCache *cache, int i)
+  {
+    std::string fileName = cache->GetTileFileName(tileKey(i));
+    vtksys::SystemTools::MakeDirectory(
+      vtksys::SystemTools::GetFilenamePath(fileName).c_str());
+    std::ofstream out(fileName.c_str(), std::ios::out | std::ios::binary);
+    out << std::string(static_cast<size_t>(tileSize), 'x');
+    out.close();
+    cache->AddTile(tileKey(i), tileSize);
+  }
+
+  // The cache works in the background, wait until it reached
+  // the given state
+  bool waitFor(vtkMapTileCache *cache, int tiles, vtkTypeInt64 size)
+  {
+    for (int i = 0; i < 1000; ++i)
+      {
+      if (cache->GetNumberOfTiles() == tiles && cache->GetSize() == size)
+        {
+        return true;
+        }
+      vtksys::SystemTools::Delay(10);
+      }
+    std::cerr << "Expected " << tiles << " tiles of " << size
+              << " bytes, found " << cache->GetNumberOfTiles()
+              << " tiles of " << cache->GetSize() << " bytes" << std::endl;
+    return false;
+  }
+
+  bool tileExists(vtkMapTileCache *cache, int i)
+  {
+    return vtksys::SystemTools::FileExists(
+      cache->GetTileFileName(tileKey(i)).c_str());
+  }
+}
+
+//----------------------------------------------------------------------------
+// Fills a cache over its budget and checks that the least recently
+// used tiles, and only those, are evicted. Then reopens the cache and
+// checks that its index was saved.
+int TestMapTileCache(int argc, char *argv[])
+{
+  if (argc < 2)
+    {
+    std::cout << "Usage: TestMapTileCache scratchDirectory" << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::string directory = argv[1];
+  vtksys::SystemTools::RemoveADirectory(directory.c_str());
+  vtksys::SystemTools::MakeDirectory(directory.c_str());
+
+  vtkMapTileCache *cache = vtkMapTileCache::New();
+  cache->SetMaximumSize(1);
+  cache->SetLowWaterMark(0.9);
+  cache->SetDirectory(directory);
+
+  // Ten tiles fit the budget of 1 MB, the eleventh overflows it and
+  // the cache is trimmed to 90% of the budget, two tiles are evicted
+  for (int i = 0; i < 8; ++i)
+    {
+    addTile(cache, i);
+    }
+  cache->TouchTile(tileKey(0));
+  for (int i = 8; i < 11; ++i)
+    {
+    addTile(cache, i);
+    }
+  if (!waitFor(cache, 9, 9 * tileSize))
+    {
+    cache->Delete();
+    return EXIT_FAILURE;
+    }
+
+  int errors = 0;
+  for (int i = 0; i < 11; ++i)
+    {
+    // Tile 0 was used after tiles 1 and 2
+    bool evicted = i == 1 || i == 2;
+    if (tileExists(cache, i) == evicted)
+      {
+      std::cerr << "Tile " << tileKey(i) << " should "
+                << (evicted ? "" : "not ") << "have been evicted"
+                << std::endl;
+      ++errors;
+      }
+    }
+
+  // Deleting the cache saves its index, which a new cache loads
+  cache->Delete();
+  cache = vtkMapTileCache::New();
+  cache->SetMaximumSize(1);
+  cache->SetDirectory(directory);
+  if (!waitFor(cache, 9, 9 * tileSize))
+    {
+    ++errors;
+    }
+  cache->Delete();
+
+  vtksys::SystemTools::RemoveADirectory(directory.c_str());
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  return TestMapTileCache(argc, argv);
+}
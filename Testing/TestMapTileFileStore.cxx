@@ -0,0 +1,184 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    TestMapTileFileStore.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileCache.h"
+#include "vtkMapTileFileStore.h"
+
+#include <vtkMultiThreader.h>
+#include <vtkNew.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+//----------------------------------------------------------------------------
+namespace
+{
+  const int numberOfTiles = 200;
+  const int numberOfThreads = 4;
+  const int zoom = 8;
+
+  // Enough of a PNG image for the store: its signature, a body and
+  // its trailer
+  std::string tileImage(int i, int version)
+  {
+    std::ostringstream image;
+    image << "\x89PNG\r\n\x1a\n" << "tile " << i << " version " << version;
+    image << std::string(4, '\0') << "IEND\xae\x42\x60\x82";
+    return image.str();
+  }
+
+  bool checkTile(vtkMapTileFileStore *store, int i, std::string *image)
+  {
+    vtkMapTileStore::TileData data;
+    if (!store->ReadTile(zoom, i, 0, data))
+      {
+      return false;
+      }
+    if (image)
+      {
+      image->assign(reinterpret_cast<const char*>(data.Data), data.Length);
+      }
+    return true;
+  }
+
+  // Every thread writes every tile, several times
+  VTK_THREAD_RETURN_TYPE writeTiles(void *arg)
+  {
+    vtkMultiThreader::ThreadInfo *info =
+      static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+    vtkMapTileFileStore *store =
+      static_cast<vtkMapTileFileStore*>(info->UserData);
+    for (int round = 0; round < 5; ++round)
+      {
+      for (int i = 0; i < numberOfTiles; ++i)
+        {
+        std::string image = tileImage(i, info->ThreadID);
+        store->WriteTile(zoom, i, 0, image.data(), image.size());
+        }
+      }
+    return VTK_THREAD_RETURN_VALUE;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Writes the same tiles from several threads and checks that each tile
+// holds one whole image matching its checksum. Then checks the metadata
+// sidecars and that tiles changed behind the store's back are dropped.
+int TestMapTileFileStore(int argc, char *argv[])
+{
+  if (argc < 2)
+    {
+    std::cout << "Usage: TestMapTileFileStore scratchDirectory"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::string directory = argv[1];
+  vtksys::SystemTools::RemoveADirectory(directory.c_str());
+
+  vtkNew<vtkMapTileFileStore> store;
+  if (!store->Open(directory))
+    {
+    std::cerr << "Cannot open " << directory << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkMultiThreader> threader;
+  threader->SetNumberOfThreads(numberOfThreads);
+  threader->SetSingleMethod(writeTiles, store.GetPointer());
+  threader->SingleMethodExecute();
+
+  int errors = 0;
+  vtkTypeInt64 size = 0;
+  for (int i = 0; i < numberOfTiles; ++i)
+    {
+    std::string image;
+    if (!checkTile(store.GetPointer(), i, &image))
+      {
+      std::cerr << "Tile " << i << " is corrupted" << std::endl;
+      ++errors;
+      }
+    size += static_cast<vtkTypeInt64>(image.size());
+    }
+  vtkMapTileCache *cache = store->GetCache();
+  if (cache->GetNumberOfTiles() != numberOfTiles ||
+      cache->GetSize() != size)
+    {
+    std::cerr << "The cache holds " << cache->GetNumberOfTiles()
+              << " tiles of " << cache->GetSize() << " bytes, expected "
+              << numberOfTiles << " tiles of " << size << " bytes"
+              << std::endl;
+    ++errors;
+    }
+
+  // Metadata is kept in a sidecar that counts against the budget
+  vtkMapTileStore::TileMetadata metadata;
+  metadata.ETag = "\"1234\"";
+  metadata.LastModified = "Wed, 21 Oct 2015 07:28:00 GMT";
+  metadata.ExpirationTime = 1445412480.0;
+  vtkMapTileStore::TileMetadata read;
+  if (!store->SetTileMetadata(zoom, 0, 0, metadata) ||
+      !store->GetTileMetadata(zoom, 0, 0, read) ||
+      read.ETag != metadata.ETag ||
+      read.LastModified != metadata.LastModified ||
+      read.ExpirationTime != metadata.ExpirationTime)
+    {
+    std::cerr << "Tile metadata was not kept" << std::endl;
+    ++errors;
+    }
+  if (cache->GetSize() <= size)
+    {
+    std::cerr << "The metadata sidecar is not counted" << std::endl;
+    ++errors;
+    }
+
+  // A tile whose file no longer matches its checksum is removed
+  {
+  std::string image = tileImage(1, numberOfThreads);
+  std::ofstream out(store->GetTileFileName(zoom, 1, 0).c_str(),
+                    std::ios::out | std::ios::binary);
+  out << image;
+  }
+  if (checkTile(store.GetPointer(), 1, NULL) || store->HasTile(zoom, 1, 0))
+    {
+    std::cerr << "A tile not matching its checksum was read" << std::endl;
+    ++errors;
+    }
+
+  // So is a tile that is not a whole image
+  {
+  std::ofstream out(store->GetTileFileName(zoom, 2, 0).c_str(),
+                    std::ios::out | std::ios::binary);
+  out << tileImage(2, 0).substr(0, 12);
+  }
+  if (checkTile(store.GetPointer(), 2, NULL) || store->HasTile(zoom, 2, 0))
+    {
+    std::cerr << "A truncated tile was read" << std::endl;
+    ++errors;
+    }
+
+  cache->Stop();
+  vtksys::SystemTools::RemoveADirectory(directory.c_str());
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  return TestMapTileFileStore(argc, argv);
+}
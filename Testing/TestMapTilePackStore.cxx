@@ -0,0 +1,156 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    TestMapTilePackStore.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTilePackStore.h"
+
+#include <vtkNew.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+//----------------------------------------------------------------------------
+namespace
+{
+  // More tiles than the initial index holds, so that it grows
+  const int numberOfTiles = 40000;
+  const int zoom = 16;
+
+  std::string tileImage(int i, int version)
+  {
+    std::ostringstream image;
+    image << "tile " << i << " version " << version;
+    return image.str();
+  }
+
+  bool writeTile(vtkMapTilePackStore *store, int i, int version)
+  {
+    std::string image = tileImage(i, version);
+    return store->WriteTile(zoom, i % 256, i / 256, image.data(),
+                            image.size());
+  }
+
+  bool checkTile(vtkMapTilePackStore *store, int i, int version)
+  {
+    vtkMapTileStore::TileData data;
+    if (!store->ReadTile(zoom, i % 256, i / 256, data))
+      {
+      std::cerr << "Tile " << i << " not found" << std::endl;
+      return false;
+      }
+    std::string image(reinterpret_cast<const char*>(data.Data),
+                      data.Length);
+    if (image != tileImage(i, version))
+      {
+      std::cerr << "Tile " << i << " is \"" << image << "\", expected \""
+                << tileImage(i, version) << "\"" << std::endl;
+      return false;
+      }
+    return true;
+  }
+
+  // Reopen the store and check all the tiles, tile 0 has been replaced
+  int checkStore(vtkMapTilePackStore *store, const std::string& directory)
+  {
+    if (!store->Open(directory))
+      {
+      std::cerr << "Cannot open " << directory << std::endl;
+      return 1;
+      }
+    int errors = 0;
+    if (store->GetNumberOfTiles() != numberOfTiles)
+      {
+      std::cerr << "Found " << store->GetNumberOfTiles() << " tiles, "
+                << "expected " << numberOfTiles << std::endl;
+      ++errors;
+      }
+    for (int i = 0; i < numberOfTiles && errors < 10; ++i)
+      {
+      errors += checkTile(store, i, i == 0 ? 1 : 0) ? 0 : 1;
+      }
+    return errors;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Fills a pack store until its index grows, replaces a tile, and
+// checks the tiles after reopening the store, after losing the index
+// and after a record was cut short by a crash.
+int TestMapTilePackStore(int argc, char *argv[])
+{
+  if (argc < 2)
+    {
+    std::cout << "Usage: TestMapTilePackStore scratchDirectory"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::string directory = argv[1];
+  std::string packName = directory + "/tiles.pack";
+  std::string indexName = packName + ".idx";
+  vtksys::SystemTools::RemoveADirectory(directory.c_str());
+
+  vtkNew<vtkMapTilePackStore> store;
+  if (!store->Open(directory))
+    {
+    std::cerr << "Cannot open " << directory << std::endl;
+    return EXIT_FAILURE;
+    }
+  int errors = 0;
+  for (int i = 0; i < numberOfTiles && errors < 10; ++i)
+    {
+    errors += writeTile(store.GetPointer(), i, 0) ? 0 : 1;
+    }
+  errors += writeTile(store.GetPointer(), 0, 1) ? 0 : 1;
+  if (vtksys::SystemTools::FileExists((indexName + ".tmp").c_str()))
+    {
+    std::cerr << "The index grown was left in a temporary file"
+              << std::endl;
+    ++errors;
+    }
+  store->Close();
+  errors += checkStore(store.GetPointer(), directory);
+  store->Close();
+
+  // The index is rebuilt from the pack
+  vtksys::SystemTools::RemoveFile(indexName.c_str());
+  errors += checkStore(store.GetPointer(), directory);
+  store->Close();
+
+  // A record cut short is ignored, and overwritten by the next tile
+  {
+  std::ofstream pack(packName.c_str(),
+                     std::ios::out | std::ios::binary | std::ios::app);
+  vtkTypeUInt64 header[2] = { 0, 1000 };
+  pack.write(reinterpret_cast<const char*>(header), sizeof(header));
+  pack << "truncated";
+  }
+  errors += checkStore(store.GetPointer(), directory);
+  errors += writeTile(store.GetPointer(), 0, 1) ? 0 : 1;
+  store->Close();
+  errors += checkStore(store.GetPointer(), directory);
+  store->Close();
+
+  vtksys::SystemTools::RemoveADirectory(directory.c_str());
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  return TestMapTilePackStore(argc, argv);
+}
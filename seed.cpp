@@ -0,0 +1,623 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    seed.cpp
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// Downloads the tiles covering an area, over a range of zoom levels,
+// into a tile cache directory, so that vtkOsmLayer can show the area
+// without network access. Tiles already in the cache are skipped, and
+// a checkpoint file lets an interrupted run resume where it stopped.
+
+#include "vtkMapTileDownloader.h"
+#include "vtkMapTileCache.h"
+#include "vtkMapTileFileStore.h"
+#include "vtkMapTilePackStore.h"
+#include "vtkMercator.h"
+#include "vtkMapTile.h"
+
+#include <vtkSmartPointer.h>
+#include <vtk_jsoncpp.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  // Web Mercator tiles stop short of the poles
+  const double maximumLatitude = 85.0511287798;
+
+  const char checkpointMagic[] = "vtkMapSeed 1";
+
+  typedef std::vector<std::pair<double, double> > Ring;
+
+  //--------------------------------------------------------------------------
+  // Area to seed, a bounding box optionally refined by polygons,
+  // all in degrees
+  struct SeedArea
+  {
+    double Bounds[4];  // west, south, east, north
+    std::vector<Ring> Rings;
+
+    // Even-odd rule over all rings, so that holes are excluded
+    bool Contains(double lon, double lat) const
+    {
+      bool inside = false;
+      for (size_t r = 0; r < this->Rings.size(); ++r)
+        {
+        const Ring& ring = this->Rings[r];
+        for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++)
+          {
+          if ((ring[i].second > lat) != (ring[j].second > lat) &&
+              lon < (ring[j].first - ring[i].first) * (lat - ring[i].second) /
+                (ring[j].second - ring[i].second) + ring[i].first)
+            {
+            inside = !inside;
+            }
+          }
+        }
+      return inside;
+    }
+
+    // Returns true if the segment pq crosses the rectangle, by clipping
+    // it against each side in turn
+    static bool Crosses(const std::pair<double, double>& p,
+                        const std::pair<double, double>& q,
+                        const double rect[4])
+    {
+      double t0 = 0.0, t1 = 1.0;
+      double d[2] = { q.first - p.first, q.second - p.second };
+      double o[2] = { p.first, p.second };
+      for (int axis = 0; axis < 2; ++axis)
+        {
+        double lower = rect[axis], upper = rect[axis + 2];
+        if (d[axis] == 0.0)
+          {
+          if (o[axis] < lower || o[axis] > upper)
+            {
+            return false;
+            }
+          continue;
+          }
+        double a = (lower - o[axis]) / d[axis];
+        double b = (upper - o[axis]) / d[axis];
+        t0 = std::max(t0, std::min(a, b));
+        t1 = std::min(t1, std::max(a, b));
+        if (t0 > t1)
+          {
+          return false;
+          }
+        }
+      return true;
+    }
+
+    // rect is west, south, east, north
+    bool Intersects(const double rect[4]) const
+    {
+      if (this->Rings.empty())
+        {
+        return true;
+        }
+      if (this->Contains(0.5 * (rect[0] + rect[2]),
+                         0.5 * (rect[1] + rect[3])))
+        {
+        return true;
+        }
+      for (size_t r = 0; r < this->Rings.size(); ++r)
+        {
+        const Ring& ring = this->Rings[r];
+        for (size_t i = 1; i < ring.size(); ++i)
+          {
+          if (Crosses(ring[i - 1], ring[i], rect))
+            {
+            return true;
+            }
+          }
+        }
+      return false;
+    }
+  };
+
+  //--------------------------------------------------------------------------
+  void addRing(const Json::Value& coordinates, SeedArea& area)
+  {
+    Ring ring;
+    for (Json::ArrayIndex i = 0; i < coordinates.size(); ++i)
+      {
+      const Json::Value& point = coordinates[i];
+      if (point.isArray() && point.size() >= 2)
+        {
+        ring.push_back(std::make_pair(point[0u].asDouble(),
+                                      point[1u].asDouble()));
+        }
+      }
+    if (ring.size() >= 3)
+      {
+      area.Rings.push_back(ring);
+      }
+  }
+
+  //--------------------------------------------------------------------------
+  // Collect the rings of every polygon in a GeoJSON object
+  void addGeometry(const Json::Value& object, SeedArea& area)
+  {
+    std::string type = object["type"].asString();
+    if (type == "FeatureCollection")
+      {
+      const Json::Value& features = object["features"];
+      for (Json::ArrayIndex i = 0; i < features.size(); ++i)
+        {
+        addGeometry(features[i], area);
+        }
+      }
+    else if (type == "Feature")
+      {
+      addGeometry(object["geometry"], area);
+      }
+    else if (type == "GeometryCollection")
+      {
+      const Json::Value& geometries = object["geometries"];
+      for (Json::ArrayIndex i = 0; i < geometries.size(); ++i)
+        {
+        addGeometry(geometries[i], area);
+        }
+      }
+    else if (type == "Polygon")
+      {
+      const Json::Value& rings = object["coordinates"];
+      for (Json::ArrayIndex i = 0; i < rings.size(); ++i)
+        {
+        addRing(rings[i], area);
+        }
+      }
+    else if (type == "MultiPolygon")
+      {
+      const Json::Value& polygons = object["coordinates"];
+      for (Json::ArrayIndex i = 0; i < polygons.size(); ++i)
+        {
+        for (Json::ArrayIndex j = 0; j < polygons[i].size(); ++j)
+          {
+          addRing(polygons[i][j], area);
+          }
+        }
+      }
+    }
+
+  //--------------------------------------------------------------------------
+  bool readPolygon(const std::string& fileName, SeedArea& area)
+  {
+    std::ifstream file(fileName.c_str());
+    Json::Value root;
+    Json::Reader reader;
+    if (!file || !reader.parse(file, root))
+      {
+      std::cerr << "Cannot read GeoJSON file " << fileName << std::endl;
+      return false;
+      }
+
+    addGeometry(root, area);
+    if (area.Rings.empty())
+      {
+      std::cerr << "No polygon in " << fileName << std::endl;
+      return false;
+      }
+
+    area.Bounds[0] = area.Bounds[1] = VTK_DOUBLE_MAX;
+    area.Bounds[2] = area.Bounds[3] = -VTK_DOUBLE_MAX;
+    for (size_t r = 0; r < area.Rings.size(); ++r)
+      {
+      for (size_t i = 0; i < area.Rings[r].size(); ++i)
+        {
+        const std::pair<double, double>& point = area.Rings[r][i];
+        area.Bounds[0] = std::min(area.Bounds[0], point.first);
+        area.Bounds[1] = std::min(area.Bounds[1], point.second);
+        area.Bounds[2] = std::max(area.Bounds[2], point.first);
+        area.Bounds[3] = std::max(area.Bounds[3], point.second);
+        }
+      }
+    return true;
+  }
+
+  //--------------------------------------------------------------------------
+  // Walks the tiles covering the area, zoom level by zoom level, column
+  // by column, row by row from the north. Position counts every tile of
+  // the walk, so that a checkpoint names the same tile in a later run.
+  class TileWalk
+  {
+  public:
+    TileWalk(const SeedArea& area, int minZoom, int maxZoom)
+      : Area(area), Zoom(minZoom - 1), MaxZoom(maxZoom), Position(0)
+    {
+      this->X = this->XMax = this->Row = this->RowMax = this->RowMin = 0;
+    }
+
+    // Returns the next tile intersecting the area, with y counted from
+    // the south like vtkOsmLayer, or false at the end of the walk
+    bool Next(int& zoom, int& x, int& y, vtkTypeUInt64& position)
+    {
+      while (true)
+        {
+        if (!this->Advance())
+          {
+          return false;
+          }
+        ++this->Position;
+
+        double rect[4];
+        rect[0] = vtkMercator::tilex2long(this->X, this->Zoom);
+        rect[1] = vtkMercator::tiley2lat(this->Row + 1, this->Zoom);
+        rect[2] = vtkMercator::tilex2long(this->X + 1, this->Zoom);
+        rect[3] = vtkMercator::tiley2lat(this->Row, this->Zoom);
+        if (this->Area.Intersects(rect))
+          {
+          zoom = this->Zoom;
+          x = this->X;
+          y = (1 << this->Zoom) - 1 - this->Row;
+          position = this->Position;
+          return true;
+          }
+        }
+    }
+
+  private:
+    // Move to the next tile of the bounding box range
+    bool Advance()
+    {
+      if (this->Zoom >= 0 && this->Zoom <= this->MaxZoom)
+        {
+        if (this->Row < this->RowMax)
+          {
+          ++this->Row;
+          return true;
+          }
+        if (this->X < this->XMax)
+          {
+          ++this->X;
+          this->Row = this->RowMin;
+          return true;
+          }
+        }
+      if (++this->Zoom > this->MaxZoom)
+        {
+        return false;
+        }
+
+      const double *b = this->Area.Bounds;
+      int last = (1 << this->Zoom) - 1;
+      double north = std::min(b[3], maximumLatitude);
+      double south = std::max(b[1], -maximumLatitude);
+      this->X = std::max(0, vtkMercator::long2tilex(b[0], this->Zoom));
+      this->XMax = std::min(last, vtkMercator::long2tilex(b[2], this->Zoom));
+      this->RowMin = std::max(0, vtkMercator::lat2tiley(north, this->Zoom));
+      this->RowMax =
+        std::min(last, vtkMercator::lat2tiley(south, this->Zoom));
+      this->Row = this->RowMin;
+      return true;
+    }
+
+    const SeedArea& Area;
+    int Zoom;
+    int MaxZoom;
+    int X;
+    int XMax;
+    int Row;
+    int RowMin;
+    int RowMax;
+    vtkTypeUInt64 Position;
+  };
+
+  //--------------------------------------------------------------------------
+  // The checkpoint holds the position of the walk before which every
+  // tile was stored, for the arguments the run was started with
+  vtkTypeUInt64 readCheckpoint(const std::string& fileName,
+                               const std::string& signature)
+  {
+    std::ifstream file(fileName.c_str());
+    std::string magic, fileSignature;
+    vtkTypeUInt64 position = 0;
+    if (!std::getline(file, magic) || magic != checkpointMagic ||
+        !std::getline(file, fileSignature) || fileSignature != signature ||
+        !(file >> position))
+      {
+      return 0;
+      }
+    return position;
+  }
+
+  //--------------------------------------------------------------------------
+  void writeCheckpoint(const std::string& fileName,
+                       const std::string& signature, vtkTypeUInt64 position)
+  {
+    // Replace the file in one step, an interrupted write keeps the
+    // previous checkpoint
+    std::string tempName = fileName + ".tmp";
+    {
+    std::ofstream file(tempName.c_str());
+    file << checkpointMagic << "\n" << signature << "\n" << position << "\n";
+    if (!file)
+      {
+      return;
+      }
+    }
+#ifdef _WIN32
+    remove(fileName.c_str());
+#endif
+    rename(tempName.c_str(), fileName.c_str());
+  }
+
+  //--------------------------------------------------------------------------
+  void printUsage()
+  {
+    std::cout
+      << "\n"
+      << "Download the tiles covering an area into a tile cache directory."
+      << "\n"
+      << "Usage: seed baseUrl cacheDirectory minZoom maxZoom\n"
+      << "         (--bbox west south east north | --polygon file.geojson)\n"
+      << "         [--rate requestsPerSecond] [--threads count]\n"
+      << "         [--store file|pack] [--budget megabytes]\n"
+      << "  e.g. seed http://localhost:8000 ~/.vtkmap/osm 0 12"
+      << " --bbox -74.3 40.5 -73.7 40.9\n"
+      << "\n"
+      << "Tiles are fetched from baseUrl/zoom/x/y.png, at most rate requests\n"
+      << "per second, retries included, default 4, by threads downloads at\n"
+      << "a time, default 2. Seed from your own tile server, public servers\n"
+      << "forbid bulk downloads. Run again with the same arguments to resume.\n"
+      << "A file store is trimmed to the budget of its cache, default\n"
+      << "unlimited, which is saved in the cache directory and used by\n"
+      << "the applications opening it.\n"
+      << std::endl;
+  }
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  if (argc < 7)
+    {
+    printUsage();
+    return EXIT_FAILURE;
+    }
+
+  std::string baseUrl = argv[1];
+  std::string cacheDirectory = argv[2];
+  int minZoom = std::max(0, atoi(argv[3]));
+  int maxZoom = std::min(20, atoi(argv[4]));
+  double rate = 4.0;
+  int threads = 2;
+  int budget = 1048576;
+  std::string storeType = "file";
+  std::string areaArguments;
+  SeedArea area;
+  bool hasArea = false;
+  for (int i = 5; i < argc; ++i)
+    {
+    std::string option = argv[i];
+    if (option == "--bbox" && i + 4 < argc)
+      {
+      std::ostringstream oss;
+      oss << option;
+      for (int k = 0; k < 4; ++k)
+        {
+        area.Bounds[k] = atof(argv[++i]);
+        oss << " " << area.Bounds[k];
+        }
+      areaArguments = oss.str();
+      hasArea = area.Bounds[0] < area.Bounds[2] &&
+        area.Bounds[1] < area.Bounds[3];
+      }
+    else if (option == "--polygon" && i + 1 < argc)
+      {
+      std::string fileName = argv[++i];
+      if (!readPolygon(fileName, area))
+        {
+        return EXIT_FAILURE;
+        }
+      areaArguments = option + " " +
+        vtksys::SystemTools::CollapseFullPath(fileName.c_str());
+      hasArea = true;
+      }
+    else if (option == "--rate" && i + 1 < argc)
+      {
+      rate = std::max(0.1, atof(argv[++i]));
+      }
+    else if (option == "--threads" && i + 1 < argc)
+      {
+      threads = atoi(argv[++i]);
+      }
+    else if (option == "--store" && i + 1 < argc)
+      {
+      storeType = argv[++i];
+      }
+    else if (option == "--budget" && i + 1 < argc)
+      {
+      budget = atoi(argv[++i]);
+      }
+    else
+      {
+      std::cerr << "Unknown or incomplete option " << option << std::endl;
+      printUsage();
+      return EXIT_FAILURE;
+      }
+    }
+  if (!hasArea || minZoom > maxZoom)
+    {
+    printUsage();
+    return EXIT_FAILURE;
+    }
+
+  vtkSmartPointer<vtkMapTileStore> store;
+  if (storeType == "pack")
+    {
+    store.TakeReference(vtkMapTilePackStore::New());
+    }
+  else
+    {
+    store.TakeReference(vtkMapTileFileStore::New());
+    }
+  vtksys::SystemTools::MakeDirectory(cacheDirectory.c_str());
+  if (!store->Open(cacheDirectory))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // Opening the store adopted the budget of an earlier run, the new
+  // one is saved for the applications using the cache
+  vtkMapTileFileStore *fileStore =
+    vtkMapTileFileStore::SafeDownCast(store);
+  if (fileStore)
+    {
+    fileStore->GetCache()->SetMaximumSize(budget);
+    if (!fileStore->GetCache()->SaveMaximumSize())
+      {
+      return EXIT_FAILURE;
+      }
+    }
+
+  vtkSmartPointer<vtkMapTileDownloader> downloader =
+    vtkSmartPointer<vtkMapTileDownloader>::New();
+  downloader->SetNumberOfThreads(threads);
+  downloader->SetMaximumRequestRate(rate);
+  // The tiles are only stored, never drawn
+  downloader->DecodeImagesOff();
+  downloader->SetStore(store);
+
+  // Resume after the last checkpoint of a run with the same arguments
+  std::ostringstream signature;
+  signature << baseUrl << " " << minZoom << " " << maxZoom << " "
+            << areaArguments;
+  std::string checkpointName = cacheDirectory + "/seed.checkpoint";
+  vtkTypeUInt64 resume = readCheckpoint(checkpointName, signature.str());
+  if (resume > 0)
+    {
+    std::cout << "Resuming after tile " << resume << " of the walk"
+              << std::endl;
+    }
+
+  // The downloader sends requests at most rate per second. Keep a few
+  // queued per thread so that it never idles.
+  TileWalk walk(area, minZoom, maxZoom);
+  const size_t maximumQueued = 4 * static_cast<size_t>(
+    downloader->GetNumberOfThreads());
+  std::map<vtkTypeUInt64, vtkTypeUInt64> queued;  // tile id to position
+  std::set<vtkTypeUInt64> failedPositions;
+  vtkTypeUInt64 walked = 0, skipped = 0, stored = 0, failed = 0;
+  double start = vtksys::SystemTools::GetTime();
+  double lastReport = start, lastCheckpoint = start;
+  bool walking = true;
+  int zoom = minZoom, x = 0, y = 0;
+  vtkTypeUInt64 position = 0;
+
+  while (walking || !queued.empty())
+    {
+    double now = vtksys::SystemTools::GetTime();
+    while (walking && queued.size() < maximumQueued)
+      {
+      if (!walk.Next(zoom, x, y, position))
+        {
+        walking = false;
+        break;
+        }
+      ++walked;
+      if (position <= resume || store->HasTile(zoom, x, y))
+        {
+        ++skipped;
+        continue;
+        }
+
+      std::ostringstream url;
+      url << baseUrl << "/" << zoom << "/" << x << "/"
+          << ((1 << zoom) - 1 - y) << ".png";
+      downloader->RequestTile(zoom, x, y, url.str());
+      queued[vtkMapTile::ComputeTileId(zoom, x, y)] = position;
+      }
+
+    std::vector<vtkMapTileDownloader::Request> completed;
+    downloader->GetCompletedRequests(completed);
+    for (size_t i = 0; i < completed.size(); ++i)
+      {
+      const vtkMapTileDownloader::Request& request = completed[i];
+      std::map<vtkTypeUInt64, vtkTypeUInt64>::iterator iter = queued.find(
+        vtkMapTile::ComputeTileId(request.Zoom, request.X, request.Y));
+      if (iter == queued.end())
+        {
+        continue;
+        }
+      if (request.Succeeded)
+        {
+        ++stored;
+        }
+      else
+        {
+        ++failed;
+        failedPositions.insert(iter->second);
+        std::cerr << "Failed " << request.Url << std::endl;
+        }
+      queued.erase(iter);
+      }
+
+    // Every tile before the oldest queued or failed one is stored,
+    // once the downloader wrote its queued tiles
+    if (now - lastCheckpoint > 5.0 &&
+        downloader->GetNumberOfPendingWrites() == 0)
+      {
+      vtkTypeUInt64 done = position;
+      std::map<vtkTypeUInt64, vtkTypeUInt64>::iterator iter;
+      for (iter = queued.begin(); iter != queued.end(); ++iter)
+        {
+        done = std::min(done, iter->second - 1);
+        }
+      if (!failedPositions.empty())
+        {
+        done = std::min(done, *failedPositions.begin() - 1);
+        }
+      writeCheckpoint(checkpointName, signature.str(),
+                      std::max(done, resume));
+      lastCheckpoint = now;
+      }
+
+    if (now - lastReport > 10.0)
+      {
+      std::cout << "Zoom " << zoom << ": " << walked << " tiles walked, "
+                << stored << " stored, " << skipped << " present, "
+                << failed << " failed" << std::endl;
+      lastReport = now;
+      }
+
+    if (completed.empty())
+      {
+      vtksys::SystemTools::Delay(10);
+      }
+    }
+
+  // Flushes the tiles still queued for writing
+  downloader->Stop();
+  if (failedPositions.empty())
+    {
+    writeCheckpoint(checkpointName, signature.str(), position);
+    }
+
+  std::cout << "Done: " << walked << " tiles walked, " << stored
+            << " stored, " << skipped << " present, " << failed
+            << " failed" << std::endl;
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
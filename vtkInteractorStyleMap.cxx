@@ -109,6 +109,7 @@ void vtkInteractorStyleMap::OnMouseWheelForward()
       {
       zoom++;
       this->Map->SetZoom(zoom);
+      this->Map->RecordZoom(1);
       this->SetCurrentRenderer(this->Map->GetRenderer());
 
       vtkCamera *camera = this->Map->GetRenderer()->GetActiveCamera();
@@ -164,6 +165,7 @@ void vtkInteractorStyleMap::OnMouseWheelBackward()
       zoom--;
 
       this->Map->SetZoom(zoom);
+      this->Map->RecordZoom(-1);
       this->SetCurrentRenderer(this->Map->GetRenderer());
 
       vtkCamera *camera = this->Map->GetRenderer()->GetActiveCamera();
@@ -264,5 +266,6 @@ void vtkInteractorStyleMap::Pan()
                       motionVector[1] + viewPoint[1],
                       motionVector[2] + viewPoint[2]);
 
+  this->Map->RecordPan(motionVector[0], motionVector[1]);
   this->Map->Draw();
 }
@@ -64,6 +64,13 @@ public:
   // Description:
   virtual void Update() = 0;
 
+  // Description:
+  // Returns true while the layer loads data in the background, and
+  // true once that data is ready to be added by Update(). vtkMap polls
+  // these to redraw as background data arrives.
+  virtual bool HasPendingRequests() { return false; }
+  virtual bool HasCompletedRequests() { return false; }
+
 protected:
 
   vtkLayer();
@@ -22,12 +22,14 @@
 
 // VTK Includes
 #include <vtkActor2D.h>
+#include <vtkCallbackCommand.h>
 #include <vtkImageInPlaceFilter.h>
 #include <vtkObjectFactory.h>
 #include <vtkPointPicker.h>
 #include <vtkPoints.h>
 #include <vtkRenderer.h>
 #include <vtkRenderWindow.h>
+#include <vtkRenderWindowInteractor.h>
 #include <vtkCamera.h>
 #include <vtkMath.h>
 #include <vtkMatrix4x4.h>
@@ -80,6 +82,16 @@ vtkMap::vtkMap()
   this->MapMarkerSet = vtkMapMarkerSet::New();
   this->Initialized = false;
   this->BaseLayer = NULL;
+  this->PollingInterval = 100;
+  this->PollTimerId = 0;
+  this->PollObserverTag = 0;
+  this->PollCallback = vtkCallbackCommand::New();
+  this->PollCallback->SetClientData(this);
+  this->PollCallback->SetCallback(vtkMap::PollCallbackFunction);
+  this->PanVelocity[0] = this->PanVelocity[1] = 0.0;
+  this->LastPanTime = 0.0;
+  this->ZoomDirection = 0;
+  this->LastZoomTime = 0.0;
 
   // Set default storage directory to ~/.vtkmap
   std::string fullPath =
@@ -90,6 +102,17 @@ vtkMap::vtkMap()
 //----------------------------------------------------------------------------
 vtkMap::~vtkMap()
 {
+  // The interactor may outlive the map, so stop polling first
+  if (this->PollInteractor)
+    {
+    if (this->PollTimerId)
+      {
+      this->PollInteractor->DestroyTimer(this->PollTimerId);
+      }
+    this->PollInteractor->RemoveObserver(this->PollObserverTag);
+    }
+  this->PollCallback->Delete();
+
   if (this->InteractorStyle)
     {
     this->InteractorStyle->Delete();
@@ -171,6 +194,54 @@ void vtkMap::GetCenter(double (&latlngPoint)[2])
   latlngPoint[1] = worldPoint[0];
 }
 
+//----------------------------------------------------------------------------
+void vtkMap::RecordPan(double dx, double dy)
+{
+  double now = vtksys::SystemTools::GetTime();
+  double elapsed = now - this->LastPanTime;
+  if (elapsed > 0.5)
+    {
+    // First motion of a new pan, the velocity is not known yet
+    this->PanVelocity[0] = this->PanVelocity[1] = 0.0;
+    }
+  else if (elapsed > 0.0)
+    {
+    // Smooth out the jitter of individual mouse events
+    this->PanVelocity[0] = 0.5 * this->PanVelocity[0] + 0.5 * dx / elapsed;
+    this->PanVelocity[1] = 0.5 * this->PanVelocity[1] + 0.5 * dy / elapsed;
+    }
+  this->LastPanTime = now;
+}
+
+//----------------------------------------------------------------------------
+void vtkMap::RecordZoom(int direction)
+{
+  this->ZoomDirection = direction > 0 ? 1 : (direction < 0 ? -1 : 0);
+  this->LastZoomTime = vtksys::SystemTools::GetTime();
+}
+
+//----------------------------------------------------------------------------
+void vtkMap::GetPanVelocity(double velocity[2])
+{
+  if (vtksys::SystemTools::GetTime() - this->LastPanTime > 0.5)
+    {
+    velocity[0] = velocity[1] = 0.0;
+    return;
+    }
+  velocity[0] = this->PanVelocity[0];
+  velocity[1] = this->PanVelocity[1];
+}
+
+//----------------------------------------------------------------------------
+int vtkMap::GetZoomDirection()
+{
+  if (vtksys::SystemTools::GetTime() - this->LastZoomTime > 3.0)
+    {
+    return 0;
+    }
+  return this->ZoomDirection;
+}
+
 //----------------------------------------------------------------------------
 void vtkMap::SetStorageDirectory(const char *path)
 {
@@ -344,6 +415,73 @@ void vtkMap::Draw()
     }
   this->Update();
   this->Renderer->GetRenderWindow()->Render();
+  this->UpdatePolling();
+}
+
+//----------------------------------------------------------------------------
+void vtkMap::UpdatePolling()
+{
+  bool pending = false;
+  if (this->BaseLayer)
+    {
+    pending = this->BaseLayer->HasPendingRequests() ||
+      this->BaseLayer->HasCompletedRequests();
+    }
+  for (size_t i = 0; !pending && i < this->Layers.size(); ++i)
+    {
+    pending = this->Layers[i]->HasPendingRequests() ||
+      this->Layers[i]->HasCompletedRequests();
+    }
+
+  vtkRenderWindowInteractor *interactor =
+    this->Renderer->GetRenderWindow()->GetInteractor();
+  if (pending && !this->PollTimerId && interactor)
+    {
+    if (this->PollInteractor != interactor)
+      {
+      if (this->PollInteractor)
+        {
+        this->PollInteractor->RemoveObserver(this->PollObserverTag);
+        }
+      this->PollInteractor = interactor;
+      this->PollObserverTag = interactor->AddObserver(
+        vtkCommand::TimerEvent, this->PollCallback);
+      }
+    this->PollTimerId = interactor->CreateRepeatingTimer(
+      static_cast<unsigned long>(this->PollingInterval));
+    }
+  else if (!pending && this->PollTimerId)
+    {
+    if (this->PollInteractor)
+      {
+      this->PollInteractor->DestroyTimer(this->PollTimerId);
+      }
+    this->PollTimerId = 0;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMap::PollCallbackFunction(vtkObject *vtkNotUsed(caller),
+                                  unsigned long vtkNotUsed(eventId),
+                                  void *clientData, void *callData)
+{
+  vtkMap *self = static_cast<vtkMap*>(clientData);
+  int *timerId = static_cast<int*>(callData);
+  if (!timerId || *timerId != self->PollTimerId || !self->PollTimerId)
+    {
+    return;
+    }
+
+  bool completed = self->BaseLayer && self->BaseLayer->HasCompletedRequests();
+  for (size_t i = 0; !completed && i < self->Layers.size(); ++i)
+    {
+    completed = self->Layers[i]->HasCompletedRequests();
+    }
+
+  if (completed)
+    {
+    self->Draw();
+    }
 }
 
 //----------------------------------------------------------------------------
@@ -20,10 +20,12 @@
 
 // VTK Includes
 #include <vtkObject.h>
+#include <vtkWeakPointer.h>
 
 #include "vtkmap_export.h"
 
 class vtkActor;
+class vtkCallbackCommand;
 class vtkInteractorStyle;
 class vtkInteractorStyleMap;
 class vtkMapMarkerSet;
@@ -31,6 +33,7 @@ class vtkMapPickResult;
 class vtkPicker;
 class vtkPoints;
 class vtkRenderer;
+class vtkRenderWindowInteractor;
 
 #include <map>
 #include <string>
@@ -75,6 +78,28 @@ public:
   void GetCenter(double (&latlngPoint)[2]);
   vtkSetVector2Macro(Center, double);
 
+  // Description:
+  // Get/Set the interval, in milliseconds, at which layers that load
+  // data in the background are polled for new content. Default is 100.
+  vtkGetMacro(PollingInterval, int)
+  vtkSetClampMacro(PollingInterval, int, 10, 10000)
+
+  // Description:
+  // Record camera motion caused by user interaction. Pans are in world
+  // coordinates, zoom direction is +1 for zooming in and -1 for out.
+  // Layers use the recent motion to prefetch data ahead of the view.
+  void RecordPan(double dx, double dy);
+  void RecordZoom(int direction);
+
+  // Description:
+  // Returns the recent pan velocity in world coordinates per second,
+  // or zero if the view has not been panned in the last half second
+  void GetPanVelocity(double velocity[2]);
+
+  // Description:
+  // Returns the direction of a zoom in the last few seconds, or 0
+  int GetZoomDirection();
+
   // Description:
   // Get/Set the directory used for caching files.
   vtkGetStringMacro(StorageDirectory);
@@ -123,6 +148,13 @@ protected:
   // Clips a number to the specified minimum and maximum values.
   double Clip(double n, double minValue, double maxValue);
 
+  // Description:
+  // Start or stop the interactor timer used to redraw the map
+  // while layers load data in the background
+  void UpdatePolling();
+  static void PollCallbackFunction(vtkObject *caller, unsigned long eventId,
+                                   void *clientData, void *callData);
+
   // Description:
   // The renderer used to draw the maps
   vtkRenderer* Renderer;
@@ -151,6 +183,21 @@ protected:
   // The map marker manager
   vtkMapMarkerSet *MapMarkerSet;
 
+  // Description:
+  // Timer state used to poll layers for background data
+  int PollingInterval;
+  int PollTimerId;
+  unsigned long PollObserverTag;
+  vtkCallbackCommand *PollCallback;
+  vtkWeakPointer<vtkRenderWindowInteractor> PollInteractor;
+
+  // Description:
+  // Recent camera motion, see RecordPan() and RecordZoom()
+  double PanVelocity[2];
+  double LastPanTime;
+  int ZoomDirection;
+  double LastZoomTime;
+
 protected:
   bool Initialized;
 
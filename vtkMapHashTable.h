@@ -0,0 +1,218 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapHashTable - hash table keyed on 64 bit integers
+// .SECTION Description
+// vtkMapHashTable maps packed 64 bit keys, such as tile ids or grid
+// cell indices, to values. It is an open addressing hash table with
+// linear probing, held in a single array, so that a lookup touches
+// one or two cache lines. Erased entries leave no tombstones, so
+// lookups do not slow down as entries come and go. The key with all
+// bits set is reserved.
+// .SECTION See Also
+// vtkMapTileTable
+
+#ifndef __vtkMapHashTable_h
+#define __vtkMapHashTable_h
+
+// VTK Includes
+#include <vtkType.h>
+
+#include <cstddef>  // for NULL
+#include <utility>
+#include <vector>
+
+template <class ValueType>
+class vtkMapHashTable
+{
+public:
+  // Description:
+  // Create an empty table of the given capacity, a power of two
+  vtkMapHashTable(size_t initialCapacity = 16)
+    : InitialCapacity(initialCapacity), Count(0)
+  {
+    this->Resize(initialCapacity);
+  }
+
+  // Description:
+  // Returns the value of key, or NULL if the key is not in the table.
+  // The pointer is valid until the table is changed.
+  ValueType* Find(vtkTypeUInt64 key)
+  {
+    Slot& slot = this->Slots[this->FindSlot(key)];
+    return slot.Key != 0 ? &slot.Value : NULL;
+  }
+  const ValueType* Find(vtkTypeUInt64 key) const
+  {
+    const Slot& slot = this->Slots[this->FindSlot(key)];
+    return slot.Key != 0 ? &slot.Value : NULL;
+  }
+
+  // Description:
+  // Add a key with the given value, unless the key is in the table.
+  // Returns the value of the key, and whether the key was added.
+  std::pair<ValueType*, bool> Insert(vtkTypeUInt64 key,
+                                     const ValueType& value)
+  {
+    // Keep the load factor at or below one half, probe sequences
+    // stay short and a probe always ends on an empty slot
+    if (2 * (this->Count + 1) > this->Slots.size())
+      {
+      this->Resize(2 * this->Slots.size());
+      }
+
+    Slot& slot = this->Slots[this->FindSlot(key)];
+    if (slot.Key != 0)
+      {
+      return std::make_pair(&slot.Value, false);
+      }
+    slot.Key = key + 1;
+    slot.Value = value;
+    ++this->Count;
+    return std::make_pair(&slot.Value, true);
+  }
+
+  // Description:
+  // Remove a key. Returns false if the key was not in the table,
+  // otherwise copies its value to value if that is not NULL.
+  bool Erase(vtkTypeUInt64 key, ValueType *value = NULL);
+
+  // Description:
+  // Remove all keys
+  void Clear()
+  {
+    this->Count = 0;
+    this->Slots.clear();
+    this->Resize(this->InitialCapacity);
+  }
+
+  // Description:
+  // Returns the number of keys in the table
+  size_t GetNumberOfEntries() const { return this->Count; }
+
+  // Description:
+  // Visit the entries, in unspecified order, by iterating over the
+  // slots of the table and skipping the unused ones
+  size_t GetNumberOfSlots() const { return this->Slots.size(); }
+  bool IsSlotUsed(size_t i) const { return this->Slots[i].Key != 0; }
+  vtkTypeUInt64 GetSlotKey(size_t i) const { return this->Slots[i].Key - 1; }
+  const ValueType& GetSlotValue(size_t i) const
+  {
+    return this->Slots[i].Value;
+  }
+
+protected:
+  struct Slot
+  {
+    // Key plus one, zero marks an empty slot
+    vtkTypeUInt64 Key;
+    ValueType Value;
+  };
+
+  // Description:
+  // Finalizer of MurmurHash3, spreads the bits of keys packed from
+  // small integers over the whole word
+  static size_t Hash(vtkTypeUInt64 key)
+  {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return static_cast<size_t>(key);
+  }
+
+  // Description:
+  // Returns the index of the slot holding key, or of the empty slot
+  // where it would go
+  size_t FindSlot(vtkTypeUInt64 key) const
+  {
+    size_t mask = this->Slots.size() - 1;
+    for (size_t i = Hash(key) & mask; ; i = (i + 1) & mask)
+      {
+      if (this->Slots[i].Key == key + 1 || this->Slots[i].Key == 0)
+        {
+        return i;
+        }
+      }
+  }
+
+  void Resize(size_t capacity);
+
+  size_t InitialCapacity;
+  std::vector<Slot> Slots;
+  size_t Count;
+};
+
+//----------------------------------------------------------------------------
+template <class ValueType>
+bool vtkMapHashTable<ValueType>::Erase(vtkTypeUInt64 key, ValueType *value)
+{
+  size_t i = this->FindSlot(key);
+  if (this->Slots[i].Key == 0)
+    {
+    return false;
+    }
+  if (value)
+    {
+    *value = this->Slots[i].Value;
+    }
+  --this->Count;
+
+  // Shift the following entries of the probe sequence back into the
+  // hole, instead of leaving a tombstone
+  size_t mask = this->Slots.size() - 1;
+  size_t j = i;
+  while (true)
+    {
+    j = (j + 1) & mask;
+    if (this->Slots[j].Key == 0)
+      {
+      break;
+      }
+    // The entry can move to i unless its home slot lies cyclically
+    // in (i, j]
+    size_t home = Hash(this->Slots[j].Key - 1) & mask;
+    bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+    if (!stays)
+      {
+      this->Slots[i] = this->Slots[j];
+      i = j;
+      }
+    }
+  this->Slots[i].Key = 0;
+  this->Slots[i].Value = ValueType();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+template <class ValueType>
+void vtkMapHashTable<ValueType>::Resize(size_t capacity)
+{
+  std::vector<Slot> old;
+  old.swap(this->Slots);
+  Slot empty;
+  empty.Key = 0;
+  empty.Value = ValueType();
+  this->Slots.assign(capacity, empty);
+
+  for (size_t i = 0; i < old.size(); ++i)
+    {
+    if (old[i].Key != 0)
+      {
+      this->Slots[this->FindSlot(old[i].Key - 1)] = old[i];
+      }
+    }
+}
+
+#endif // __vtkMapHashTable_h
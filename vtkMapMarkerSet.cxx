@@ -13,6 +13,7 @@
 =========================================================================*/
 
 #include "vtkMapMarkerSet.h"
+#include "vtkMapHashTable.h"
 #include "vtkMapPickResult.h"
 #include "vtkMercator.h"
 #include "vtkTeardropSource.h"
@@ -23,6 +24,7 @@
 #include <vtkDoubleArray.h>
 #include <vtkIdTypeArray.h>
 #include <vtkGlyph3D.h>
+#include <vtkMultiThreader.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
 #include <vtkPointData.h>
@@ -38,25 +40,148 @@
 #include <vtkUnsignedIntArray.h>
 
 #include <algorithm>
+#include <cmath>
+#include <map>
 #include <vector>
 
 const int NumberOfClusterLevels = 20;
 
+// Smallest batch of markers worth clustering on its own thread
+const vtkIdType MinimumMarkersPerThread = 1000;
+
+// Node index marking the end of a node list, or no node
+const vtkTypeUInt32 NoNode = 0xffffffff;
+
+// Nodes are allocated in blocks of 2^NodeBlockBits
+const int NodeBlockBits = 12;
+const vtkTypeUInt32 NodeBlockSize = 1 << NodeBlockBits;
+
+//----------------------------------------------------------------------------
+namespace
+{
+  // Convert a cluster distance from image (pixel) to gcs coords
+  double gcsClusterDistance(double distance, int zoomLevel)
+  {
+    double level0Scale = 360.0 / 256.0;  // 360 degress <==> 256 tile pixels
+    double scale = level0Scale / static_cast<double>(1<<zoomLevel);
+    return scale * distance;
+  }
+
+  // Pack the x/y index of a grid cell in a single key. The indices are
+  // offset by 2^31, so that cell (-1, -1) does not get the key
+  // vtkMapHashTable reserves. Cells of the map never reach (2^31-1, 2^31-1),
+  // which does.
+  vtkTypeUInt64 gridCellKey(int x, int y)
+  {
+    const vtkTypeUInt32 offset = 0x80000000u;
+    return
+      (static_cast<vtkTypeUInt64>(static_cast<vtkTypeUInt32>(x) ^ offset)
+       << 32) |
+      static_cast<vtkTypeUInt64>(static_cast<vtkTypeUInt32>(y) ^ offset);
+  }
+
+  // From the grid cells of a level to the first node of their node list
+  typedef vtkMapHashTable<vtkTypeUInt32> GridCellTable;
+}
+
 //----------------------------------------------------------------------------
 // Internal class for cluster tree nodes
-// Each node represents either one marker or a cluster of nodes
+// Each node represents either one marker or a cluster of nodes.
+// Nodes refer to each other by their 32 bit index in the tree.
 class vtkMapMarkerSet::ClusteringNode
 {
 public:
-  int NodeId;  // for dev use
-  int Level;  // for dev
   double gcsCoords[2];
-  ClusteringNode *Parent;
-  std::set<ClusteringNode*> Children;
+  vtkTypeUInt32 NodeId;  // index of the node in its tree
+  vtkTypeUInt32 Parent;
+  // Children are a list linked through their sibling indices
+  vtkTypeUInt32 FirstChild;
+  vtkTypeUInt32 NextSibling;
+  vtkTypeUInt32 PreviousSibling;
+  // Nodes of a grid cell are a list too
+  vtkTypeUInt32 NextInCell;
+  vtkTypeUInt32 PreviousInCell;
+  vtkTypeUInt32 LevelIndex;  // position in the node list of its level
+  int Level;  // -1 for deleted nodes
   int NumberOfMarkers;  // 1 for single-point nodes, >1 for clusters
   int MarkerId;  // only relevant for single-point markers (not clusters)
 };
 
+//----------------------------------------------------------------------------
+// Internal class for the nodes of a cluster tree. Nodes are allocated in
+// blocks, so that they stay at the same address, and deleted nodes are
+// reused. Each level has a list of its nodes, and a uniform grid over
+// them, with cells as wide as the level's cluster distance, so that the
+// search for a clustering partner only visits the cells around a node.
+// Nodes must be moved in the grid whenever their coordinates change.
+class vtkMapMarkerSet::ClusterTree
+{
+public:
+  typedef std::pair<int, int> GridCell;
+
+  ClusterTree() : NumberOfNodes(0) {}
+  ~ClusterTree();
+
+  // Description:
+  // Delete all nodes, and set the grid cell sizes
+  void Initialize(double clusterDistance);
+
+  ClusteringNode *GetNode(vtkTypeUInt32 index) const
+  {
+    return this->NodeBlocks[index >> NodeBlockBits] +
+      (index & (NodeBlockSize - 1));
+  }
+  ClusteringNode *GetParent(const ClusteringNode *node) const
+  {
+    return node->Parent == NoNode ? NULL : this->GetNode(node->Parent);
+  }
+
+  // Description:
+  // Create a node without parent nor children at a level
+  ClusteringNode *NewNode(int level, const double gcsCoords[2]);
+
+  // Description:
+  // Delete a node, which must not have children anymore
+  void DeleteNode(ClusteringNode *node);
+
+  // Description:
+  // Add a node without parent to a cluster, updating the marker count
+  // and coordinates of the cluster
+  void JoinCluster(ClusteringNode *cluster, ClusteringNode *node);
+
+  void AddChild(ClusteringNode *parent, ClusteringNode *child);
+  void RemoveChild(ClusteringNode *parent, ClusteringNode *child);
+
+  GridCell ComputeGridCell(const double gcsCoords[2], int level) const;
+  vtkTypeUInt32 GetFirstNodeInCell(int level, int x, int y) const
+  {
+    const vtkTypeUInt32 *head = this->NodeGrids[level].Find(gridCellKey(x, y));
+    return head ? *head : NoNode;
+  }
+  void InsertGridNode(ClusteringNode *node);
+  void RemoveGridNode(ClusteringNode *node);
+
+  // Description:
+  // Set the coordinates of a node in the grid, moving it to its new cell
+  void MoveNode(ClusteringNode *node, const double gcsCoords[2]);
+
+  // Description:
+  // Move the nodes of another tree into this one
+  void Append(ClusterTree& other);
+
+  std::vector<std::vector<vtkTypeUInt32> > LevelNodes;
+  std::vector<GridCellTable> NodeGrids;
+  std::vector<double> GridCellSizes;
+
+  std::vector<ClusteringNode*> NodeBlocks;
+  vtkTypeUInt32 NumberOfNodes;  // allocated, including deleted nodes
+  std::vector<vtkTypeUInt32> DeletedNodes;
+
+private:
+  ClusterTree(const ClusterTree&);  // not implemented
+  void operator=(const ClusterTree&);  // not implemented
+};
+
 //----------------------------------------------------------------------------
 vtkStandardNewMacro(vtkMapMarkerSet)
 
@@ -65,15 +190,36 @@ class vtkMapMarkerSet::MapMarkerSetInternals
 {
 public:
   bool MarkersChanged;
-  std::vector<ClusteringNode*> CurrentNodes;  // in this->PolyData
+  std::vector<vtkTypeUInt32> CurrentNodes;  // in this->PolyData
 
   // Used for marker clustering:
   int ZoomLevel;
-  std::vector<std::set<ClusteringNode*> > NodeTable;
+  ClusterTree Tree;
   int NumberOfMarkers;
+  // Node of each marker id at the bottom level, NoNode once removed
+  std::vector<vtkTypeUInt32> MarkerNodes;
   double ClusterDistance;
-  int NumberOfNodes;  // for dev use
-  std::vector<ClusteringNode*> AllNodes;   // for dev
+
+  // Used by AddMarkers() to cluster vertical strips of markers in
+  // parallel, each into its own tree
+  struct Partition
+  {
+    ClusterTree Tree;
+    std::vector<vtkIdType> Markers;  // indices in the batch, in id order
+  };
+  std::vector<Partition*> Partitions;
+  const double *BatchLatitudes;
+  const double *BatchLongitudes;
+  vtkIdType BatchFirstId;
+
+  // Used by StitchNodes() when merging the strips
+  typedef std::pair<ClusteringNode*, ClusteringNode*> NodePair;
+  std::map<ClusteringNode*, ClusteringNode*> MergedNodes;
+  std::set<ClusteringNode*> ChangedParents;
+  std::vector<NodePair> ParentsToMerge;
+
+  // Returns the node a stitched node was merged into, or the node itself
+  ClusteringNode *FindMergedNode(ClusteringNode *node) const;
 };
 
 //----------------------------------------------------------------------------
@@ -86,16 +232,283 @@ vtkMapMarkerSet::vtkMapMarkerSet()
   this->Actor = NULL;
   this->Clustering = false;
   this->MaxClusterScaleFactor = 2.0;
+  this->NumberOfThreads = 1;
 
   this->Internals = new MapMarkerSetInternals;
   this->Internals->MarkersChanged = false;
   this->Internals->ZoomLevel = -1;
-  std::set<ClusteringNode*> clusterSet;
-  std::fill_n(std::back_inserter(this->Internals->NodeTable),
-              NumberOfClusterLevels, clusterSet);
   this->Internals->NumberOfMarkers = 0;
   this->Internals->ClusterDistance = 80.0;
-  this->Internals->NumberOfNodes = 0;
+  this->Internals->Tree.Initialize(this->Internals->ClusterDistance);
+  this->Internals->BatchLatitudes = NULL;
+  this->Internals->BatchLongitudes = NULL;
+  this->Internals->BatchFirstId = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkMapMarkerSet::ClusterTree::~ClusterTree()
+{
+  for (size_t i = 0; i < this->NodeBlocks.size(); i++)
+    {
+    delete [] this->NodeBlocks[i];
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterTree::Initialize(double clusterDistance)
+{
+  for (size_t i = 0; i < this->NodeBlocks.size(); i++)
+    {
+    delete [] this->NodeBlocks[i];
+    }
+  this->NodeBlocks.clear();
+  this->NumberOfNodes = 0;
+  this->DeletedNodes.clear();
+
+  this->LevelNodes.assign(NumberOfClusterLevels,
+                          std::vector<vtkTypeUInt32>());
+  this->NodeGrids.assign(NumberOfClusterLevels, GridCellTable());
+  this->GridCellSizes.clear();
+  for (int level = 0; level < NumberOfClusterLevels; level++)
+    {
+    this->GridCellSizes.push_back(gcsClusterDistance(clusterDistance, level));
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkMapMarkerSet::ClusteringNode*
+vtkMapMarkerSet::ClusterTree::NewNode(int level, const double gcsCoords[2])
+{
+  vtkTypeUInt32 index;
+  if (!this->DeletedNodes.empty())
+    {
+    index = this->DeletedNodes.back();
+    this->DeletedNodes.pop_back();
+    }
+  else
+    {
+    index = this->NumberOfNodes++;
+    if ((index >> NodeBlockBits) >= this->NodeBlocks.size())
+      {
+      this->NodeBlocks.push_back(new ClusteringNode[NodeBlockSize]);
+      }
+    }
+
+  ClusteringNode *node = this->GetNode(index);
+  node->gcsCoords[0] = gcsCoords[0];
+  node->gcsCoords[1] = gcsCoords[1];
+  node->NodeId = index;
+  node->Parent = NoNode;
+  node->FirstChild = NoNode;
+  node->NextSibling = NoNode;
+  node->PreviousSibling = NoNode;
+  node->Level = level;
+  node->NumberOfMarkers = 1;
+  node->MarkerId = -1;
+
+  node->LevelIndex = static_cast<vtkTypeUInt32>(this->LevelNodes[level].size());
+  this->LevelNodes[level].push_back(index);
+  this->InsertGridNode(node);
+  return node;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterTree::DeleteNode(ClusteringNode *node)
+{
+  this->RemoveGridNode(node);
+
+  // Fill the hole in the level's node list with its last node
+  std::vector<vtkTypeUInt32>& levelNodes = this->LevelNodes[node->Level];
+  vtkTypeUInt32 last = levelNodes.back();
+  levelNodes[node->LevelIndex] = last;
+  this->GetNode(last)->LevelIndex = node->LevelIndex;
+  levelNodes.pop_back();
+
+  node->Level = -1;
+  this->DeletedNodes.push_back(node->NodeId);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterTree::JoinCluster(ClusteringNode *cluster,
+                                               ClusteringNode *node)
+{
+  double denominator = node->NumberOfMarkers + cluster->NumberOfMarkers;
+  double gcsCoords[2];
+  for (unsigned i=0; i<2; i++)
+    {
+    double numerator = cluster->gcsCoords[i]*cluster->NumberOfMarkers +
+      node->gcsCoords[i]*node->NumberOfMarkers;
+    gcsCoords[i] = numerator/denominator;
+    }
+  this->MoveNode(cluster, gcsCoords);
+  cluster->NumberOfMarkers += node->NumberOfMarkers;
+  cluster->MarkerId = -1;
+  this->AddChild(cluster, node);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterTree::AddChild(ClusteringNode *parent,
+                                            ClusteringNode *child)
+{
+  child->Parent = parent->NodeId;
+  child->PreviousSibling = NoNode;
+  child->NextSibling = parent->FirstChild;
+  if (parent->FirstChild != NoNode)
+    {
+    this->GetNode(parent->FirstChild)->PreviousSibling = child->NodeId;
+    }
+  parent->FirstChild = child->NodeId;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterTree::RemoveChild(ClusteringNode *parent,
+                                               ClusteringNode *child)
+{
+  if (child->PreviousSibling != NoNode)
+    {
+    this->GetNode(child->PreviousSibling)->NextSibling = child->NextSibling;
+    }
+  else
+    {
+    parent->FirstChild = child->NextSibling;
+    }
+  if (child->NextSibling != NoNode)
+    {
+    this->GetNode(child->NextSibling)->PreviousSibling =
+      child->PreviousSibling;
+    }
+  child->Parent = NoNode;
+  child->NextSibling = NoNode;
+  child->PreviousSibling = NoNode;
+}
+
+//----------------------------------------------------------------------------
+vtkMapMarkerSet::ClusterTree::GridCell
+vtkMapMarkerSet::ClusterTree::
+ComputeGridCell(const double gcsCoords[2], int level) const
+{
+  double cellSize = this->GridCellSizes[level];
+  return GridCell(static_cast<int>(std::floor(gcsCoords[0] / cellSize)),
+                  static_cast<int>(std::floor(gcsCoords[1] / cellSize)));
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterTree::InsertGridNode(ClusteringNode *node)
+{
+  GridCell cell = this->ComputeGridCell(node->gcsCoords, node->Level);
+  GridCellTable& grid = this->NodeGrids[node->Level];
+  std::pair<vtkTypeUInt32*, bool> head =
+    grid.Insert(gridCellKey(cell.first, cell.second), node->NodeId);
+  node->PreviousInCell = NoNode;
+  node->NextInCell = NoNode;
+  if (!head.second)
+    {
+    // Put the node in front of the nodes already in the cell
+    node->NextInCell = *head.first;
+    this->GetNode(*head.first)->PreviousInCell = node->NodeId;
+    *head.first = node->NodeId;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterTree::RemoveGridNode(ClusteringNode *node)
+{
+  if (node->PreviousInCell != NoNode)
+    {
+    this->GetNode(node->PreviousInCell)->NextInCell = node->NextInCell;
+    }
+  else
+    {
+    // The node is still at the coordinates it was inserted at
+    GridCell cell = this->ComputeGridCell(node->gcsCoords, node->Level);
+    GridCellTable& grid = this->NodeGrids[node->Level];
+    vtkTypeUInt64 key = gridCellKey(cell.first, cell.second);
+    if (node->NextInCell != NoNode)
+      {
+      *grid.Find(key) = node->NextInCell;
+      }
+    else
+      {
+      grid.Erase(key);
+      }
+    }
+  if (node->NextInCell != NoNode)
+    {
+    this->GetNode(node->NextInCell)->PreviousInCell = node->PreviousInCell;
+    }
+  node->NextInCell = NoNode;
+  node->PreviousInCell = NoNode;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterTree::MoveNode(ClusteringNode *node,
+                                            const double gcsCoords[2])
+{
+  GridCell cell = this->ComputeGridCell(gcsCoords, node->Level);
+  if (cell != this->ComputeGridCell(node->gcsCoords, node->Level))
+    {
+    this->RemoveGridNode(node);
+    node->gcsCoords[0] = gcsCoords[0];
+    node->gcsCoords[1] = gcsCoords[1];
+    this->InsertGridNode(node);
+    }
+  else
+    {
+    node->gcsCoords[0] = gcsCoords[0];
+    node->gcsCoords[1] = gcsCoords[1];
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterTree::Append(ClusterTree& other)
+{
+  // Copy the nodes after the ones of this tree, shifting their links
+  vtkTypeUInt32 offset = this->NumberOfNodes;
+  for (vtkTypeUInt32 i = 0; i < other.NumberOfNodes; i++)
+    {
+    vtkTypeUInt32 index = this->NumberOfNodes++;
+    if ((index >> NodeBlockBits) >= this->NodeBlocks.size())
+      {
+      this->NodeBlocks.push_back(new ClusteringNode[NodeBlockSize]);
+      }
+    ClusteringNode *node = this->GetNode(index);
+    *node = *other.GetNode(i);
+    node->NodeId = index;
+    vtkTypeUInt32 *links[] = { &node->Parent, &node->FirstChild,
+                               &node->NextSibling, &node->PreviousSibling };
+    for (int k = 0; k < 4; k++)
+      {
+      if (*links[k] != NoNode)
+        {
+        *links[k] += offset;
+        }
+      }
+
+    if (node->Level < 0)
+      {
+      this->DeletedNodes.push_back(index);
+      continue;
+      }
+    node->LevelIndex =
+      static_cast<vtkTypeUInt32>(this->LevelNodes[node->Level].size());
+    this->LevelNodes[node->Level].push_back(index);
+    this->InsertGridNode(node);
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkMapMarkerSet::ClusteringNode*
+vtkMapMarkerSet::MapMarkerSetInternals::
+FindMergedNode(ClusteringNode *node) const
+{
+  std::map<ClusteringNode*, ClusteringNode*>::const_iterator iter =
+    this->MergedNodes.find(node);
+  while (iter != this->MergedNodes.end())
+    {
+    node = iter->second;
+    iter = this->MergedNodes.find(node);
+    }
+  return node;
 }
 
 //----------------------------------------------------------------------------
@@ -105,6 +518,7 @@ void vtkMapMarkerSet::PrintSelf(ostream &os, vtkIndent indent)
   os << this->GetClassName() << "\n"
      << indent << "Initialized: " << this->Initialized << "\n"
      << indent << "Clustering: " << this->Clustering << "\n"
+     << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n"
      << indent << "NumberOfMarkers: "
      << this->Internals->NumberOfMarkers
      << std::endl;
@@ -131,206 +545,774 @@ vtkMapMarkerSet::~vtkMapMarkerSet()
 //----------------------------------------------------------------------------
 vtkIdType vtkMapMarkerSet::AddMarker(double latitude, double longitude)
 {
-  // Set marker id
-  int markerId = this->Internals->NumberOfMarkers++;
+  vtkIdType markerId =
+    static_cast<vtkIdType>(this->Internals->MarkerNodes.size());
+  ClusteringNode *node =
+    this->InsertMarker(&this->Internals->Tree, markerId, latitude, longitude);
+  this->Internals->MarkerNodes.push_back(node->NodeId);
+  this->Internals->NumberOfMarkers++;
+  this->Internals->MarkersChanged = true;
+
+  if (false)
+    {
+    // Dump all nodes
+    ClusterTree *tree = &this->Internals->Tree;
+    for (vtkTypeUInt32 i=0; i<tree->NumberOfNodes; i++)
+      {
+      ClusteringNode *currentNode = tree->GetNode(i);
+      std::cout << "Node " << i << " has ";
+      if (currentNode->Level >= 0)
+        {
+      std::cout << "parent " << static_cast<int>(currentNode->Parent) << ", "
+                << currentNode->NumberOfMarkers << " markers, and "
+                << " marker id " << currentNode->MarkerId;
+        }
+      else
+        {
+        std::cout << " been deleted";
+        }
+      std::cout << "\n";
+      }
+    std::cout << std::endl;
+    }
+
+  return markerId;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkMapMarkerSet::AddMarkers(vtkIdType numberOfMarkers,
+                                      const double *latitudes,
+                                      const double *longitudes)
+{
+  if (numberOfMarkers <= 0)
+    {
+    return -1;
+    }
+
+  std::vector<vtkTypeUInt32>& markerNodes = this->Internals->MarkerNodes;
+  vtkIdType firstId = static_cast<vtkIdType>(markerNodes.size());
+  int existingMarkers = this->Internals->NumberOfMarkers;
+  this->Internals->NumberOfMarkers += static_cast<int>(numberOfMarkers);
+
+  if (this->Clustering && this->NumberOfThreads > 1 &&
+      existingMarkers == 0 &&
+      numberOfMarkers >= 2 * MinimumMarkersPerThread)
+    {
+    markerNodes.resize(firstId + numberOfMarkers, NoNode);
+    this->ClusterMarkersInParallel(numberOfMarkers, latitudes, longitudes);
+    }
+  else if (this->Clustering && numberOfMarkers >= existingMarkers)
+    {
+    // Rebuilding the tree costs less than inserting a batch at least as
+    // large as it one marker at a time
+    markerNodes.resize(firstId + numberOfMarkers, NoNode);
+    this->BuildTree(numberOfMarkers, latitudes, longitudes);
+    }
+  else
+    {
+    // A batch smaller than the set is inserted in id order, the same as
+    // markers added one at a time
+    ClusterTree *tree = &this->Internals->Tree;
+    markerNodes.reserve(firstId + numberOfMarkers);
+    for (vtkIdType i = 0; i < numberOfMarkers; i++)
+      {
+      ClusteringNode *node =
+        this->InsertMarker(tree, firstId + i, latitudes[i], longitudes[i]);
+      markerNodes.push_back(node->NodeId);
+      }
+    }
+
+  this->Internals->MarkersChanged = true;
+  return firstId;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkMapMarkerSet::AddMarkers(vtkPoints *points)
+{
+  if (!points || points->GetNumberOfPoints() == 0)
+    {
+    return -1;
+    }
+
+  vtkIdType numberOfMarkers = points->GetNumberOfPoints();
+  std::vector<double> latitudes(numberOfMarkers);
+  std::vector<double> longitudes(numberOfMarkers);
+  double coords[3];
+  for (vtkIdType i = 0; i < numberOfMarkers; i++)
+    {
+    points->GetPoint(i, coords);
+    longitudes[i] = coords[0];
+    latitudes[i] = coords[1];
+    }
+  return this->AddMarkers(numberOfMarkers, &latitudes[0], &longitudes[0]);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::BuildTree(vtkIdType numberOfMarkers,
+                                const double *latitudes,
+                                const double *longitudes)
+{
+  ClusterTree *tree = &this->Internals->Tree;
+  std::vector<vtkTypeUInt32>& markerNodes = this->Internals->MarkerNodes;
+  vtkIdType firstId =
+    static_cast<vtkIdType>(markerNodes.size()) - numberOfMarkers;
+  int bottomLevel = NumberOfClusterLevels - 1;
+
+  // Keep the markers already in the tree, in id order
+  std::vector<vtkIdType> markerIds;
+  std::vector<double> markerCoords;
+  for (vtkIdType id = 0; id < firstId; id++)
+    {
+    if (markerNodes[id] != NoNode)
+      {
+      ClusteringNode *node = tree->GetNode(markerNodes[id]);
+      markerIds.push_back(id);
+      markerCoords.push_back(node->gcsCoords[0]);
+      markerCoords.push_back(node->gcsCoords[1]);
+      }
+    }
+  tree->Initialize(this->Internals->ClusterDistance);
+  this->Internals->CurrentNodes.clear();
+  for (size_t i = 0; i < markerIds.size(); i++)
+    {
+    ClusteringNode *node = tree->NewNode(bottomLevel, &markerCoords[2*i]);
+    node->MarkerId = static_cast<int>(markerIds[i]);
+    markerNodes[markerIds[i]] = node->NodeId;
+    }
+
+  // Then add the nodes of the new markers
+  for (vtkIdType i = 0; i < numberOfMarkers; i++)
+    {
+    double gcsCoords[2];
+    gcsCoords[0] = longitudes[i];
+    gcsCoords[1] = vtkMercator::lat2y(latitudes[i]);
+    ClusteringNode *node = tree->NewNode(bottomLevel, gcsCoords);
+    node->MarkerId = static_cast<int>(firstId + i);
+    markerNodes[firstId + i] = node->NodeId;
+    }
+
+  this->ClusterLevels(tree);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterLevels(ClusterTree *tree)
+{
+  // Each level is clustered from the complete level below, whose nodes
+  // are visited in node id order: a node joins the closest cluster
+  // within the cluster distance, or is copied up as a new cluster. As
+  // clusters grow their centroids move, so those that end up within
+  // the cluster distance of each other are then merged, as they are in
+  // the refinement step of InsertNode(). Each level costs a sort and a
+  // grid search per node.
+  double threshold = this->Internals->ClusterDistance;
+  std::set<ClusteringNode*> parentsToMerge;  // stays empty, no parents yet
+  for (int level = NumberOfClusterLevels - 2; level >= 0; level--)
+    {
+    std::vector<vtkTypeUInt32> childIds(tree->LevelNodes[level + 1]);
+    std::sort(childIds.begin(), childIds.end());
+    for (size_t i = 0; i < childIds.size(); i++)
+      {
+      ClusteringNode *child = tree->GetNode(childIds[i]);
+      ClusteringNode *closest =
+        this->FindClosestNode(tree, child, level, threshold);
+      if (closest)
+        {
+        tree->JoinCluster(closest, child);
+        }
+      else
+        {
+        ClusteringNode *newNode = tree->NewNode(level, child->gcsCoords);
+        newNode->NumberOfMarkers = child->NumberOfMarkers;
+        newNode->MarkerId = child->MarkerId;
+        tree->AddChild(newNode, child);
+        }
+      }
+
+    // Nodes merged into another are deleted, and keep level -1 as no
+    // node is created during this pass
+    std::vector<vtkTypeUInt32> nodeIds(tree->LevelNodes[level]);
+    std::sort(nodeIds.begin(), nodeIds.end());
+    for (size_t i = 0; i < nodeIds.size(); i++)
+      {
+      ClusteringNode *node = tree->GetNode(nodeIds[i]);
+      if (node->Level != level)
+        {
+        continue;
+        }
+      ClusteringNode *closest;
+      while ((closest = this->FindClosestNode(tree, node, level, threshold)))
+        {
+        this->MergeNodes(tree, node, closest, parentsToMerge, level);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkMapMarkerSet::ClusteringNode*
+vtkMapMarkerSet::InsertMarker(ClusterTree *tree, vtkIdType markerId,
+                              double latitude, double longitude)
+{
   vtkDebugMacro("Adding marker " << markerId);
 
-  // Instantiate ClusteringNode
-  ClusteringNode *node = new ClusteringNode;
-  this->Internals->AllNodes.push_back(node);
-  node->NodeId = this->Internals->NumberOfNodes++;
-  node->Level = 0;
-  node->gcsCoords[0] = longitude;
-  node->gcsCoords[1] = vtkMercator::lat2y(latitude);
-  node->NumberOfMarkers = 1;
-  node->Parent = 0;
-  node->MarkerId = markerId;
+  // Instantiate ClusteringNode, at the bottom level when clustering
+  // In non-clustering mode, markers are stored at level 0
+  double gcsCoords[2];
+  gcsCoords[0] = longitude;
+  gcsCoords[1] = vtkMercator::lat2y(latitude);
+  int level = this->Clustering ? NumberOfClusterLevels - 1 : 0;
+  ClusteringNode *node = tree->NewNode(level, gcsCoords);
+  node->MarkerId = static_cast<int>(markerId);
   vtkDebugMacro("Created ClusteringNode id " << node->NodeId);
 
-  // todo refactor into separate method
   // todo calc initial cluster distance here and divide down
   if (this->Clustering)
     {
-    // Insertion step: Starting at bottom level, populate NodeTable until
-    // a clustering partner is found.
-    int level = this->Internals->NodeTable.size() - 1;
-    node->Level = level;
-    vtkDebugMacro("Inserting Node " << node->NodeId
-                  << " into level " << level);
-    this->Internals->NodeTable[level].insert(node);
+    this->InsertNode(tree, node);
+    }
+  return node;
+}
 
-    level--;
-    double threshold = this->Internals->ClusterDistance;
-    for (; level >= 0; level--)
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::InsertNode(ClusterTree *tree, ClusteringNode *node)
+{
+  // Insertion step: Starting at the level of the node, populate the
+  // levels above until a clustering partner is found.
+  int level = node->Level;
+  vtkDebugMacro("Inserting Node " << node->NodeId
+                << " into level " << level);
+
+  level--;
+  double threshold = this->Internals->ClusterDistance;
+  for (; level >= 0; level--)
+    {
+    ClusteringNode *closest =
+      this->FindClosestNode(tree, node, level, threshold);
+    if (closest)
       {
-      ClusteringNode *closest =
-        this->FindClosestNode(node, level, threshold);
-      if (closest)
+      // Todo Update closest node with marker info
+      vtkDebugMacro("Found closest node to " << node->NodeId
+                    << " at " << closest->NodeId);
+      tree->JoinCluster(closest, node);
+
+      // Insertion step ends with first clustering
+      node = closest;
+      break;
+      }
+    else
+      {
+      // Copy node and add to this level
+      ClusteringNode *newNode = tree->NewNode(level, node->gcsCoords);
+      newNode->NumberOfMarkers = node->NumberOfMarkers;
+      newNode->MarkerId = node->MarkerId;
+      tree->AddChild(newNode, node);
+      vtkDebugMacro("Level " << level << " add node " << node->NodeId
+                    << " --> " << newNode->NodeId);
+
+      node = newNode;
+      }
+    }
+
+  // Advance to next level up
+  node = tree->GetParent(node);
+  level--;
+
+  // Refinement step: Continue iterating up while
+  // * Merge any nodes identified in previous iteration
+  // * Update node coordinates
+  // * Check for closest node
+  std::set<ClusteringNode*> nodesToMerge;
+  std::set<ClusteringNode*> parentsToMerge;
+  while (level >= 0)
+    {
+    // Merge nodes identified in previous iteration
+    std::set<ClusteringNode*>::iterator mergingNodeIter =
+      nodesToMerge.begin();
+    for (; mergingNodeIter != nodesToMerge.end(); mergingNodeIter++)
+      {
+      ClusteringNode *mergingNode = *mergingNodeIter;
+      if (node == mergingNode)
         {
-        // Todo Update closest node with marker info
-        vtkDebugMacro("Found closest node to " << node->NodeId
-                      << " at " << closest->NodeId);
-        double denominator = 1.0 + closest->NumberOfMarkers;
-        for (unsigned i=0; i<2; i++)
-          {
-          double numerator = closest->gcsCoords[i]*closest->NumberOfMarkers +
-            node->gcsCoords[i];
-          closest->gcsCoords[i] = numerator/denominator;
-          }
-        closest->NumberOfMarkers++;
-        closest->MarkerId = -1;
-        closest->Children.insert(node);
-        node->Parent = closest;
-
-        // Insertion step ends with first clustering
-        node = closest;
-        break;
+        vtkWarningMacro("Node & merging node the same " << node->NodeId);
         }
       else
         {
-        // Copy node and add to this level
-        ClusteringNode *newNode = new ClusteringNode;
-        this->Internals->AllNodes.push_back(newNode);
-        newNode->NodeId = this->Internals->NumberOfNodes++;
-        newNode->Level = level;
-        newNode->gcsCoords[0] = node->gcsCoords[0];
-        newNode->gcsCoords[1] = node->gcsCoords[1];
-        newNode->NumberOfMarkers = node->NumberOfMarkers;
-        newNode->MarkerId = node->MarkerId;
-        newNode->Parent = NULL;
-        newNode->Children.insert(node);
-        this->Internals->NodeTable[level].insert(newNode);
-        vtkDebugMacro("Level " << level << " add node " << node->NodeId
-                      << " --> " << newNode->NodeId);
-
-        node->Parent = newNode;
-        node = newNode;
+        vtkDebugMacro("At level " << level
+                      << "Merging node " << mergingNode
+                      << " into " << node);
+        this->MergeNodes(tree, node, mergingNode, parentsToMerge, level);
         }
       }
 
-    // Advance to next level up
-    node = node->Parent;
+    // Update coordinates and count
+    this->UpdateNodeFromChildren(tree, node);
+
+    // Check for new clustering partner
+    ClusteringNode *closest =
+      this->FindClosestNode(tree, node, level, threshold);
+    if (closest)
+      {
+      this->MergeNodes(tree, node, closest, parentsToMerge, level);
+      }
+
+    // Setup for next iteration
+    nodesToMerge.clear();
+    nodesToMerge = parentsToMerge;
+    parentsToMerge.clear();
+    node = tree->GetParent(node);
     level--;
+    }
+}
 
-    // Refinement step: Continue iterating up while
-    // * Merge any nodes identified in previous iteration
-    // * Update node coordinates
-    // * Check for closest node
-    std::set<ClusteringNode*> nodesToMerge;
-    std::set<ClusteringNode*> parentsToMerge;
-    while (level >= 0)
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterMarkersInParallel(vtkIdType numberOfMarkers,
+                                               const double *latitudes,
+                                               const double *longitudes)
+{
+  // Split the markers into vertical strips of about the same number of
+  // markers, one per thread. Markers of the same longitude are kept in
+  // the same strip, so that every strip starts at a longitude (edge)
+  // none of the markers of the previous strips reach.
+  std::vector<std::pair<double, vtkIdType> > order(numberOfMarkers);
+  for (vtkIdType i = 0; i < numberOfMarkers; i++)
+    {
+    order[i] = std::make_pair(longitudes[i], i);
+    }
+  std::sort(order.begin(), order.end());
+
+  // SingleMethodExecute() runs no more threads than the global maximum,
+  // strips past it would not be clustered
+  int numberOfThreads = this->NumberOfThreads;
+  int globalMaximum = vtkMultiThreader::GetGlobalMaximumNumberOfThreads();
+  if (globalMaximum > 0)
+    {
+    numberOfThreads = std::min(numberOfThreads, globalMaximum);
+    }
+  vtkIdType numberOfStrips = std::min(
+    static_cast<vtkIdType>(numberOfThreads),
+    numberOfMarkers / MinimumMarkersPerThread);
+  std::vector<MapMarkerSetInternals::Partition*>& partitions =
+    this->Internals->Partitions;
+  std::vector<double> edges;
+  vtkIdType begin = 0;
+  for (vtkIdType k = 1; k <= numberOfStrips; k++)
+    {
+    vtkIdType end = numberOfMarkers * k / numberOfStrips;
+    if (end <= begin)
       {
-      // Merge nodes identified in previous iteration
-      std::set<ClusteringNode*>::iterator mergingNodeIter =
-        nodesToMerge.begin();
-      for (; mergingNodeIter != nodesToMerge.end(); mergingNodeIter++)
+      continue;
+      }
+    while (end < numberOfMarkers && order[end].first == order[end-1].first)
+      {
+      end++;
+      }
+
+    MapMarkerSetInternals::Partition *partition =
+      new MapMarkerSetInternals::Partition;
+    partition->Tree.Initialize(this->Internals->ClusterDistance);
+    for (vtkIdType i = begin; i < end; i++)
+      {
+      partition->Markers.push_back(order[i].second);
+      }
+    std::sort(partition->Markers.begin(), partition->Markers.end());
+    if (!partitions.empty())
+      {
+      edges.push_back(order[begin].first);
+      }
+    partitions.push_back(partition);
+    begin = end;
+    }
+
+  // Cluster each strip into its own tree
+  this->Internals->BatchLatitudes = latitudes;
+  this->Internals->BatchLongitudes = longitudes;
+  this->Internals->BatchFirstId =
+    static_cast<vtkIdType>(this->Internals->MarkerNodes.size()) -
+    numberOfMarkers;
+  vtkNew<vtkMultiThreader> threader;
+  threader->SetNumberOfThreads(static_cast<int>(partitions.size()));
+  threader->SetSingleMethod(vtkMapMarkerSet::ClusterPartitionMain, this);
+  threader->SingleMethodExecute();
+  this->Internals->BatchLatitudes = NULL;
+  this->Internals->BatchLongitudes = NULL;
+
+  // Move the nodes of the strips into the tree, in strip order
+  ClusterTree *tree = &this->Internals->Tree;
+  for (size_t p = 0; p < partitions.size(); p++)
+    {
+    tree->Append(partitions[p]->Tree);
+    delete partitions[p];
+    }
+  partitions.clear();
+
+  this->StitchPartitions(edges);
+
+  // Stitching never merges bottom level nodes, so each one is still the
+  // node of a single marker
+  const std::vector<vtkTypeUInt32>& bottomNodes =
+    tree->LevelNodes[NumberOfClusterLevels - 1];
+  for (size_t i = 0; i < bottomNodes.size(); i++)
+    {
+    ClusteringNode *node = tree->GetNode(bottomNodes[i]);
+    this->Internals->MarkerNodes[node->MarkerId] = node->NodeId;
+    }
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkMapMarkerSet::ClusterPartitionMain(void *arg)
+{
+  vtkMultiThreader::ThreadInfo *info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkMapMarkerSet *self = static_cast<vtkMapMarkerSet*>(info->UserData);
+  self->ClusterPartition(info->ThreadID);
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::ClusterPartition(int index)
+{
+  // Runs on a worker thread, and only touches the tree of its strip
+  MapMarkerSetInternals::Partition *partition =
+    this->Internals->Partitions[index];
+  const double *latitudes = this->Internals->BatchLatitudes;
+  const double *longitudes = this->Internals->BatchLongitudes;
+  vtkIdType firstId = this->Internals->BatchFirstId;
+  for (size_t i = 0; i < partition->Markers.size(); i++)
+    {
+    vtkIdType marker = partition->Markers[i];
+    double gcsCoords[2];
+    gcsCoords[0] = longitudes[marker];
+    gcsCoords[1] = vtkMercator::lat2y(latitudes[marker]);
+    ClusteringNode *node =
+      partition->Tree.NewNode(NumberOfClusterLevels - 1, gcsCoords);
+    node->MarkerId = static_cast<int>(firstId + marker);
+    }
+  this->ClusterLevels(&partition->Tree);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::StitchPartitions(const std::vector<double>& edges)
+{
+  // The strips were clustered separately, so nodes of neighboring strips
+  // may be closer than the cluster distance. Going up from the bottom
+  // level, such nodes are merged, which in turn merges their parents at
+  // the level above, and the nodes whose children changed are updated
+  // before their own level is searched. As with markers added one at a
+  // time, nodes of the bottom level are never merged.
+  ClusterTree *tree = &this->Internals->Tree;
+  double threshold = this->Internals->ClusterDistance;
+  this->Internals->MergedNodes.clear();
+  this->Internals->ChangedParents.clear();
+  this->Internals->ParentsToMerge.clear();
+
+  for (int level = NumberOfClusterLevels - 2; level >= 0; level--)
+    {
+    std::vector<MapMarkerSetInternals::NodePair> parentsToMerge;
+    parentsToMerge.swap(this->Internals->ParentsToMerge);
+    std::set<ClusteringNode*> changedNodes;
+    changedNodes.swap(this->Internals->ChangedParents);
+
+    // Merge the parents of the nodes merged at the level below
+    for (size_t i = 0; i < parentsToMerge.size(); i++)
+      {
+      ClusteringNode *node =
+        this->Internals->FindMergedNode(parentsToMerge[i].first);
+      ClusteringNode *mergingNode =
+        this->Internals->FindMergedNode(parentsToMerge[i].second);
+      if (node != mergingNode)
         {
-        ClusteringNode *mergingNode = *mergingNodeIter;
-        if (node == mergingNode)
-          {
-          vtkWarningMacro("Node & merging node the same " << node->NodeId);
-          }
-        else
-          {
-          vtkDebugMacro("At level " << level
-                        << "Merging node " << mergingNode
-                        << " into " << node);
-          this->MergeNodes(node, mergingNode, parentsToMerge, level);
-          }
+        this->StitchNodes(tree, node, mergingNode, level);
         }
+      }
 
-      // Update coordinates?
-
-      // Update count
-      int numMarkers = 0;
-      double numerator[2];
-      numerator[0] = numerator[1] = 0.0;
-      std::set<ClusteringNode*>::iterator childIter = node->Children.begin();
-      for (; childIter != node->Children.end(); childIter++)
+    // Update the nodes whose children changed
+    std::set<ClusteringNode*> updatedNodes;
+    std::set<ClusteringNode*>::iterator changedIter = changedNodes.begin();
+    for (; changedIter != changedNodes.end(); changedIter++)
+      {
+      ClusteringNode *node = this->Internals->FindMergedNode(*changedIter);
+      if (updatedNodes.insert(node).second)
         {
-        ClusteringNode *child = *childIter;
-        numMarkers += child->NumberOfMarkers;
-        for (int i=0; i<2; i++)
-          {
-          numerator[i] += child->NumberOfMarkers * child->gcsCoords[i];
-          }
+        this->UpdateNodeFromChildren(tree, node);
         }
-      node->NumberOfMarkers = numMarkers;
-      if (numMarkers > 1)
+      }
+
+    // Look for partners across the strip edges, for the nodes within the
+    // cluster distance of an edge, in node id order
+    double gcsThreshold = gcsClusterDistance(threshold, level);
+    std::vector<std::pair<vtkTypeUInt32, ClusteringNode*> > edgeNodes;
+    const std::vector<vtkTypeUInt32>& levelNodes = tree->LevelNodes[level];
+    for (size_t n = 0; n < levelNodes.size(); n++)
+      {
+      ClusteringNode *node = tree->GetNode(levelNodes[n]);
+      double x = node->gcsCoords[0];
+      size_t strip =
+        std::upper_bound(edges.begin(), edges.end(), x) - edges.begin();
+      if ((strip > 0 && x - edges[strip-1] < gcsThreshold) ||
+          (strip < edges.size() && edges[strip] - x < gcsThreshold))
         {
-        node->MarkerId = -1;
+        edgeNodes.push_back(std::make_pair(node->NodeId, node));
         }
-      node->gcsCoords[0] = numerator[0] / numMarkers;
-      node->gcsCoords[1] = numerator[1] / numMarkers;
+      }
+    std::sort(edgeNodes.begin(), edgeNodes.end());
 
-      // Check for new clustering partner
+    for (size_t i = 0; i < edgeNodes.size(); i++)
+      {
+      ClusteringNode *node = edgeNodes[i].second;
+      if (this->Internals->MergedNodes.count(node))
+        {
+        continue;
+        }
       ClusteringNode *closest =
-        this->FindClosestNode(node, level, threshold);
-      if (closest)
+        this->FindClosestNode(tree, node, level, threshold, &edges);
+      if (!closest)
         {
-        this->MergeNodes(node, closest, parentsToMerge, level);
+        continue;
         }
 
-      // Setup for next iteration
-      nodesToMerge.clear();
-      nodesToMerge = parentsToMerge;
-      parentsToMerge.clear();
-      node = node->Parent;
-      level--;
+      // Keep the older node
+      if (closest->NodeId < node->NodeId)
+        {
+        this->StitchNodes(tree, closest, node, level);
+        }
+      else
+        {
+        this->StitchNodes(tree, node, closest, level);
+        }
+      }
+    }
+
+  this->Internals->MergedNodes.clear();
+  this->Internals->ChangedParents.clear();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::StitchNodes(ClusterTree *tree, ClusteringNode *node,
+                                  ClusteringNode *mergingNode, int level)
+{
+  ClusteringNode *parent = tree->GetParent(node);
+  ClusteringNode *mergingParent = tree->GetParent(mergingNode);
+  std::set<ClusteringNode*> parentsToMerge;
+  this->MergeNodes(tree, node, mergingNode, parentsToMerge, level);
+  this->Internals->MergedNodes[mergingNode] = node;
+
+  // The parents now share the children of the merged nodes
+  if (parent)
+    {
+    this->Internals->ChangedParents.insert(parent);
+    }
+  if (mergingParent && mergingParent != parent)
+    {
+    this->Internals->ParentsToMerge.push_back(
+      MapMarkerSetInternals::NodePair(parent, mergingParent));
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::UpdateNodeFromChildren(ClusterTree *tree,
+                                             ClusteringNode *node)
+{
+  // Nodes left without children are deleted, not updated
+  if (node->FirstChild == NoNode)
+    {
+    vtkErrorMacro("Cannot update node " << node->NodeId
+                  << ", it has no children");
+    return;
+    }
+
+  int numMarkers = 0;
+  double numerator[2];
+  numerator[0] = numerator[1] = 0.0;
+  ClusteringNode *child = NULL;
+  vtkTypeUInt32 childId = node->FirstChild;
+  while (childId != NoNode)
+    {
+    child = tree->GetNode(childId);
+    childId = child->NextSibling;
+    numMarkers += child->NumberOfMarkers;
+    for (int i=0; i<2; i++)
+      {
+      numerator[i] += child->NumberOfMarkers * child->gcsCoords[i];
+      }
+    }
+  node->NumberOfMarkers = numMarkers;
+  // A cluster left with one marker, after removals, is that marker again
+  node->MarkerId = numMarkers > 1 ? -1 : child->MarkerId;
+  double gcsCoords[2];
+  gcsCoords[0] = numerator[0] / numMarkers;
+  gcsCoords[1] = numerator[1] / numMarkers;
+  tree->MoveNode(node, gcsCoords);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::SplitNode(ClusterTree *tree, ClusteringNode *node,
+                                std::vector<ClusteringNode*>& detachedNodes)
+{
+  // A child belongs to the cluster while it is within the cluster
+  // distance of it, the same test as for clustering partners
+  double gcsThreshold =
+    gcsClusterDistance(this->Internals->ClusterDistance, node->Level);
+  double gcsThreshold2 = gcsThreshold * gcsThreshold;
+
+  // Detaching a child moves the cluster, so detach one at a time, and
+  // always keep one child
+  while (node->FirstChild != NoNode &&
+         tree->GetNode(node->FirstChild)->NextSibling != NoNode)
+    {
+    ClusteringNode *farthest = NULL;
+    double farthestDistance2 = gcsThreshold2;
+    vtkTypeUInt32 childId = node->FirstChild;
+    while (childId != NoNode)
+      {
+      ClusteringNode *child = tree->GetNode(childId);
+      childId = child->NextSibling;
+      double dx = child->gcsCoords[0] - node->gcsCoords[0];
+      double dy = child->gcsCoords[1] - node->gcsCoords[1];
+      double d2 = dx*dx + dy*dy;
+      if (d2 >= farthestDistance2)
+        {
+        farthest = child;
+        farthestDistance2 = d2;
+        }
       }
+    if (!farthest)
+      {
+      break;
+      }
+
+    vtkDebugMacro("Level " << node->Level << " detach node "
+                  << farthest->NodeId << " from " << node->NodeId);
+    tree->RemoveChild(node, farthest);
+    detachedNodes.push_back(farthest);
+    this->UpdateNodeFromChildren(tree, node);
     }
+}
 
+//----------------------------------------------------------------------------
+bool vtkMapMarkerSet::RemoveMarker(vtkIdType markerId)
+{
+  std::vector<vtkTypeUInt32>& markerNodes = this->Internals->MarkerNodes;
+  if (markerId < 0 ||
+      markerId >= static_cast<vtkIdType>(markerNodes.size()) ||
+      markerNodes[markerId] == NoNode)
+    {
+    vtkWarningMacro("No marker with id " << markerId);
+    return false;
+    }
+
+  vtkDebugMacro("Removing marker " << markerId);
+  ClusterTree *tree = &this->Internals->Tree;
+  ClusteringNode *node = tree->GetNode(markerNodes[markerId]);
+  markerNodes[markerId] = NoNode;
+  this->Internals->NumberOfMarkers--;
   this->Internals->MarkersChanged = true;
 
-  if (false)
+  // Going up from the node of the marker, delete the nodes left without
+  // children, and update the others, splitting off the children now too
+  // far from their cluster. As in the refinement step of the insertion,
+  // the updated nodes may then be close enough to merge with another.
+  // The split off nodes are clustered again only once all levels are
+  // updated, as that may merge nodes of this path.
+  double threshold = this->Internals->ClusterDistance;
+  std::vector<ClusteringNode*> detachedNodes;
+  std::set<ClusteringNode*> nodesToMerge;
+  std::set<ClusteringNode*> parentsToMerge;
+  while (node)
     {
-    // Dump all nodes
-    for (int i=0; i<this->Internals->AllNodes.size(); i++)
+    ClusteringNode *parent = tree->GetParent(node);
+    if (node->FirstChild == NoNode)
       {
-      ClusteringNode *currentNode = this->Internals->AllNodes[i];
-      std::cout << "Node " << i << " has ";
-      if (currentNode)
+      if (parent)
         {
-      std::cout << currentNode->Children.size() << " children, "
-                << currentNode->NumberOfMarkers << " markers, and "
-                << " marker id " << currentNode->MarkerId;
+        tree->RemoveChild(parent, node);
         }
-      else
+      tree->DeleteNode(node);
+      }
+    else
+      {
+      int level = node->Level;
+      std::set<ClusteringNode*>::iterator mergingNodeIter =
+        nodesToMerge.begin();
+      for (; mergingNodeIter != nodesToMerge.end(); mergingNodeIter++)
         {
-        std::cout << " been deleted";
+        if (*mergingNodeIter != node)
+          {
+          this->MergeNodes(tree, node, *mergingNodeIter, parentsToMerge,
+                           level);
+          }
+        }
+
+      this->UpdateNodeFromChildren(tree, node);
+      this->SplitNode(tree, node, detachedNodes);
+
+      ClusteringNode *closest =
+        this->FindClosestNode(tree, node, level, threshold);
+      if (closest)
+        {
+        this->MergeNodes(tree, node, closest, parentsToMerge, level);
         }
-      std::cout << "\n";
       }
-    std::cout << std::endl;
+
+    nodesToMerge.clear();
+    nodesToMerge.swap(parentsToMerge);
+    node = parent;
     }
 
-  return markerId;
+  // Cluster the split off nodes, top levels first, so that the levels
+  // searched for their partners have no other node without parent
+  std::vector<std::pair<int, vtkTypeUInt32> > order;
+  for (size_t i = 0; i < detachedNodes.size(); i++)
+    {
+    order.push_back(
+      std::make_pair(detachedNodes[i]->Level, detachedNodes[i]->NodeId));
+    }
+  std::sort(order.begin(), order.end());
+  for (size_t i = 0; i < order.size(); i++)
+    {
+    this->InsertNode(tree, tree->GetNode(order[i].second));
+    }
+
+  return true;
 }
 
 //----------------------------------------------------------------------------
 void vtkMapMarkerSet::RemoveMarkers()
 {
-  // Explicitly delete node instances in the table
-  std::vector<std::set<ClusteringNode*> >::iterator tableIter =
-    this->Internals->NodeTable.begin();
-  for (; tableIter != this->Internals->NodeTable.end(); tableIter++)
-    {
-    std::set<ClusteringNode*> nodeSet = *tableIter;
-    std::set<ClusteringNode*>::iterator nodeIter = nodeSet.begin();
-    for (; nodeIter != nodeSet.end(); nodeIter++)
-      {
-      delete *nodeIter;
-      }
-    nodeSet.clear();
-    tableIter->operator=(nodeSet);
-    }
+  // Release all node blocks, instead of keeping the deleted nodes around
+  this->Internals->Tree.Initialize(this->Internals->ClusterDistance);
 
   this->Internals->CurrentNodes.clear();
+  this->Internals->MarkerNodes.clear();
   this->Internals->NumberOfMarkers = 0;
-  this->Internals->NumberOfNodes = 0;
   this->Internals->MarkersChanged = true;
 }
 
+//----------------------------------------------------------------------------
+int vtkMapMarkerSet::GetNumberOfMarkers()
+{
+  return this->Internals->NumberOfMarkers;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapMarkerSet::GetClusterSizes(int zoomLevel, std::vector<int>& sizes)
+{
+  // Same level as drawn by Update()
+  zoomLevel = std::max(0, std::min(zoomLevel, NumberOfClusterLevels - 1));
+  if (!this->Clustering)
+    {
+    zoomLevel = 0;
+    }
+
+  sizes.clear();
+  const std::vector<vtkTypeUInt32>& levelNodes =
+    this->Internals->Tree.LevelNodes[zoomLevel];
+  for (size_t i = 0; i < levelNodes.size(); i++)
+    {
+    sizes.push_back(
+      this->Internals->Tree.GetNode(levelNodes[i])->NumberOfMarkers);
+    }
+}
+
 //----------------------------------------------------------------------------
 void vtkMapMarkerSet::Update(int zoomLevel)
 {
@@ -394,13 +1376,13 @@ void vtkMapMarkerSet::Update(int zoomLevel)
   double b = 4.0*k - 4.0;
 
   this->Internals->CurrentNodes.clear();
-  std::set<ClusteringNode*> nodeSet = this->Internals->NodeTable[zoomLevel];
-  std::set<ClusteringNode*>::const_iterator iter;
-  for (iter = nodeSet.begin(); iter != nodeSet.end(); iter++)
+  const std::vector<vtkTypeUInt32>& levelNodes =
+    this->Internals->Tree.LevelNodes[zoomLevel];
+  for (size_t i = 0; i < levelNodes.size(); i++)
     {
-    ClusteringNode *node = *iter;
+    ClusteringNode *node = this->Internals->Tree.GetNode(levelNodes[i]);
     points->InsertNextPoint(node->gcsCoords);
-    this->Internals->CurrentNodes.push_back(node);
+    this->Internals->CurrentNodes.push_back(levelNodes[i]);
     if (node->NumberOfMarkers == 1)  // point marker
       {
       markerType = 0;
@@ -455,10 +1437,16 @@ PickPoint(vtkRenderer *renderer, vtkPicker *picker, int displayCoords[2],
       if (glyphIdArray)
         {
         int glyphId = glyphIdArray->GetValue(pointId);
+        if (glyphId < 0 ||
+            glyphId >= static_cast<int>(this->Internals->CurrentNodes.size()))
+          {
+          return;
+          }
         // std::cout << "Point id " << pointId
         //           << " - Data " << glyphId << std::endl;
 
-        ClusteringNode *node = this->Internals->CurrentNodes[glyphId];
+        ClusteringNode *node =
+          this->Internals->Tree.GetNode(this->Internals->CurrentNodes[glyphId]);
         // std::cout << "Marker id " << marker->MarkerId
         //           << ", Count " << marker->NumberOfMarkers
         //           << ", at " << marker->Latitude << ", " << marker->Longitude
@@ -565,36 +1553,67 @@ void vtkMapMarkerSet::InitializeRenderingPipeline()
 //----------------------------------------------------------------------------
 vtkMapMarkerSet::ClusteringNode*
 vtkMapMarkerSet::
-FindClosestNode(ClusteringNode *node, int zoomLevel, double distanceThreshold)
+FindClosestNode(ClusterTree *tree, ClusteringNode *node, int zoomLevel,
+                double distanceThreshold, const std::vector<double> *edges)
 {
   // Convert distanceThreshold from image to gcs coords
-  double level0Scale = 360.0 / 256.0;  // 360 degress <==> 256 tile pixels
-  double scale = level0Scale / static_cast<double>(1<<zoomLevel);
-  double gcsThreshold = scale * distanceThreshold;
+  double gcsThreshold = gcsClusterDistance(distanceThreshold, zoomLevel);
   double gcsThreshold2 = gcsThreshold * gcsThreshold;
 
+  // Only the grid cells within the threshold of the node can hold a
+  // partner, which is one cell around it for the default threshold
+  typedef ClusterTree::GridCell GridCell;
+  int reach = static_cast<int>(
+    std::ceil(gcsThreshold / tree->GridCellSizes[zoomLevel]));
+  GridCell center = tree->ComputeGridCell(node->gcsCoords, zoomLevel);
+
+  // When stitching strips, only nodes of other strips are partners
+  size_t strip = 0;
+  if (edges)
+    {
+    strip = std::upper_bound(edges->begin(), edges->end(),
+                             node->gcsCoords[0]) - edges->begin();
+    }
+
   ClusteringNode *closestNode = NULL;
   double closestDistance2 = gcsThreshold2;
-  std::set<ClusteringNode*> nodeSet = this->Internals->NodeTable[zoomLevel];
-  std::set<ClusteringNode*>::const_iterator setIter = nodeSet.begin();
-  for (; setIter != nodeSet.end(); setIter++)
+  for (int i = center.first - reach; i <= center.first + reach; i++)
     {
-    ClusteringNode *other = *setIter;
-    if (other == node)
+    for (int j = center.second - reach; j <= center.second + reach; j++)
       {
-      continue;
-      }
+      vtkTypeUInt32 otherId = tree->GetFirstNodeInCell(zoomLevel, i, j);
+      while (otherId != NoNode)
+        {
+        ClusteringNode *other = tree->GetNode(otherId);
+        otherId = other->NextInCell;
+        if (other == node)
+          {
+          continue;
+          }
+        if (edges &&
+            strip == static_cast<size_t>(
+              std::upper_bound(edges->begin(), edges->end(),
+                               other->gcsCoords[0]) - edges->begin()))
+          {
+          continue;
+          }
 
-    double d2 = 0.0;
-    for (int i=0; i<2; i++)
-      {
-      double d1 = other->gcsCoords[i] - node->gcsCoords[i];
-      d2 += d1 * d1;
-      }
-    if (d2 < closestDistance2)
-      {
-      closestNode = other;
-      closestDistance2 = d2;
+        double d2 = 0.0;
+        for (int k=0; k<2; k++)
+          {
+          double d1 = other->gcsCoords[k] - node->gcsCoords[k];
+          d2 += d1 * d1;
+          }
+        // Break ties on the node id, so that the partner does not
+        // depend on the order the grid cells are visited in
+        if (d2 < closestDistance2 ||
+            (d2 == closestDistance2 && closestNode &&
+             other->NodeId < closestNode->NodeId))
+          {
+          closestNode = other;
+          closestDistance2 = d2;
+          }
+        }
       }
     }
 
@@ -604,7 +1623,8 @@ FindClosestNode(ClusteringNode *node, int zoomLevel, double distanceThreshold)
 //----------------------------------------------------------------------------
 void
 vtkMapMarkerSet::
-MergeNodes(ClusteringNode *node, ClusteringNode *mergingNode,
+MergeNodes(ClusterTree *tree, ClusteringNode *node,
+           ClusteringNode *mergingNode,
            std::set<ClusteringNode*>& parentsToMerge, int level)
 {
   vtkDebugMacro("Merging " << mergingNode->NodeId
@@ -619,49 +1639,68 @@ MergeNodes(ClusteringNode *node, ClusteringNode *mergingNode,
   // Update gcsCoords
   int numMarkers = node->NumberOfMarkers + mergingNode->NumberOfMarkers;
   double denominator = static_cast<double>(numMarkers);
+  double gcsCoords[2];
   for (unsigned i=0; i<2; i++)
     {
     double numerator = node->gcsCoords[i]*node->NumberOfMarkers +
       mergingNode->gcsCoords[i]*mergingNode->NumberOfMarkers;
-    node->gcsCoords[i] = numerator/denominator;
+    gcsCoords[i] = numerator/denominator;
     }
+  tree->MoveNode(node, gcsCoords);
   node->NumberOfMarkers = numMarkers;
   node->MarkerId  = -1;
 
-  // Update links to/from children of merging node
-  // Make a working copy of the child set
-  std::set<ClusteringNode*> childNodeSet(mergingNode->Children);
-  std::set<ClusteringNode*>::iterator childNodeIter =
-    childNodeSet.begin();
-  for (; childNodeIter != childNodeSet.end(); childNodeIter++)
+  // Update links to/from children of merging node, moving its whole
+  // child list in front of the list of node
+  vtkTypeUInt32 childId = mergingNode->FirstChild;
+  ClusteringNode *lastChild = NULL;
+  while (childId != NoNode)
     {
-    ClusteringNode *childNode = *childNodeIter;
-    node->Children.insert(childNode);
-    childNode->Parent = node;
+    lastChild = tree->GetNode(childId);
+    lastChild->Parent = node->NodeId;
+    childId = lastChild->NextSibling;
+    }
+  if (lastChild)
+    {
+    lastChild->NextSibling = node->FirstChild;
+    if (node->FirstChild != NoNode)
+      {
+      tree->GetNode(node->FirstChild)->PreviousSibling = lastChild->NodeId;
+      }
+    node->FirstChild = mergingNode->FirstChild;
+    mergingNode->FirstChild = NoNode;
     }
 
   // Adjust parent marker counts
   // Todo recompute from children
+  // Nodes at the top level (0) have no parent
   int n = mergingNode->NumberOfMarkers;
-  node->Parent->NumberOfMarkers += n;
-  mergingNode->Parent->NumberOfMarkers -= n;
+  ClusteringNode *parent = tree->GetParent(node);
+  ClusteringNode *mergingParent = tree->GetParent(mergingNode);
+  if (parent)
+    {
+    parent->NumberOfMarkers += n;
+    }
+  if (mergingParent)
+    {
+    mergingParent->NumberOfMarkers -= n;
 
-  // Remove mergingNode from its parent
-  ClusteringNode *parent =  mergingNode->Parent;
-  parent->Children.erase(mergingNode);
+    // Remove mergingNode from its parent
+    tree->RemoveChild(mergingParent, mergingNode);
+    }
 
   // Remember parent node if different than node's parent
-  if (mergingNode->Parent && mergingNode->Parent != node->Parent)
+  if (mergingParent && mergingParent != parent)
     {
-    parentsToMerge.insert(mergingNode->Parent);
+    parentsToMerge.insert(mergingParent);
     }
 
   // Delete mergingNode
   // todo only delete if valid level specified?
-  int count = this->Internals->NodeTable[level].count(mergingNode);
-  if (count == 1)
+  if (mergingNode->Level == level &&
+      tree->LevelNodes[level][mergingNode->LevelIndex] == mergingNode->NodeId)
     {
-    this->Internals->NodeTable[level].erase(mergingNode);
+    tree->DeleteNode(mergingNode);
     }
   else
     {
@@ -669,6 +1708,4 @@ MergeNodes(ClusteringNode *node, ClusteringNode *mergingNode,
                   << " not found at level " << level);
     }
   // todo Check CurrentNodes too?
-  this->Internals->AllNodes[mergingNode->NodeId] = NULL;
-  delete mergingNode;
 }
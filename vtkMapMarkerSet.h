@@ -18,15 +18,18 @@
 #ifndef __vtkMapMarkerSet_h
 #define __vtkMapMarkerSet_h
 
+#include <vtkMultiThreader.h>
 #include <vtkObject.h>
 #include "vtkmap_export.h"
 #include <set>
+#include <vector>
 
 class vtkActor;
 class vtkMapClusteredMarkerSet;
 class vtkMapPickResult;
 class vtkMapper;
 class vtkPicker;
+class vtkPoints;
 class vtkPolyDataMapper;
 class vtkPolyData;
 class vtkRenderer;
@@ -58,14 +61,60 @@ public:
   vtkSetClampMacro(MaxClusterScaleFactor, double, 1.0, 100.0);
   vtkGetMacro(MaxClusterScaleFactor, double);
 
+  // Description:
+  // Set/get the number of threads AddMarkers() uses to cluster a batch
+  // of markers, default is 1. Threads are only used for the first batch
+  // added to an empty set, when it has at least 2000 markers, with at
+  // most one thread per 1000 markers and no more than vtkMultiThreader's
+  // global maximum. The markers are then split into vertical strips, each
+  // clustered bottom-up on its own thread, and the clusters across the
+  // strip edges are merged afterwards on the calling thread. The
+  // clusters near the edges can differ slightly from those of a batch
+  // clustered on one thread.
+  vtkSetClampMacro(NumberOfThreads, int, 1, VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads, int);
+
   // Description:
   // Add marker to map, returns id
   vtkIdType AddMarker(double latitude, double longitude);
 
+  // Description:
+  // Add markers to map, from arrays of latitudes and longitudes, or from
+  // points holding the longitude and latitude of each marker as their x
+  // and y coords. The markers get consecutive ids. Returns the id of the
+  // first marker, or -1 if there are none.
+  // When clustering, a batch at least as large as the set rebuilds the
+  // cluster tree one level at a time, from the bottom up, in O(N log N).
+  // Each level is clustered from the whole level below rather than one
+  // marker at a time, so the clusters can differ slightly from those of
+  // markers added with AddMarker(). Smaller batches are inserted one
+  // marker at a time. See SetNumberOfThreads() for clustering a batch on
+  // several threads.
+  vtkIdType AddMarkers(vtkIdType numberOfMarkers, const double *latitudes,
+                       const double *longitudes);
+  vtkIdType AddMarkers(vtkPoints *points);
+
+  // Description:
+  // Removes one marker, and updates the clusters it was part of without
+  // rebuilding them: emptied clusters are deleted, and the nodes now too
+  // far from the rest of their cluster are clustered again. Returns false
+  // if there is no marker with that id. Ids are not reused.
+  bool RemoveMarker(vtkIdType markerId);
+
   // Description:
   // Removes all map markers
   void RemoveMarkers();
 
+  // Description:
+  // Returns the number of markers in the set
+  int GetNumberOfMarkers();
+
+  // Description:
+  // Get the number of markers of each marker drawn at a zoom level:
+  // the size of each cluster, or 1 for single markers. The order is
+  // unspecified.
+  void GetClusterSizes(int zoomLevel, std::vector<int>& sizes);
+
   // Description:
   // Update the marker geometry to draw the map
   void Update(int zoomLevel);
@@ -93,6 +142,10 @@ public:
   // Sets the max size to render cluster glyphs (based on marker count)
   double MaxClusterScaleFactor;
 
+  // Description:
+  // Number of threads clustering batches of markers
+  int NumberOfThreads;
+
   // Description:
   // The renderer used to draw maps
   vtkRenderer* Renderer;
@@ -102,11 +155,63 @@ public:
   vtkActor *Actor;
 
   class ClusteringNode;
-  ClusteringNode *FindClosestNode(ClusteringNode *node, int zoomLevel,
-                                  double distanceThreshold);
-  void MergeNodes(ClusteringNode *node, ClusteringNode *mergingNode,
+  class ClusterTree;
+
+  // Description:
+  // Creates the node of a marker and inserts it into a cluster tree.
+  // Returns the node of the marker.
+  ClusteringNode *InsertMarker(ClusterTree *tree, vtkIdType markerId,
+                               double latitude, double longitude);
+
+  // Description:
+  // Clusters a node without parent into the levels above it
+  void InsertNode(ClusterTree *tree, ClusteringNode *node);
+
+  // Description:
+  // Rebuilds the cluster tree bottom-up from the markers already in the
+  // set and a batch of new markers, which have the last marker ids
+  void BuildTree(vtkIdType numberOfMarkers, const double *latitudes,
+                 const double *longitudes);
+
+  // Description:
+  // Clusters the bottom level of a tree, whose nodes have no parent yet,
+  // into the levels above it, one whole level at a time
+  void ClusterLevels(ClusterTree *tree);
+
+  // Description:
+  // Detaches the children too far from a node to be part of its cluster,
+  // farthest first, and appends them to detachedNodes
+  void SplitNode(ClusterTree *tree, ClusteringNode *node,
+                 std::vector<ClusteringNode*>& detachedNodes);
+
+  // Description:
+  // Clusters a batch of markers in vertical strips, one per thread,
+  // then stitches the strips together
+  void ClusterMarkersInParallel(vtkIdType numberOfMarkers,
+                                const double *latitudes,
+                                const double *longitudes);
+  static VTK_THREAD_RETURN_TYPE ClusterPartitionMain(void *arg);
+  void ClusterPartition(int index);
+  void StitchPartitions(const std::vector<double>& edges);
+  void StitchNodes(ClusterTree *tree, ClusteringNode *node,
+                   ClusteringNode *mergingNode, int level);
+
+  // Description:
+  // Finds the closest node within distanceThreshold at a level, the one
+  // with the lowest node id among equally close nodes. If the strip
+  // edges are given, only nodes of other strips are considered.
+  ClusteringNode *FindClosestNode(ClusterTree *tree, ClusteringNode *node,
+                                  int zoomLevel, double distanceThreshold,
+                                  const std::vector<double> *edges = NULL);
+  void MergeNodes(ClusterTree *tree, ClusteringNode *node,
+                  ClusteringNode *mergingNode,
                   std::set<ClusteringNode*>& parentsToMerge, int level);
 
+  // Description:
+  // Recomputes the marker count and coordinates of a node from its
+  // children
+  void UpdateNodeFromChildren(ClusterTree *tree, ClusteringNode *node);
+
  private:
   class MapMarkerSetInternals;
   MapMarkerSetInternals* Internals;
@@ -13,24 +13,22 @@
 =========================================================================*/
 
 #include "vtkMapTile.h"
-#include "vtkOsmLayer.h"
+#include "vtkMapTileImageCache.h"
+#include "vtkMapTileStore.h"
 
 // VTK Includes
 #include <vtkActor.h>
+#include <vtkImageData.h>
 #include <vtkObjectFactory.h>
 #include <vtkPlaneSource.h>
 #include <vtkPolyDataMapper.h>
-#include <vtkPNGReader.h>
 #include <vtkProperty.h>
 #include <vtkTexture.h>
 #include <vtkTextureMapToPlane.h>
 #include <vtkNew.h>
 
-#include <curl/curl.h>
-
-#include <cstdio>  // for remove()
+#include <algorithm>
 #include <sstream>
-#include <fstream>
 
 vtkStandardNewMacro(vtkMapTile)
 
@@ -43,8 +41,15 @@ vtkMapTile::vtkMapTile()
   Mapper = 0;
   this->Bin = Hidden;
   this->VisibleFlag = false;
+  this->Placeholder = false;
   this->Corners[0] = this->Corners[1] =
   this->Corners[2] = this->Corners[3] = 0.0;
+  this->Store = NULL;
+  this->TileIndex[0] = this->TileIndex[1] = this->TileIndex[2] = 0;
+  this->ExpirationTime = VTK_DOUBLE_MAX;
+  this->PlaceholderTexture = NULL;
+  this->PlaceholderCorners[0] = this->PlaceholderCorners[1] =
+  this->PlaceholderCorners[2] = this->PlaceholderCorners[3] = 0.0;
 }
 
 //----------------------------------------------------------------------------
@@ -69,42 +74,148 @@ vtkMapTile::~vtkMapTile()
     {
     Mapper->Delete();
     }
+
+  if (this->PlaceholderTexture)
+    {
+    this->PlaceholderTexture->UnRegister(this);
+    }
+
+  this->SetStore(NULL);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTile::SetStore(vtkMapTileStore *store)
+{
+  if (store == this->Store)
+    {
+    return;
+    }
+  if (store)
+    {
+    store->Register(this);
+    }
+  if (this->Store)
+    {
+    this->Store->UnRegister(this);
+    }
+  this->Store = store;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTile::SetPlaceholderTexture(vtkTexture *texture,
+                                       const double corners[4])
+{
+  if (texture == this->PlaceholderTexture &&
+      (!texture || std::equal(corners, corners + 4, this->PlaceholderCorners)))
+    {
+    return;
+    }
+
+  if (texture)
+    {
+    texture->Register(this);
+    std::copy(corners, corners + 4, this->PlaceholderCorners);
+    }
+  if (this->PlaceholderTexture)
+    {
+    this->PlaceholderTexture->UnRegister(this);
+    }
+  this->PlaceholderTexture = texture;
+  this->Modified();
 }
 
 //----------------------------------------------------------------------------
-void vtkMapTile::Build(const char* cacheDirectory)
+void vtkMapTile::Build()
 {
+  // Pipeline objects are created once and reused when the tile is rebuilt
+  if (!this->Plane)
+    {
+    this->Plane = vtkPlaneSource::New();
+    this->TexturePlane = vtkTextureMapToPlane::New();
+    this->TexturePlane->SetInputConnection(this->Plane->GetOutputPort());
+
+    this->Mapper = vtkPolyDataMapper::New();
+    this->Mapper->SetInputConnection(this->TexturePlane->GetOutputPort());
+
+    this->Actor = vtkActor::New();
+    this->Actor->SetMapper(this->Mapper);
+    this->Actor->PickableOff();
+    }
 
-  this->Plane = vtkPlaneSource::New();
   this->Plane->SetPoint1(this->Corners[2], this->Corners[1], 0.0);
   this->Plane->SetPoint2(this->Corners[0], this->Corners[3], 0.0);
   this->Plane->SetOrigin(this->Corners[0], this->Corners[1], 0.0);
   this->Plane->SetNormal(0, 0, 1);
 
-  this->TexturePlane = vtkTextureMapToPlane::New();
-  this->InitializeDownload(cacheDirectory);
-
-  // Read the image which will be the texture
-  vtkNew<vtkPNGReader> pngReader;
-  pngReader->SetFileName (this->ImageFile.c_str());
-  pngReader->Update();
-
-  // Apply the texture
-  vtkNew<vtkTexture> texture;
-  texture->SetInputConnection(pngReader->GetOutputPort());
-  texture->SetQualityTo32Bit();
-  texture->SetInterpolate(1);
-  this->TexturePlane->SetInputConnection(Plane->GetOutputPort());
+  double sRange[2] = { 0.0, 1.0 };
+  double tRange[2] = { 0.0, 1.0 };
+  vtkSmartPointer<vtkImageData> image = this->LoadImage();
+  if (image)
+    {
+    // Apply the texture. The image is passed as data rather than
+    // through the pipeline, since it may be shared with other tiles.
+    vtkNew<vtkTexture> texture;
+    texture->SetInputData(image);
+    texture->SetQualityTo32Bit();
+    texture->SetInterpolate(1);
+    this->Actor->SetTexture(texture.GetPointer());
+    this->Actor->GetProperty()->SetColor(1.0, 1.0, 1.0);
+    this->Placeholder = false;
+
+    this->UpdateExpirationTime();
+
+    // The ancestor texture is no longer needed
+    if (this->PlaceholderTexture)
+      {
+      this->PlaceholderTexture->UnRegister(this);
+      this->PlaceholderTexture = NULL;
+      }
+    }
+  else if (this->PlaceholderTexture)
+    {
+    // Crop the ancestor texture to the extent of this tile
+    const double *pc = this->PlaceholderCorners;
+    sRange[0] = (this->Corners[0] - pc[0]) / (pc[2] - pc[0]);
+    sRange[1] = (this->Corners[2] - pc[0]) / (pc[2] - pc[0]);
+    tRange[0] = (this->Corners[1] - pc[1]) / (pc[3] - pc[1]);
+    tRange[1] = (this->Corners[3] - pc[1]) / (pc[3] - pc[1]);
+    this->Actor->SetTexture(this->PlaceholderTexture);
+    this->Actor->GetProperty()->SetColor(1.0, 1.0, 1.0);
+    this->Placeholder = true;
+    }
+  else
+    {
+    // Draw a plain tile until the image can be downloaded
+    this->Actor->SetTexture(NULL);
+    this->Actor->GetProperty()->SetColor(0.85, 0.85, 0.85);
+    this->Placeholder = true;
+    }
+  this->TexturePlane->SetSRange(sRange);
+  this->TexturePlane->SetTRange(tRange);
 
-  this->Mapper = vtkPolyDataMapper::New();
-  this->Mapper->SetInputConnection(this->TexturePlane->GetOutputPort());
+  this->BuildTime.Modified();
+}
 
-  this->Actor = vtkActor::New();
-  this->Actor->SetMapper(Mapper);
-  this->Actor->SetTexture(texture.GetPointer());
-  this->Actor->PickableOff();
+//----------------------------------------------------------------------------
+void vtkMapTile::UpdateExpirationTime()
+{
+  // The metadata of a fresh download may still be queued for writing,
+  // its expiration time is then already set
+  vtkMapTileStore::TileMetadata metadata;
+  if (this->Store &&
+      this->Store->GetTileMetadata(this->TileIndex[0], this->TileIndex[1],
+                                   this->TileIndex[2], metadata))
+    {
+    this->ExpirationTime = metadata.ExpirationTime;
+    }
+}
 
-  this->BuildTime.Modified();
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkImageData> vtkMapTile::LoadImage()
+{
+  // Images are decoded off the render thread by vtkMapTileDecoder
+  return vtkMapTileImageCache::GetInstance()->GetImage(this->ImageSource);
 }
 
 //----------------------------------------------------------------------------
@@ -132,74 +243,25 @@ bool vtkMapTile::IsVisible()
 }
 
 //----------------------------------------------------------------------------
-void vtkMapTile::InitializeDownload(const char *cacheDirectory)
+vtkTypeUInt64 vtkMapTile::ComputeTileId(int zoom, int x, int y)
 {
-  // Generate destination file name
-  this->ImageFile = std::string(cacheDirectory) + "/" + this->ImageKey + ".png";
-
-  // Check if texture already exists.
-  // If not, download
-  while(!this->IsImageDownloaded(this->ImageFile.c_str()))
-    {
-    std::cerr << "Downloading " << this->ImageSource.c_str() << std::endl;
-    this->DownloadImage(this->ImageSource.c_str(), this->ImageFile.c_str());
-    }
+  // 2^24 tiles per axis is well beyond the deepest zoom level in use
+  return (static_cast<vtkTypeUInt64>(zoom) << 48) |
+    (static_cast<vtkTypeUInt64>(x) << 24) | static_cast<vtkTypeUInt64>(y);
 }
 
 //----------------------------------------------------------------------------
-bool vtkMapTile::IsImageDownloaded(const char *outfile)
+bool vtkMapTile::IsImageDownloaded()
 {
-  // Check if file can be opened
-  // Additional checks to confirm existence of correct
-  // texture can be added
-  std::ifstream file(outfile);
-  if ( file.is_open() )
-    {
-    file.close();
-    return true;
-    }
-  else
-    {
-    file.close();
-    return false;
-    }
+  return this->Store && this->Store->HasTile(this->TileIndex[0],
+                                             this->TileIndex[1],
+                                             this->TileIndex[2]);
 }
 
 //----------------------------------------------------------------------------
-void vtkMapTile::DownloadImage(const char *url, const char *outfilename)
+bool vtkMapTile::IsImageDecoded()
 {
-  // Download file from url and store in outfilename
-  // Uses libcurl
-  CURL* curl;
-  FILE* fp;
-  CURLcode res;
-  char errorBuffer[CURL_ERROR_SIZE];
-  curl = curl_easy_init();
-
-  if(curl)
-    {
-    fp = fopen(outfilename, "wb");
-    if(!fp)
-      {
-      vtkErrorMacro( << "Not Open")
-      return;
-      }
-
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, NULL);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-    res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-    fclose(fp);
-
-    //if curl failed remove the file
-    if (res != CURLE_OK)
-      {
-      remove(outfilename);
-      vtkWarningMacro(<<errorBuffer);
-      }
-    }
+  return vtkMapTileImageCache::GetInstance()->HasImage(this->ImageSource);
 }
 
 //----------------------------------------------------------------------------
@@ -215,10 +277,9 @@ void vtkMapTile::Init()
 {
   if (this->GetMTime() > this->BuildTime.GetMTime())
     {
-    vtkOsmLayer *osmLayer = vtkOsmLayer::SafeDownCast(this->Layer);
-    this->Build(osmLayer->GetCacheDirectory());
+    this->Build();
     }
-  this->Layer->GetRenderer()->AddActor(this->Actor);
+  // The layer draws the actor, see vtkOsmLayer
 }
 
 //----------------------------------------------------------------------------
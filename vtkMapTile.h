@@ -21,10 +21,16 @@
 #include "vtkFeature.h"
 #include "vtkmap_export.h"
 
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+
 class vtkStdString;
 class vtkPlaneSource;
 class vtkActor;
+class vtkImageData;
+class vtkMapTileStore;
 class vtkPolyDataMapper;
+class vtkTexture;
 class vtkTextureMapToPlane;
 
 class VTKMAP_EXPORT vtkMapTile : public vtkFeature
@@ -44,6 +50,55 @@ public:
   void  SetImageSource(const std::string& imgSrc) {this->ImageSource= imgSrc;}
   std::string GetImageSource() {return this->ImageSource;}
 
+  // Description:
+  // Get/Set the store holding the tile image
+  virtual void SetStore(vtkMapTileStore *store);
+  vtkGetObjectMacro(Store, vtkMapTileStore)
+
+  // Description:
+  // Get/Set the zoom level and x/y index of the tile in the store
+  vtkSetVector3Macro(TileIndex, int)
+  vtkGetVector3Macro(TileIndex, int)
+
+  // Description:
+  // Check if the tile image is available in the store
+  bool IsImageDownloaded();
+
+  // Description:
+  // Check if the decoded tile image is in the shared image cache
+  bool IsImageDecoded();
+
+  // Description:
+  // Returns true if the tile was built without its image, in which
+  // case a plain placeholder tile is drawn
+  vtkGetMacro(Placeholder, bool)
+
+  // Description:
+  // Get/Set the time in seconds since the epoch after which the image
+  // must be revalidated with the server. Read from the store when the
+  // tile is built, VTK_DOUBLE_MAX if it has no metadata. Setting it
+  // does not rebuild the tile.
+  void SetExpirationTime(double time) { this->ExpirationTime = time; }
+  vtkGetMacro(ExpirationTime, double)
+
+  // Description:
+  // Read the expiration time from the metadata of the image in the store,
+  // if it has any. Called when the tile is built; tiles drawn by a
+  // vtkMapTileAtlas are never built.
+  void UpdateExpirationTime();
+
+  // Description:
+  // Set the texture of an ancestor tile, and the world extent it covers
+  // as (lowerleft, upper right). Until its own image is available, the
+  // tile is drawn with the part of that texture it covers, instead of a
+  // plain placeholder.
+  void SetPlaceholderTexture(vtkTexture *texture, const double corners[4]);
+  vtkGetObjectMacro(PlaceholderTexture, vtkTexture)
+
+  // Description:
+  // Pack zoom level and tile indices into a single id
+  static vtkTypeUInt64 ComputeTileId(int zoom, int x, int y);
+
   // Description:
   // Get/Set corners of the tile (lowerleft, upper right)
   vtkGetVector4Macro(Corners, double);
@@ -68,8 +123,10 @@ public:
   bool IsVisible();
 
   // Description:
-  // Create the geometry and download
-  // the image if necessary
+  // Create the geometry and texture from the cached tile image,
+  // or a placeholder if the image is not in the cache. The actor is
+  // not added to the renderer, vtkOsmLayer draws it with the other
+  // tiles. See vtkMapTileDownloader.
   virtual void Init();
 
   // Description:
@@ -86,25 +143,16 @@ protected:
   vtkMapTile();
   ~vtkMapTile();
 
-  void Build(const char* cacheDirectory);
-
-  // Description:
-  // Check if the corresponding image is downloaded
-  bool IsImageDownloaded(const char* outfile);
-
-  // Description:
-  // Download the image corresponding to the Bing Maps QuadKey
-  void DownloadImage(const char* url, const char* outfilename);
+  void Build();
 
   // Description:
-  // Generate url of tile and output file from QuadKey, and download the texture
-  // if not already downloaded.
-  void InitializeDownload(const char *cacheDirectory);
+  // Returns the decoded tile image from the shared image cache,
+  // or NULL if it has not been decoded yet
+  vtkSmartPointer<vtkImageData> LoadImage();
 
   // Description:
   // Storing the Quadkey
   std::string ImageSource;
-  std::string ImageFile;
   std::string ImageKey;
 
   vtkPlaneSource* Plane;
@@ -114,7 +162,13 @@ protected:
 
   int Bin;
   bool VisibleFlag;
+  bool Placeholder;
   double Corners[4];
+  vtkMapTileStore* Store;
+  int TileIndex[3];
+  vtkTexture* PlaceholderTexture;
+  double PlaceholderCorners[4];
+  double ExpirationTime;
 
 private:
   vtkMapTile(const vtkMapTile&);  // Not implemented
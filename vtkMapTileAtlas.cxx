@@ -0,0 +1,429 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileAtlas.h"
+
+// VTK Includes
+#include <vtkActor.h>
+#include <vtkCellArray.h>
+#include <vtkFloatArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataMapper.h>
+#include <vtkProperty.h>
+#include <vtkSmartPointer.h>
+#include <vtkTexture.h>
+
+#include <cstring>
+#include <map>
+#include <vector>
+
+vtkStandardNewMacro(vtkMapTileAtlas)
+
+//----------------------------------------------------------------------------
+namespace
+{
+  struct AtlasSlot
+  {
+    // Tile id plus one, zero marks a free slot
+    vtkTypeUInt64 Key;
+    // Image copied into the slot, only compared and never dereferenced.
+    // Its modification time tells a new image at the same address apart.
+    vtkImageData *Image;
+    unsigned long ImageTime;
+    int LastFrame;
+  };
+
+  struct AtlasPage
+  {
+    vtkSmartPointer<vtkImageData> Image;
+    vtkSmartPointer<vtkPolyData> Mesh;
+    vtkSmartPointer<vtkActor> Actor;
+    bool ImageModified;
+    // Per quad, corners followed by texture coordinates as
+    // (lower left, upper right)
+    std::vector<double> Quads;
+    std::vector<double> DrawnQuads;
+  };
+
+  void buildMesh(AtlasPage& page, bool textured)
+  {
+    vtkIdType count = static_cast<vtkIdType>(page.DrawnQuads.size() / 8);
+    vtkNew<vtkPoints> points;
+    points->SetNumberOfPoints(4 * count);
+    vtkNew<vtkCellArray> polys;
+    polys->Allocate(polys->EstimateSize(count, 4));
+    vtkNew<vtkFloatArray> tcoords;
+    tcoords->SetNumberOfComponents(2);
+    tcoords->SetNumberOfTuples(4 * count);
+
+    for (vtkIdType i = 0; i < count; ++i)
+      {
+      const double *c = &page.DrawnQuads[8 * i];
+      const double *t = c + 4;
+      vtkIdType ids[4] = { 4 * i, 4 * i + 1, 4 * i + 2, 4 * i + 3 };
+      points->SetPoint(ids[0], c[0], c[1], 0.0);
+      points->SetPoint(ids[1], c[2], c[1], 0.0);
+      points->SetPoint(ids[2], c[2], c[3], 0.0);
+      points->SetPoint(ids[3], c[0], c[3], 0.0);
+      tcoords->SetTuple2(ids[0], t[0], t[1]);
+      tcoords->SetTuple2(ids[1], t[2], t[1]);
+      tcoords->SetTuple2(ids[2], t[2], t[3]);
+      tcoords->SetTuple2(ids[3], t[0], t[3]);
+      polys->InsertNextCell(4, ids);
+      }
+
+    page.Mesh->SetPoints(points.GetPointer());
+    page.Mesh->SetPolys(polys.GetPointer());
+    page.Mesh->GetPointData()->SetTCoords(
+      textured ? tcoords.GetPointer() : NULL);
+  }
+}
+
+//----------------------------------------------------------------------------
+class vtkMapTileAtlas::vtkInternal
+{
+public:
+  // Page 0 holds the placeholder quads and has no image
+  void AddPage(int pageSize, int slotsPerPage);
+
+  std::vector<AtlasPage> Pages;
+  std::vector<AtlasSlot> Slots;
+  std::map<vtkTypeUInt64, int> TileSlots;
+  int Frame;
+  bool WarnedUnsupported;
+};
+
+//----------------------------------------------------------------------------
+void vtkMapTileAtlas::vtkInternal::AddPage(int pageSize, int slotsPerPage)
+{
+  AtlasPage page;
+  page.Mesh = vtkSmartPointer<vtkPolyData>::New();
+  page.ImageModified = false;
+
+  vtkNew<vtkPolyDataMapper> mapper;
+  mapper->SetInputData(page.Mesh);
+  page.Actor = vtkSmartPointer<vtkActor>::New();
+  page.Actor->SetMapper(mapper.GetPointer());
+  page.Actor->PickableOff();
+  page.Actor->VisibilityOff();
+
+  if (this->Pages.empty())
+    {
+    page.Actor->GetProperty()->SetColor(0.85, 0.85, 0.85);
+    }
+  else
+    {
+    page.Image = vtkSmartPointer<vtkImageData>::New();
+    page.Image->SetDimensions(pageSize, pageSize, 1);
+    page.Image->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
+    memset(page.Image->GetScalarPointer(), 0,
+           static_cast<size_t>(pageSize) * pageSize * 4);
+
+    vtkNew<vtkTexture> texture;
+    texture->SetInputData(page.Image);
+    texture->SetQualityTo32Bit();
+    texture->SetInterpolate(1);
+    texture->RepeatOff();
+    texture->EdgeClampOn();
+    page.Actor->SetTexture(texture.GetPointer());
+    page.Actor->GetProperty()->SetColor(1.0, 1.0, 1.0);
+
+    AtlasSlot slot;
+    slot.Key = 0;
+    slot.Image = NULL;
+    slot.ImageTime = 0;
+    slot.LastFrame = -1;
+    this->Slots.insert(this->Slots.end(), slotsPerPage, slot);
+    }
+  this->Pages.push_back(page);
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileAtlas::vtkMapTileAtlas()
+{
+  this->TileSize = 256;
+  this->PageSize = 2048;
+  this->MaximumNumberOfPages = 4;
+  this->Impl = new vtkInternal;
+  this->Impl->Frame = 0;
+  this->Impl->WarnedUnsupported = false;
+  this->Impl->AddPage(this->PageSize, 0);
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileAtlas::~vtkMapTileAtlas()
+{
+  delete this->Impl;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileAtlas::PrintSelf(ostream &os, vtkIndent indent)
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "TileSize: " << this->TileSize << "\n"
+     << indent << "PageSize: " << this->PageSize << "\n"
+     << indent << "MaximumNumberOfPages: " << this->MaximumNumberOfPages << "\n"
+     << indent << "NumberOfPages: " << (this->Impl->Pages.size() - 1) << "\n"
+     << indent << "NumberOfTiles: " << this->Impl->TileSlots.size()
+     << std::endl;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileAtlas::BeginFrame()
+{
+  ++this->Impl->Frame;
+  for (size_t i = 0; i < this->Impl->Pages.size(); ++i)
+    {
+    this->Impl->Pages[i].Quads.clear();
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileAtlas::AddQuad(vtkTypeUInt64 id, vtkImageData *image,
+                              const double imageCorners[4],
+                              const double corners[4])
+{
+  int slot = this->FindSlot(id, image);
+  if (slot < 0)
+    {
+    return false;
+    }
+
+  int slotsPerSide = this->PageSize / this->TileSize;
+  int slotsPerPage = slotsPerSide * slotsPerSide;
+  int local = slot % slotsPerPage;
+  double origin[2];
+  origin[0] = (local % slotsPerSide) * this->TileSize;
+  origin[1] = (local / slotsPerSide) * this->TileSize;
+
+  AtlasPage& page = this->Impl->Pages[1 + slot / slotsPerPage];
+  page.Quads.insert(page.Quads.end(), corners, corners + 4);
+
+  // Sample between the centers of the border texels of the slot,
+  // so that filtering never reads the neighbouring slots
+  for (int i = 0; i < 4; ++i)
+    {
+    int axis = i % 2;
+    double fraction = (corners[i] - imageCorners[axis]) /
+      (imageCorners[axis + 2] - imageCorners[axis]);
+    page.Quads.push_back(
+      (origin[axis] + 0.5 + fraction * (this->TileSize - 1)) / this->PageSize);
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileAtlas::AddPlaceholder(const double corners[4])
+{
+  AtlasPage& page = this->Impl->Pages[0];
+  page.Quads.insert(page.Quads.end(), corners, corners + 4);
+  page.Quads.insert(page.Quads.end(), 4, 0.0);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileAtlas::EndFrame()
+{
+  for (size_t i = 0; i < this->Impl->Pages.size(); ++i)
+    {
+    AtlasPage& page = this->Impl->Pages[i];
+    if (page.ImageModified)
+      {
+      // vtkTexture uploads the whole page again, once per frame
+      // however many tiles arrived
+      page.Image->Modified();
+      page.ImageModified = false;
+      }
+    if (page.Quads != page.DrawnQuads)
+      {
+      page.DrawnQuads.swap(page.Quads);
+      buildMesh(page, i > 0);
+      }
+    page.Actor->SetVisibility(!page.DrawnQuads.empty());
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileAtlas::HasTile(vtkTypeUInt64 id)
+{
+  return this->Impl->TileSlots.count(id) > 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileAtlas::RemoveAllTiles()
+{
+  this->Impl->Pages.resize(1);
+  this->Impl->Pages[0].Quads.clear();
+  this->Impl->Pages[0].DrawnQuads.clear();
+  buildMesh(this->Impl->Pages[0], false);
+  this->Impl->Pages[0].Actor->VisibilityOff();
+  this->Impl->Slots.clear();
+  this->Impl->TileSlots.clear();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkMapTileAtlas::GetNumberOfActors()
+{
+  return static_cast<int>(this->Impl->Pages.size());
+}
+
+//----------------------------------------------------------------------------
+vtkActor *vtkMapTileAtlas::GetActor(int index)
+{
+  if (index < 0 || index >= this->GetNumberOfActors())
+    {
+    return NULL;
+    }
+  return this->Impl->Pages[index].Actor;
+}
+
+//----------------------------------------------------------------------------
+int vtkMapTileAtlas::FindSlot(vtkTypeUInt64 id, vtkImageData *image)
+{
+  std::vector<AtlasSlot>& slots = this->Impl->Slots;
+  std::map<vtkTypeUInt64, int>::iterator iter =
+    this->Impl->TileSlots.find(id);
+  if (iter != this->Impl->TileSlots.end())
+    {
+    AtlasSlot& slot = slots[iter->second];
+    if (image &&
+        (image != slot.Image || image->GetMTime() != slot.ImageTime))
+      {
+      // The tile image changed, after a download or a revalidation
+      if (!this->CopyImage(iter->second, image))
+        {
+        slot.Key = 0;
+        this->Impl->TileSlots.erase(iter);
+        return -1;
+        }
+      slot.Image = image;
+      slot.ImageTime = image->GetMTime();
+      }
+    slot.LastFrame = this->Impl->Frame;
+    return iter->second;
+    }
+
+  if (!image)
+    {
+    return -1;
+    }
+
+  // Take a free slot, or else add a page, or else reuse the slot least
+  // recently drawn. Slots drawn in this frame are never reused.
+  int best = -1;
+  for (size_t i = 0; i < slots.size(); ++i)
+    {
+    if (slots[i].Key == 0)
+      {
+      best = static_cast<int>(i);
+      break;
+      }
+    if (slots[i].LastFrame < this->Impl->Frame &&
+        (best < 0 || slots[i].LastFrame < slots[best].LastFrame))
+      {
+      best = static_cast<int>(i);
+      }
+    }
+  if ((best < 0 || slots[best].Key != 0) &&
+      static_cast<int>(this->Impl->Pages.size()) <= this->MaximumNumberOfPages)
+    {
+    int slotsPerSide = this->PageSize / this->TileSize;
+    best = static_cast<int>(slots.size());
+    this->Impl->AddPage(this->PageSize, slotsPerSide * slotsPerSide);
+    this->Modified();
+    }
+  if (best < 0)
+    {
+    return -1;
+    }
+
+  AtlasSlot& slot = slots[best];
+  if (slot.Key != 0)
+    {
+    this->Impl->TileSlots.erase(slot.Key - 1);
+    slot.Key = 0;
+    }
+  if (!this->CopyImage(best, image))
+    {
+    return -1;
+    }
+  slot.Key = id + 1;
+  slot.Image = image;
+  slot.ImageTime = image->GetMTime();
+  slot.LastFrame = this->Impl->Frame;
+  this->Impl->TileSlots[id] = best;
+  return best;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileAtlas::CopyImage(int slot, vtkImageData *image)
+{
+  int dims[3];
+  image->GetDimensions(dims);
+  int components = image->GetNumberOfScalarComponents();
+  if (image->GetScalarType() != VTK_UNSIGNED_CHAR ||
+      dims[0] != this->TileSize || dims[1] != this->TileSize ||
+      components < 1 || components > 4)
+    {
+    if (!this->Impl->WarnedUnsupported)
+      {
+      vtkWarningMacro("Cannot pack tile images other than 8 bit images of "
+                      << this->TileSize << " pixels square");
+      this->Impl->WarnedUnsupported = true;
+      }
+    return false;
+    }
+
+  int slotsPerSide = this->PageSize / this->TileSize;
+  int slotsPerPage = slotsPerSide * slotsPerSide;
+  int local = slot % slotsPerPage;
+  AtlasPage& page = this->Impl->Pages[1 + slot / slotsPerPage];
+
+  // Expand gray, gray alpha and RGB images to the RGBA of the page
+  const unsigned char *source =
+    static_cast<const unsigned char*>(image->GetScalarPointer());
+  unsigned char *target =
+    static_cast<unsigned char*>(page.Image->GetScalarPointer()) +
+    (static_cast<size_t>(local / slotsPerSide) * this->TileSize *
+     this->PageSize + (local % slotsPerSide) * this->TileSize) * 4;
+  for (int y = 0; y < this->TileSize; ++y)
+    {
+    unsigned char *row = target + static_cast<size_t>(y) * this->PageSize * 4;
+    for (int x = 0; x < this->TileSize; ++x, source += components)
+      {
+      unsigned char *pixel = row + 4 * x;
+      switch (components)
+        {
+        case 1:
+        case 2:
+          pixel[0] = pixel[1] = pixel[2] = source[0];
+          pixel[3] = components == 2 ? source[1] : 255;
+          break;
+        default:
+          pixel[0] = source[0];
+          pixel[1] = source[1];
+          pixel[2] = source[2];
+          pixel[3] = components == 4 ? source[3] : 255;
+          break;
+        }
+      }
+    }
+  page.ImageModified = true;
+  return true;
+}
@@ -0,0 +1,133 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapTileAtlas - draws map tiles as quads of a few batched meshes
+// .SECTION Description
+// vtkMapTileAtlas packs tile images into the slots of a few large
+// texture pages, and draws the tiles of a frame as textured quads, with
+// one mesh and one actor per page plus one untextured actor for plain
+// placeholder tiles. A frame of tiles costs a handful of draw calls
+// instead of a pipeline and a draw call per tile.
+//
+// Tiles are identified by their vtkMapTile::ComputeTileId() id. Their
+// image is copied into a slot the first time it is drawn, and again only
+// when it changes. Slots of tiles not drawn in the current frame are
+// reused, least recently drawn first, once the pages are full.
+//
+// Each frame is bracketed by BeginFrame() and EndFrame(), which rebuilds
+// the meshes whose quads changed. Only 8 bit images of TileSize pixels
+// square can be packed.
+//
+// vtkTexture has no way to update part of its image, so a page that
+// received new tiles is uploaded whole, PageSize squared times 4 bytes,
+// at the end of the frame. Frames adding many tiles cost that much
+// texture bandwidth per page touched.
+// .SECTION See Also
+// vtkOsmLayer vtkMapTile
+
+#ifndef __vtkMapTileAtlas_h
+#define __vtkMapTileAtlas_h
+
+// VTK Includes
+#include <vtkObject.h>
+#include <vtkType.h>
+#include "vtkmap_export.h"
+
+class vtkActor;
+class vtkImageData;
+
+class VTKMAP_EXPORT vtkMapTileAtlas : public vtkObject
+{
+public:
+  static vtkMapTileAtlas *New();
+  virtual void PrintSelf(ostream &os, vtkIndent indent);
+  vtkTypeMacro(vtkMapTileAtlas, vtkObject)
+
+  // Description:
+  // Get/Set the size in pixels of the tile images, default is 256.
+  // Must be set before the first tile is added.
+  vtkSetClampMacro(TileSize, int, 16, 1024)
+  vtkGetMacro(TileSize, int)
+
+  // Description:
+  // Get/Set the size in pixels of the texture pages, default is 2048.
+  // Must be set before the first tile is added.
+  vtkSetClampMacro(PageSize, int, 256, 8192)
+  vtkGetMacro(PageSize, int)
+
+  // Description:
+  // Get/Set the maximum number of texture pages, default is 4
+  vtkSetClampMacro(MaximumNumberOfPages, int, 1, 64)
+  vtkGetMacro(MaximumNumberOfPages, int)
+
+  // Description:
+  // Start a new frame, dropping the quads of the previous one
+  void BeginFrame();
+
+  // Description:
+  // Add a quad covering corners (lower left, upper right), drawn with
+  // the part of the image of tile id it covers. imageCorners is the
+  // extent of the whole image. If image is NULL, the image already in
+  // the atlas is used. Returns false if the image is not in the atlas
+  // and cannot be added, in which case no quad is added.
+  bool AddQuad(vtkTypeUInt64 id, vtkImageData *image,
+               const double imageCorners[4], const double corners[4]);
+
+  // Description:
+  // Add a plain placeholder quad covering corners
+  void AddPlaceholder(const double corners[4]);
+
+  // Description:
+  // Rebuild the meshes and textures changed since BeginFrame()
+  void EndFrame();
+
+  // Description:
+  // Returns true if the image of tile id is in the atlas
+  bool HasTile(vtkTypeUInt64 id);
+
+  // Description:
+  // Drop all tile images and quads
+  void RemoveAllTiles();
+
+  // Description:
+  // Returns the actors drawing the frame, the placeholder actor first
+  int GetNumberOfActors();
+  vtkActor *GetActor(int index);
+
+protected:
+  vtkMapTileAtlas();
+  ~vtkMapTileAtlas();
+
+  // Description:
+  // Returns the slot holding the image of tile id, copying image into a
+  // slot if needed, or -1 if no slot is available
+  int FindSlot(vtkTypeUInt64 id, vtkImageData *image);
+
+  // Description:
+  // Copy an image into a slot, converting it to RGBA.
+  // Returns false if the image cannot be packed.
+  bool CopyImage(int slot, vtkImageData *image);
+
+  int TileSize;
+  int PageSize;
+  int MaximumNumberOfPages;
+
+  class vtkInternal;
+  vtkInternal *Impl;
+
+private:
+  vtkMapTileAtlas(const vtkMapTileAtlas&);  // Not implemented
+  void operator=(const vtkMapTileAtlas&); // Not implemented
+};
+
+#endif // __vtkMapTileAtlas_h
@@ -0,0 +1,720 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileCache.h"
+
+// VTK Includes
+#include <vtkConditionVariable.h>
+#include <vtkMutexLock.h>
+#include <vtkObjectFactory.h>
+#include <vtksys/Directory.hxx>
+#include <vtksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <cstdio>  // for rename()
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+vtkStandardNewMacro(vtkMapTileCache)
+
+//----------------------------------------------------------------------------
+namespace
+{
+  const char *indexFileName = "tiles.index";
+  const char *indexHeader = "vtkMapTileCache 2";
+
+  // Previous index format, without checksums
+  const char *indexHeaderVersion1 = "vtkMapTileCache 1";
+
+  // Budget of the directory in megabytes, see SaveMaximumSize()
+  const char *budgetFileName = "tiles.budget";
+  const char *budgetHeader = "vtkMapTileCacheBudget 1";
+
+  // Seconds between saves of the index while tiles are added or
+  // removed. A crash loses at most the changes of this interval, and
+  // the files they added are not evicted until they are used again.
+  // Changes to the order of use alone are saved on shutdown.
+  const double saveInterval = 30.0;
+
+  // Age in seconds after which a temporary file is known to be left
+  // over. Writes in progress keep theirs for much less than that.
+  const double temporaryFileAge = 600.0;
+
+  // Deepest zoom level served by the tile server
+  const int maximumTileZoom = 19;
+
+  // Parse a tile index or zoom level written without leading zeros,
+  // which must be less than limit
+  bool parseTileIndex(const std::string& digits, int limit, int& value)
+  {
+    if (digits.empty() || digits.size() > 7 ||
+        (digits.size() > 1 && digits[0] == '0'))
+      {
+      return false;
+      }
+    value = atoi(digits.c_str());
+    return value < limit;
+  }
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileCache::vtkMapTileCache()
+{
+  this->MaximumSize = 1024;
+  this->LowWaterMark = 0.9;
+  this->Threader = vtkMultiThreader::New();
+  this->ThreadId = -1;
+  this->Lock = vtkMutexLock::New();
+  this->Condition = vtkConditionVariable::New();
+  this->Size = 0;
+  this->Changes = 0;
+  this->OrderChanged = false;
+  this->NextSaveTime = 0.0;
+  this->Stopping = false;
+  for (int i = 0; i < NumberOfTileLocks; ++i)
+    {
+    this->TileLocks[i] = vtkMutexLock::New();
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileCache::~vtkMapTileCache()
+{
+  this->Stop();
+  this->Condition->Delete();
+  this->Lock->Delete();
+  for (int i = 0; i < NumberOfTileLocks; ++i)
+    {
+    this->TileLocks[i]->Delete();
+    }
+  this->Threader->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::PrintSelf(ostream &os, vtkIndent indent)
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Directory: " << this->Directory << "\n"
+     << indent << "MaximumSize: " << this->MaximumSize << " MB\n"
+     << indent << "LowWaterMark: " << this->LowWaterMark << "\n"
+     << indent << "Size: " << this->GetSize() << " bytes\n"
+     << indent << "NumberOfTiles: " << this->GetNumberOfTiles()
+     << std::endl;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::SetDirectory(const std::string& directory)
+{
+  if (directory == this->Directory && this->ThreadId >= 0)
+    {
+    return;
+    }
+
+  this->Stop();
+
+  // A few bytes, read before the thread starts so that it never
+  // trims the cache to another budget
+  std::ifstream budget((directory + "/" + budgetFileName).c_str());
+  std::string header;
+  int maximumSize;
+  if (std::getline(budget, header) && header == budgetHeader &&
+      budget >> maximumSize)
+    {
+    this->SetMaximumSize(maximumSize);
+    }
+
+  this->Lock->Lock();
+  this->Directory = directory;
+  this->Order.clear();
+  this->Tiles.clear();
+  this->Size = 0;
+  this->Changes = 0;
+  this->OrderChanged = false;
+  this->NextSaveTime = vtksys::SystemTools::GetTime() + saveInterval;
+  this->Lock->Unlock();
+
+  this->ThreadId = this->Threader->SpawnThread(
+    vtkMapTileCache::WorkerMain, this);
+  if (this->ThreadId < 0)
+    {
+    vtkErrorMacro("Cannot spawn tile cache thread");
+    }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileCache::SaveMaximumSize()
+{
+  if (this->Directory.empty())
+    {
+    vtkErrorMacro("No cache directory to save the budget in");
+    return false;
+    }
+
+  std::string fileName = this->Directory + "/" + budgetFileName;
+  std::ofstream out(fileName.c_str());
+  out << budgetHeader << "\n" << this->MaximumSize << "\n";
+  out.close();
+  if (out.fail())
+    {
+    vtkErrorMacro("Cannot write tile cache budget " << fileName);
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::AddTile(const std::string& key, vtkTypeInt64 size,
+                              vtkTypeUInt32 checksum)
+{
+  TileEntry entry;
+  entry.Key = key;
+  entry.Size = size;
+  entry.Checksum = checksum;
+
+  this->Lock->Lock();
+  this->InsertTile(entry);
+  if (this->Size > this->MaximumSize * vtkTypeInt64(1048576) ||
+      vtksys::SystemTools::GetTime() >= this->NextSaveTime)
+    {
+    this->Condition->Signal();
+    }
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::TouchTile(const std::string& key)
+{
+  this->Lock->Lock();
+  std::map<std::string, TileList::iterator>::iterator iter =
+    this->Tiles.find(key);
+  if (iter != this->Tiles.end())
+    {
+    // Tiles in view are touched on every render, the index is not
+    // saved for that
+    if (iter->second != this->Order.begin())
+      {
+      this->Order.splice(this->Order.begin(), this->Order, iter->second);
+      this->OrderChanged = true;
+      }
+    // Also serves as the timer of the saves of added or removed tiles
+    if (this->Changes > 0 &&
+        vtksys::SystemTools::GetTime() >= this->NextSaveTime)
+      {
+      this->Condition->Signal();
+      }
+    this->Lock->Unlock();
+    return;
+    }
+  this->Lock->Unlock();
+
+  // Not indexed yet, either the index is still loading or the tile
+  // was cached while the index was not saved
+  std::string fileName = this->GetTileFileName(key);
+  if (vtksys::SystemTools::FileExists(fileName.c_str()))
+    {
+    this->AddTile(key, this->GetTileFilesSize(key));
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::SetTileSize(const std::string& key, vtkTypeInt64 size)
+{
+  this->Lock->Lock();
+  std::map<std::string, TileList::iterator>::iterator iter =
+    this->Tiles.find(key);
+  if (iter != this->Tiles.end() && iter->second->Size != size)
+    {
+    this->Size += size - iter->second->Size;
+    iter->second->Size = size;
+    ++this->Changes;
+    if (this->Size > this->MaximumSize * vtkTypeInt64(1048576))
+      {
+      this->Condition->Signal();
+      }
+    }
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::RemoveTile(const std::string& key)
+{
+  this->Lock->Lock();
+  std::map<std::string, TileList::iterator>::iterator iter =
+    this->Tiles.find(key);
+  if (iter != this->Tiles.end())
+    {
+    this->Size -= iter->second->Size;
+    this->Order.erase(iter->second);
+    this->Tiles.erase(iter);
+    ++this->Changes;
+    }
+  this->Lock->Unlock();
+
+  this->RemoveTileFiles(key);
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileCache::GetTileChecksum(const std::string& key,
+                                      vtkTypeUInt32& checksum)
+{
+  this->Lock->Lock();
+  std::map<std::string, TileList::iterator>::iterator iter =
+    this->Tiles.find(key);
+  bool found = iter != this->Tiles.end() && iter->second->Checksum != 0;
+  if (found)
+    {
+    checksum = iter->second->Checksum;
+    }
+  this->Lock->Unlock();
+  return found;
+}
+
+//----------------------------------------------------------------------------
+vtkMutexLock *vtkMapTileCache::GetTileLock(const std::string& key)
+{
+  // FNV-1a, neighbouring tiles get different locks
+  vtkTypeUInt32 hash = 2166136261u;
+  for (size_t i = 0; i < key.size(); ++i)
+    {
+    hash = (hash ^ static_cast<unsigned char>(key[i])) * 16777619u;
+    }
+  return this->TileLocks[hash % NumberOfTileLocks];
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::LockTile(const std::string& key)
+{
+  this->GetTileLock(key)->Lock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::UnlockTile(const std::string& key)
+{
+  this->GetTileLock(key)->Unlock();
+}
+
+//----------------------------------------------------------------------------
+std::string vtkMapTileCache::GetTileFileName(const std::string& key)
+{
+  return this->Directory + "/" + key + ".png";
+}
+
+//----------------------------------------------------------------------------
+std::string vtkMapTileCache::GetSidecarFileName(const std::string& key)
+{
+  return this->Directory + "/" + key + ".meta";
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::RemoveTileFiles(const std::string& key)
+{
+  vtksys::SystemTools::RemoveFile(this->GetTileFileName(key).c_str());
+  vtksys::SystemTools::RemoveFile(this->GetSidecarFileName(key).c_str());
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkMapTileCache::GetTileFilesSize(const std::string& key)
+{
+  std::string fileName = this->GetTileFileName(key);
+  vtkTypeInt64 size = static_cast<vtkTypeInt64>(
+    vtksys::SystemTools::FileLength(fileName.c_str()));
+  std::string sidecar = this->GetSidecarFileName(key);
+  if (vtksys::SystemTools::FileExists(sidecar.c_str()))
+    {
+    size += static_cast<vtkTypeInt64>(
+      vtksys::SystemTools::FileLength(sidecar.c_str()));
+    }
+  return size;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkMapTileCache::GetSize()
+{
+  this->Lock->Lock();
+  vtkTypeInt64 size = this->Size;
+  this->Lock->Unlock();
+  return size;
+}
+
+//----------------------------------------------------------------------------
+int vtkMapTileCache::GetNumberOfTiles()
+{
+  this->Lock->Lock();
+  int count = static_cast<int>(this->Tiles.size());
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::Stop()
+{
+  if (this->ThreadId < 0)
+    {
+    return;
+    }
+
+  this->Lock->Lock();
+  this->Stopping = true;
+  this->Condition->Broadcast();
+  this->Lock->Unlock();
+
+  // TerminateThread() joins the thread, which saves the index on exit
+  this->Threader->TerminateThread(this->ThreadId);
+  this->ThreadId = -1;
+  this->Stopping = false;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::InsertTile(const TileEntry& entry)
+{
+  std::map<std::string, TileList::iterator>::iterator iter =
+    this->Tiles.find(entry.Key);
+  if (iter != this->Tiles.end())
+    {
+    this->Size -= iter->second->Size;
+    this->Order.erase(iter->second);
+    }
+  this->Order.push_front(entry);
+  this->Tiles[entry.Key] = this->Order.begin();
+  this->Size += entry.Size;
+  ++this->Changes;
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkMapTileCache::WorkerMain(void *arg)
+{
+  vtkMultiThreader::ThreadInfo *info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkMapTileCache *self = static_cast<vtkMapTileCache*>(info->UserData);
+  self->RunWorker();
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::RunWorker()
+{
+  // Directory does not change while the thread runs
+  this->RemoveTemporaryFiles(this->Directory, 0);
+  std::vector<TileEntry> entries;
+  std::vector<TileEntry> migrated;
+  this->MigrateFlatCache(migrated);
+  this->LoadIndex(entries);
+  // Migrated tiles are least recently used. Those the index or the
+  // scan already found are skipped below.
+  entries.insert(entries.end(), migrated.begin(), migrated.end());
+
+  this->Lock->Lock();
+  // Tiles reported while loading were used more recently than any
+  // tile of the index, so they stay in front
+  for (size_t i = 0; i < entries.size(); ++i)
+    {
+    if (this->Tiles.find(entries[i].Key) == this->Tiles.end())
+      {
+      this->Order.push_back(entries[i]);
+      this->Tiles[entries[i].Key] = --this->Order.end();
+      this->Size += entries[i].Size;
+      }
+    }
+  if (!migrated.empty())
+    {
+    ++this->Changes;
+    }
+
+  while (!this->Stopping)
+    {
+    vtkTypeInt64 budget = this->MaximumSize * vtkTypeInt64(1048576);
+    if (this->Size > budget)
+      {
+      vtkTypeInt64 target =
+        static_cast<vtkTypeInt64>(this->LowWaterMark * budget);
+      std::vector<std::string> victims;
+      while (this->Size > target && !this->Order.empty())
+        {
+        const TileEntry& last = this->Order.back();
+        this->Size -= last.Size;
+        this->Tiles.erase(last.Key);
+        victims.push_back(last.Key);
+        this->Order.pop_back();
+        }
+      this->Changes += static_cast<int>(victims.size());
+
+      // The files are removed without holding the lock across all of
+      // them. A victim written again meanwhile keeps its new files, the
+      // tile lock keeps it from being written during the removal.
+      this->Lock->Unlock();
+      for (size_t i = 0; i < victims.size(); ++i)
+        {
+        this->LockTile(victims[i]);
+        this->Lock->Lock();
+        bool evicted = this->Tiles.find(victims[i]) == this->Tiles.end();
+        this->Lock->Unlock();
+        if (evicted)
+          {
+          this->RemoveTileFiles(victims[i]);
+          }
+        this->UnlockTile(victims[i]);
+        }
+      this->Lock->Lock();
+      continue;
+      }
+
+    if (this->Changes > 0 &&
+        vtksys::SystemTools::GetTime() >= this->NextSaveTime)
+      {
+      this->SaveIndex();
+      continue;
+      }
+
+    this->Condition->Wait(this->Lock);
+    }
+
+  if (this->Changes > 0 || this->OrderChanged)
+    {
+    this->SaveIndex();
+    }
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::MigrateFlatCache(std::vector<TileEntry>& entries)
+{
+  vtksys::Directory directory;
+  if (!directory.Load(this->Directory.c_str()))
+    {
+    return;
+    }
+
+  int moved = 0;
+  int removed = 0;
+  for (unsigned long i = 0; i < directory.GetNumberOfFiles(); ++i)
+    {
+    std::string name = directory.GetFile(i);
+    std::string digits =
+      vtksys::SystemTools::GetFilenameWithoutExtension(name);
+    if (vtksys::SystemTools::GetFilenameLastExtension(name) != ".png" ||
+        digits.empty() ||
+        digits.find_first_not_of("0123456789") != std::string::npos)
+      {
+      continue;
+      }
+
+    // Find every split of the name into a zoom level and tile indices
+    // valid at that level. Names with more than one are ambiguous.
+    int matches = 0;
+    int zoom = 0, x = 0, y = 0;
+    for (size_t zoomLength = 1; zoomLength <= 2; ++zoomLength)
+      {
+      int z;
+      if (!parseTileIndex(digits.substr(0, zoomLength),
+                          maximumTileZoom + 1, z))
+        {
+        continue;
+        }
+      for (size_t xLength = 1;
+           zoomLength + xLength < digits.size(); ++xLength)
+        {
+        int tx, ty;
+        if (parseTileIndex(digits.substr(zoomLength, xLength), 1 << z, tx) &&
+            parseTileIndex(digits.substr(zoomLength + xLength), 1 << z, ty))
+          {
+          ++matches;
+          zoom = z;
+          x = tx;
+          y = ty;
+          }
+        }
+      }
+
+    std::string oldPath = this->Directory + "/" + name;
+    if (matches == 1)
+      {
+      // Flat names count rows from the north, like the keys
+      std::ostringstream key;
+      key << zoom << "/" << x << "/" << y;
+      TileEntry entry;
+      entry.Key = key.str();
+      entry.Checksum = 0;
+      std::string newPath = this->GetTileFileName(entry.Key);
+      vtksys::SystemTools::MakeDirectory(
+        vtksys::SystemTools::GetFilenamePath(newPath).c_str());
+      // Tiles are written while the migration runs, the newer image wins
+      this->LockTile(entry.Key);
+      bool renamed = !vtksys::SystemTools::FileExists(newPath.c_str()) &&
+        rename(oldPath.c_str(), newPath.c_str()) == 0;
+      this->UnlockTile(entry.Key);
+      if (renamed)
+        {
+        entry.Size = this->GetTileFilesSize(entry.Key);
+        entries.push_back(entry);
+        ++moved;
+        continue;
+        }
+      }
+
+    // Ambiguous or redundant, the tile is downloaded again when needed
+    vtksys::SystemTools::RemoveFile(oldPath.c_str());
+    ++removed;
+    }
+
+  if (moved > 0 || removed > 0)
+    {
+    vtkDebugMacro("Migrated " << moved << " tiles of tile cache "
+                  << this->Directory << ", removed " << removed);
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::LoadIndex(std::vector<TileEntry>& entries)
+{
+  std::ifstream in((this->Directory + "/" + indexFileName).c_str());
+  std::string header;
+  if (!in || !std::getline(in, header) ||
+      (header != indexHeader && header != indexHeaderVersion1))
+    {
+    // Done once for caches without an index, the index
+    // is saved right away so that this is not repeated
+    this->ScanDirectory(this->Directory, "", 0, entries);
+    this->Lock->Lock();
+    this->Changes = std::max(this->Changes, 1);
+    this->NextSaveTime = 0.0;
+    this->Lock->Unlock();
+    return;
+    }
+
+  // Checksums of tiles indexed by version 1 are unknown
+  bool hasChecksums = header == indexHeader;
+  TileEntry entry;
+  entry.Checksum = 0;
+  while ((in >> entry.Size) &&
+         (!hasChecksums || (in >> std::hex >> entry.Checksum >> std::dec)) &&
+         (in >> entry.Key))
+    {
+    entries.push_back(entry);
+    }
+  if (!hasChecksums)
+    {
+    this->Lock->Lock();
+    this->Changes = std::max(this->Changes, 1);
+    this->NextSaveTime = 0.0;
+    this->Lock->Unlock();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::ScanDirectory(
+  const std::string& path, const std::string& prefix, int depth,
+  std::vector<TileEntry>& entries)
+{
+  vtksys::Directory directory;
+  if (!directory.Load(path.c_str()))
+    {
+    return;
+    }
+
+  for (unsigned long i = 0; i < directory.GetNumberOfFiles(); ++i)
+    {
+    std::string name = directory.GetFile(i);
+    if (name == "." || name == "..")
+      {
+      continue;
+      }
+    std::string fileName = path + "/" + name;
+    if (vtksys::SystemTools::FileIsDirectory(fileName.c_str()))
+      {
+      // Tiles are at most zoom/x/y deep
+      if (depth < 2)
+        {
+        this->ScanDirectory(fileName, prefix + name + "/", depth + 1,
+                            entries);
+        }
+      }
+    else if (vtksys::SystemTools::GetFilenameLastExtension(name) == ".png")
+      {
+      TileEntry entry;
+      entry.Key =
+        prefix + vtksys::SystemTools::GetFilenameWithoutLastExtension(name);
+      entry.Size = this->GetTileFilesSize(entry.Key);
+      entry.Checksum = 0;
+      entries.push_back(entry);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::RemoveTemporaryFiles(const std::string& path,
+                                           int depth)
+{
+  vtksys::Directory directory;
+  if (!directory.Load(path.c_str()))
+    {
+    return;
+    }
+
+  // Tiles are written while the sweep runs, their temporary files
+  // are recent
+  double cutoff = vtksys::SystemTools::GetTime() - temporaryFileAge;
+  for (unsigned long i = 0; i < directory.GetNumberOfFiles(); ++i)
+    {
+    std::string name = directory.GetFile(i);
+    std::string extension =
+      vtksys::SystemTools::GetFilenameLastExtension(name);
+    std::string fileName = path + "/" + name;
+    if (extension == ".tmp")
+      {
+      if (vtksys::SystemTools::ModifiedTime(fileName.c_str()) < cutoff)
+        {
+        vtksys::SystemTools::RemoveFile(fileName.c_str());
+        }
+      }
+    // Only the zoom and x directories are named without extension,
+    // other files are not checked for being directories
+    else if (extension.empty() && depth < 2 && name != "." &&
+             name != ".." &&
+             vtksys::SystemTools::FileIsDirectory(fileName.c_str()))
+      {
+      this->RemoveTemporaryFiles(fileName, depth + 1);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileCache::SaveIndex()
+{
+  std::vector<TileEntry> entries(this->Order.begin(), this->Order.end());
+  this->Changes = 0;
+  this->OrderChanged = false;
+  this->NextSaveTime = vtksys::SystemTools::GetTime() + saveInterval;
+  this->Lock->Unlock();
+
+  // Replace the index in one step, so that it is never left half written
+  std::string fileName = this->Directory + "/" + indexFileName;
+  std::string tempName = fileName + ".tmp";
+  std::ofstream out(tempName.c_str());
+  out << indexHeader << "\n";
+  for (size_t i = 0; i < entries.size(); ++i)
+    {
+    out << entries[i].Size << " " << std::hex << entries[i].Checksum
+        << std::dec << " " << entries[i].Key << "\n";
+    }
+  out.close();
+  if (out.fail() || rename(tempName.c_str(), fileName.c_str()) != 0)
+    {
+    vtkWarningMacro("Cannot write tile cache index " << fileName);
+    vtksys::SystemTools::RemoveFile(tempName.c_str());
+    }
+
+  this->Lock->Lock();
+}
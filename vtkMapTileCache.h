@@ -0,0 +1,210 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapTileCache - size bounded on-disk cache of tile images
+// .SECTION Description
+// vtkMapTileCache keeps the tile images in a cache directory within a
+// byte budget. Tiles are identified by their key, a path relative to
+// the cache directory without the .png extension. A tile may have a
+// <key>.meta sidecar file, which counts against the budget and is
+// removed with the tile. Callers report new
+// tiles with AddTile() and tiles in use with TouchTile(). Once the
+// budget is exceeded, a background thread removes least recently used
+// tiles until the cache is back under LowWaterMark of the budget.
+//
+// The tiles, their checksums and their order of use are kept in an
+// index file in the cache directory, so the cache does not have to
+// stat every file at startup. The index is loaded in the background,
+// and rebuilt by scanning the directory if it is missing. Tiles
+// cached by earlier versions in one flat directory are moved to the
+// <zoom>/<x>/<y> layout in the background too.
+
+#ifndef __vtkMapTileCache_h
+#define __vtkMapTileCache_h
+
+// VTK Includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+#include <vtkType.h>
+#include "vtkmap_export.h"
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+class vtkConditionVariable;
+class vtkMutexLock;
+
+class VTKMAP_EXPORT vtkMapTileCache : public vtkObject
+{
+public:
+  static vtkMapTileCache *New();
+  virtual void PrintSelf(ostream &os, vtkIndent indent);
+  vtkTypeMacro(vtkMapTileCache, vtkObject)
+
+  // Description:
+  // Set the cache directory and start managing it. The index of a
+  // previous directory is saved first. A budget saved in the directory
+  // with SaveMaximumSize() replaces MaximumSize.
+  void SetDirectory(const std::string& directory);
+  std::string GetDirectory() { return this->Directory; }
+
+  // Description:
+  // Get/Set the budget of the cache in megabytes, default is 1024
+  vtkSetClampMacro(MaximumSize, int, 1, 1048576)
+  vtkGetMacro(MaximumSize, int)
+
+  // Description:
+  // Save MaximumSize as the budget of the cache directory, which
+  // caches opening the directory later use instead of their own, e.g.
+  // so that an application does not trim a cache seeded for it.
+  // Returns false if it cannot be saved.
+  bool SaveMaximumSize();
+
+  // Description:
+  // Get/Set the fraction of the budget the cache is trimmed down to
+  // when it overflows, default is 0.9
+  vtkSetClampMacro(LowWaterMark, double, 0.1, 1.0)
+  vtkGetMacro(LowWaterMark, double)
+
+  // Description:
+  // Report a tile written to the cache, of the given size in bytes.
+  // A checksum of 0 means unknown.
+  void AddTile(const std::string& key, vtkTypeInt64 size,
+               vtkTypeUInt32 checksum = 0);
+
+  // Description:
+  // Report the new size in bytes of the files of an indexed tile,
+  // e.g. after its sidecar file was written
+  void SetTileSize(const std::string& key, vtkTypeInt64 size);
+
+  // Description:
+  // Remove a tile and its file from the cache
+  void RemoveTile(const std::string& key);
+
+  // Description:
+  // Get the checksum recorded for a tile, returns false if
+  // there is none
+  bool GetTileChecksum(const std::string& key, vtkTypeUInt32& checksum);
+
+  // Description:
+  // Mark a tile as used now. Tiles missing from the index are added.
+  // The new order of use is saved with the next change of the tiles,
+  // or on shutdown.
+  void TouchTile(const std::string& key);
+
+  // Description:
+  // Lock the files of a tile. Writers hold it from replacing the files
+  // of a tile until the tile is reported, and eviction holds it while
+  // it removes them. Tiles share a fixed set of locks by their key.
+  void LockTile(const std::string& key);
+  void UnlockTile(const std::string& key);
+
+  // Description:
+  // Returns the file of a tile, and its sidecar file, in the cache
+  // directory
+  std::string GetTileFileName(const std::string& key);
+  std::string GetSidecarFileName(const std::string& key);
+
+  // Description:
+  // Returns the total size in bytes, and the number of tiles, in the index
+  vtkTypeInt64 GetSize();
+  int GetNumberOfTiles();
+
+  // Description:
+  // Save the index and stop the background thread. Called on destruction.
+  void Stop();
+
+protected:
+  vtkMapTileCache();
+  ~vtkMapTileCache();
+
+  void RunWorker();
+  static VTK_THREAD_RETURN_TYPE WorkerMain(void *arg);
+
+  struct TileEntry
+  {
+    std::string Key;
+    vtkTypeInt64 Size;
+    vtkTypeUInt32 Checksum;
+  };
+
+  // Description:
+  // Remove the files of a tile, or return their total size
+  void RemoveTileFiles(const std::string& key);
+  vtkTypeInt64 GetTileFilesSize(const std::string& key);
+
+  // Description:
+  // Remove the temporary files left by writes that were cut short,
+  // e.g. by a crash, from the tile directories. Only files older than
+  // any write in progress are removed.
+  void RemoveTemporaryFiles(const std::string& path, int depth);
+
+  // Description:
+  // Move tile images cached by earlier versions, which kept all tiles
+  // in one directory as <zoom><x><y>.png, to the <zoom>/<x>/<y>.png
+  // layout, and add them to entries. Names that match more than one
+  // tile are removed, those tiles are downloaded again.
+  void MigrateFlatCache(std::vector<TileEntry>& entries);
+
+  // Description:
+  // Read the index file, or scan the directory if there is none,
+  // into entries ordered from most to least recently used
+  void LoadIndex(std::vector<TileEntry>& entries);
+  void ScanDirectory(const std::string& path, const std::string& prefix,
+                     int depth, std::vector<TileEntry>& entries);
+
+  // Description:
+  // Write the index. Must be called with Lock held, the lock is
+  // released while writing.
+  void SaveIndex();
+
+  // Description:
+  // Add or move a tile to the front of the use order.
+  // Must be called with Lock held.
+  void InsertTile(const TileEntry& entry);
+
+  std::string Directory;
+  int MaximumSize;
+  double LowWaterMark;
+
+  vtkMultiThreader *Threader;
+  int ThreadId;
+
+  // Description:
+  // Index state, shared with the background thread and guarded by Lock.
+  // Order holds the tiles from most to least recently used.
+  typedef std::list<TileEntry> TileList;
+  vtkMutexLock *Lock;
+  vtkConditionVariable *Condition;
+  TileList Order;
+  std::map<std::string, TileList::iterator> Tiles;
+  vtkTypeInt64 Size;
+  int Changes;  // tiles added or removed since the index was saved
+  bool OrderChanged;
+  double NextSaveTime;
+  bool Stopping;
+
+  // Description:
+  // Locks of the tile files, see LockTile()
+  enum { NumberOfTileLocks = 16 };
+  vtkMutexLock *TileLocks[NumberOfTileLocks];
+  vtkMutexLock *GetTileLock(const std::string& key);
+
+private:
+  vtkMapTileCache(const vtkMapTileCache&);  // Not implemented
+  void operator=(const vtkMapTileCache&); // Not implemented
+};
+
+#endif // __vtkMapTileCache_h
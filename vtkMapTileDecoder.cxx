@@ -0,0 +1,345 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileDecoder.h"
+#include "vtkMapTile.h"
+#include "vtkMapTileImageCache.h"
+#include "vtkMapTileStore.h"
+
+// VTK Includes
+#include <vtkConditionVariable.h>
+#include <vtkImageData.h>
+#include <vtkMutexLock.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPNGReader.h>
+
+#include <algorithm>
+
+vtkStandardNewMacro(vtkMapTileDecoder)
+
+//----------------------------------------------------------------------------
+namespace
+{
+  bool lessPriority(const vtkMapTileDecoder::Request& a,
+                    const vtkMapTileDecoder::Request& b)
+  {
+    return a.Priority < b.Priority;
+  }
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileDecoder::vtkMapTileDecoder()
+{
+  this->NumberOfThreads = 2;
+  this->Store = NULL;
+  this->Threader = vtkMultiThreader::New();
+  this->Lock = vtkMutexLock::New();
+  this->QueueCondition = vtkConditionVariable::New();
+  this->Stopping = false;
+  this->Generation = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileDecoder::~vtkMapTileDecoder()
+{
+  this->Stop();
+  this->QueueCondition->Delete();
+  this->Lock->Delete();
+  this->Threader->Delete();
+  this->SetStore(NULL);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDecoder::PrintSelf(ostream &os, vtkIndent indent)
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n"
+     << indent << "PendingRequests: " << this->GetNumberOfPendingRequests()
+     << std::endl;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDecoder::SetStore(vtkMapTileStore *store)
+{
+  if (!this->ThreadIds.empty() && store != this->Store)
+    {
+    vtkErrorMacro("Cannot change the store while decoding");
+    return;
+    }
+  if (store == this->Store)
+    {
+    return;
+    }
+  if (store)
+    {
+    store->Register(this);
+    }
+  if (this->Store)
+    {
+    this->Store->UnRegister(this);
+    }
+  this->Store = store;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDecoder::RequestImage(int zoom, int x, int y,
+                                     const std::string& key, double priority)
+{
+  if (!this->Store)
+    {
+    vtkErrorMacro("Cannot decode tiles without a store");
+    return;
+    }
+
+  Request request;
+  request.Zoom = zoom;
+  request.X = x;
+  request.Y = y;
+  request.Key = key;
+  request.Succeeded = false;
+  request.Priority = priority;
+
+  vtkTypeUInt64 id = vtkMapTile::ComputeTileId(zoom, x, y);
+  this->Lock->Lock();
+  request.Generation = this->Generation;
+  if (this->PendingTiles.insert(id).second)
+    {
+    this->Queue.push_back(request);
+    this->QueueCondition->Signal();
+    }
+  else
+    {
+    // Renew a queued request, a tile being decoded is not in the queue
+    std::vector<Request>::iterator iter;
+    for (iter = this->Queue.begin(); iter != this->Queue.end(); ++iter)
+      {
+      if (iter->Zoom == zoom && iter->X == x && iter->Y == y)
+        {
+        iter->Priority = priority;
+        iter->Generation = this->Generation;
+        break;
+        }
+      }
+    }
+  this->Lock->Unlock();
+
+  if (this->ThreadIds.empty())
+    {
+    this->StartThreads();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDecoder::BeginRequests()
+{
+  this->Lock->Lock();
+  ++this->Generation;
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+int vtkMapTileDecoder::EndRequests()
+{
+  int count = 0;
+  this->Lock->Lock();
+  std::vector<Request>::iterator iter = this->Queue.begin();
+  while (iter != this->Queue.end())
+    {
+    if (iter->Generation != this->Generation)
+      {
+      this->PendingTiles.erase(
+        vtkMapTile::ComputeTileId(iter->Zoom, iter->X, iter->Y));
+      iter = this->Queue.erase(iter);
+      ++count;
+      }
+    else
+      {
+      ++iter;
+      }
+    }
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileDecoder::IsPending(int zoom, int x, int y)
+{
+  this->Lock->Lock();
+  bool pending =
+    this->PendingTiles.count(vtkMapTile::ComputeTileId(zoom, x, y)) > 0;
+  this->Lock->Unlock();
+  return pending;
+}
+
+//----------------------------------------------------------------------------
+int vtkMapTileDecoder::GetNumberOfPendingRequests()
+{
+  this->Lock->Lock();
+  int count = static_cast<int>(this->PendingTiles.size());
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileDecoder::HasCompletedRequests()
+{
+  this->Lock->Lock();
+  bool result = !this->Completed.empty();
+  this->Lock->Unlock();
+  return result;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDecoder::GetCompletedRequests(std::vector<Request>& completed)
+{
+  this->Lock->Lock();
+  completed.insert(completed.end(),
+                   this->Completed.begin(), this->Completed.end());
+  this->Completed.clear();
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDecoder::Stop()
+{
+  this->Lock->Lock();
+  this->Stopping = true;
+  this->Queue.clear();
+  this->QueueCondition->Broadcast();
+  this->Lock->Unlock();
+
+  // TerminateThread() joins the thread
+  for (size_t i = 0; i < this->ThreadIds.size(); ++i)
+    {
+    this->Threader->TerminateThread(this->ThreadIds[i]);
+    }
+  this->ThreadIds.clear();
+
+  this->Lock->Lock();
+  this->PendingTiles.clear();
+  this->Stopping = false;
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDecoder::StartThreads()
+{
+  for (int i = 0; i < this->NumberOfThreads; ++i)
+    {
+    int id = this->Threader->SpawnThread(vtkMapTileDecoder::WorkerMain, this);
+    if (id < 0)
+      {
+      vtkErrorMacro("Cannot spawn tile decode thread");
+      break;
+      }
+    this->ThreadIds.push_back(id);
+    }
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkMapTileDecoder::WorkerMain(void *arg)
+{
+  vtkMultiThreader::ThreadInfo *info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkMapTileDecoder *self = static_cast<vtkMapTileDecoder*>(info->UserData);
+  self->RunWorker();
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDecoder::RunWorker()
+{
+  this->Lock->Lock();
+  while (true)
+    {
+    while (this->Queue.empty() && !this->Stopping)
+      {
+      this->QueueCondition->Wait(this->Lock);
+      }
+    if (this->Stopping)
+      {
+      break;
+      }
+
+    std::vector<Request>::iterator next = std::min_element(
+      this->Queue.begin(), this->Queue.end(), lessPriority);
+    Request request = *next;
+    this->Queue.erase(next);
+    this->Lock->Unlock();
+
+    request.Succeeded = this->DecodeImage(request);
+
+    this->Lock->Lock();
+    this->PendingTiles.erase(
+      vtkMapTile::ComputeTileId(request.Zoom, request.X, request.Y));
+    this->Completed.push_back(request);
+    }
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileDecoder::DecodeImage(const Request& request)
+{
+  // Runs on a worker thread: only touch the request, the store
+  // and the image cache, which are thread safe, here
+  vtkMapTileImageCache *images = vtkMapTileImageCache::GetInstance();
+  if (images->HasImage(request.Key))
+    {
+    // Decoded for another layer meanwhile
+    return true;
+    }
+
+  vtkMapTileStore::TileData data;
+  if (!this->Store->ReadTile(request.Zoom, request.X, request.Y, data))
+    {
+    return false;
+    }
+
+  vtkSmartPointer<vtkImageData> image =
+    vtkMapTileDecoder::Decode(data.Data, data.Length);
+  if (!image)
+    {
+    vtkWarningMacro(<< "Cannot decode tile image " << request.Key);
+    return false;
+    }
+
+  images->AddImage(request.Key, image);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkImageData>
+vtkMapTileDecoder::Decode(const unsigned char *data, size_t length)
+{
+  // Decode straight from the buffer. The reader expands palette and
+  // low bit depth images to 8 bit gray or RGB(A), the layouts vtkTexture
+  // uploads without further conversion. Incomplete images are not
+  // decoded, so that their tile stays a placeholder.
+  if (!vtkMapTileStore::IsValidImage(data, length))
+    {
+    return NULL;
+    }
+  vtkNew<vtkPNGReader> pngReader;
+  pngReader->SetMemoryBuffer(const_cast<unsigned char*>(data));
+  pngReader->SetMemoryBufferLength(static_cast<vtkIdType>(length));
+  pngReader->Update();
+  vtkSmartPointer<vtkImageData> image = pngReader->GetOutput();
+  if (image->GetNumberOfPoints() == 0)
+    {
+    image = NULL;
+    }
+  return image;
+}
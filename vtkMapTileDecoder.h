@@ -0,0 +1,153 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapTileDecoder - decodes tile images on worker threads
+// .SECTION Description
+// vtkMapTileDecoder reads tile images from a vtkMapTileStore and decodes
+// them on a pool of worker threads, so that the render thread only
+// attaches finished images to the tile textures. Decoded images are
+// added to the vtkMapTileImageCache, under the key of the request.
+// Requests are served in priority order, and can be cancelled like
+// those of vtkMapTileDownloader.
+// .SECTION See Also
+// vtkMapTileDownloader vtkMapTileImageCache
+
+#ifndef __vtkMapTileDecoder_h
+#define __vtkMapTileDecoder_h
+
+// VTK Includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+#include "vtkmap_export.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+class vtkConditionVariable;
+class vtkImageData;
+class vtkMapTileStore;
+class vtkMutexLock;
+
+class VTKMAP_EXPORT vtkMapTileDecoder : public vtkObject
+{
+public:
+  static vtkMapTileDecoder *New();
+  virtual void PrintSelf(ostream &os, vtkIndent indent);
+  vtkTypeMacro(vtkMapTileDecoder, vtkObject)
+
+  // Description:
+  // Decode of a single tile image, identified by its zoom level and
+  // x/y index. Key is the key of the image in vtkMapTileImageCache.
+  class Request
+  {
+  public:
+    int Zoom;
+    int X;
+    int Y;
+    std::string Key;
+    bool Succeeded;
+    double Priority;
+    int Generation;
+  };
+
+  // Description:
+  // Get/Set the number of worker threads, default is 2.
+  // Must be set before the first request is queued.
+  vtkSetClampMacro(NumberOfThreads, int, 1, 16)
+  vtkGetMacro(NumberOfThreads, int)
+
+  // Description:
+  // Get/Set the store images are read from.
+  // Must be set before the first request is queued.
+  virtual void SetStore(vtkMapTileStore *store);
+  vtkGetObjectMacro(Store, vtkMapTileStore)
+
+  // Description:
+  // Queue decode of a tile image. Requests with a lower priority value
+  // are decoded first. Requesting a tile that is already queued only
+  // updates its priority.
+  void RequestImage(int zoom, int x, int y, const std::string& key,
+                    double priority = 0.0);
+
+  // Description:
+  // Bracket a pass that re-requests every image still wanted.
+  // EndRequests() cancels queued requests that were not renewed since
+  // BeginRequests(). Returns the number of cancelled requests.
+  void BeginRequests();
+  int EndRequests();
+
+  // Description:
+  // Returns true if the tile is queued or being decoded
+  bool IsPending(int zoom, int x, int y);
+
+  // Description:
+  // Returns the number of tiles queued or being decoded
+  int GetNumberOfPendingRequests();
+
+  // Description:
+  // Returns true if finished requests are waiting to be collected
+  bool HasCompletedRequests();
+
+  // Description:
+  // Append finished requests to completed and clear the internal list
+  void GetCompletedRequests(std::vector<Request>& completed);
+
+  // Description:
+  // Discard queued requests and stop the worker threads, after they
+  // finish the images they are decoding
+  void Stop();
+
+  // Description:
+  // Decode a PNG image held in memory. Returns NULL if it is truncated
+  // or cannot be decoded. Thread safe.
+  static vtkSmartPointer<vtkImageData> Decode(const unsigned char *data,
+                                              size_t length);
+
+protected:
+  vtkMapTileDecoder();
+  ~vtkMapTileDecoder();
+
+  void StartThreads();
+  void RunWorker();
+
+  // Description:
+  // Read and decode the image of a request into the image cache
+  bool DecodeImage(const Request& request);
+
+  static VTK_THREAD_RETURN_TYPE WorkerMain(void *arg);
+
+  int NumberOfThreads;
+  vtkMapTileStore *Store;
+
+  vtkMultiThreader *Threader;
+  std::vector<int> ThreadIds;
+
+  // Description:
+  // State shared with the worker threads, guarded by Lock
+  vtkMutexLock *Lock;
+  vtkConditionVariable *QueueCondition;
+  std::vector<Request> Queue;
+  std::set<vtkTypeUInt64> PendingTiles;
+  std::vector<Request> Completed;
+  bool Stopping;
+  int Generation;
+
+private:
+  vtkMapTileDecoder(const vtkMapTileDecoder&);  // Not implemented
+  void operator=(const vtkMapTileDecoder&); // Not implemented
+};
+
+#endif // __vtkMapTileDecoder_h
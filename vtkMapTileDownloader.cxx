@@ -0,0 +1,1031 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileDownloader.h"
+#include "vtkMapTile.h"
+#include "vtkMapTileDecoder.h"
+#include "vtkMapTileImageCache.h"
+
+// VTK Includes
+#include <vtkConditionVariable.h>
+#include <vtkImageData.h>
+#include <vtkMutexLock.h>
+#include <vtkObjectFactory.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <curl/curl.h>
+
+#if defined(VTK_USE_PTHREADS)
+# include <pthread.h>
+# include <sys/time.h>
+#elif defined(VTK_USE_WIN32_THREADS)
+# include "vtkWindows.h"
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+
+//----------------------------------------------------------------------------
+class vtkMapTileDownloader::vtkInternal
+{
+public:
+  vtkInternal();
+  ~vtkInternal();
+
+  // vtkConditionVariable cannot time out, so the worker waiting for
+  // the next retry waits on this timer instead. A Wake() ends the
+  // current wait, or the next one if no thread is waiting.
+  void WaitForTimer(double seconds);
+  void WakeTimer();
+
+  // DNS, TLS session and connection caches shared by all worker handles
+  CURLSH *Share;
+  vtkSimpleMutexLock ShareLocks[CURL_LOCK_DATA_LAST];
+
+  // Whether a worker waits on the timer, guarded by the downloader Lock
+  bool TimerWaiting;
+
+#if defined(VTK_USE_PTHREADS)
+  pthread_mutex_t TimerMutex;
+  pthread_cond_t TimerCondition;
+  bool TimerWoken;
+#elif defined(VTK_USE_WIN32_THREADS)
+  HANDLE TimerEvent;
+#endif
+};
+
+//----------------------------------------------------------------------------
+vtkMapTileDownloader::vtkInternal::vtkInternal()
+{
+  this->Share = NULL;
+  this->TimerWaiting = false;
+#if defined(VTK_USE_PTHREADS)
+  pthread_mutex_init(&this->TimerMutex, NULL);
+  pthread_cond_init(&this->TimerCondition, NULL);
+  this->TimerWoken = false;
+#elif defined(VTK_USE_WIN32_THREADS)
+  // Auto-reset, so that a wake is consumed by the wait it ends
+  this->TimerEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileDownloader::vtkInternal::~vtkInternal()
+{
+#if defined(VTK_USE_PTHREADS)
+  pthread_cond_destroy(&this->TimerCondition);
+  pthread_mutex_destroy(&this->TimerMutex);
+#elif defined(VTK_USE_WIN32_THREADS)
+  CloseHandle(this->TimerEvent);
+#endif
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::vtkInternal::WaitForTimer(double seconds)
+{
+  seconds = std::max(seconds, 0.0);
+#if defined(VTK_USE_PTHREADS)
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  double deadline = now.tv_sec + now.tv_usec * 1e-6 + seconds;
+  struct timespec timeout;
+  timeout.tv_sec = static_cast<time_t>(deadline);
+  timeout.tv_nsec = static_cast<long>((deadline - timeout.tv_sec) * 1e9);
+
+  pthread_mutex_lock(&this->TimerMutex);
+  int result = 0;
+  while (!this->TimerWoken && result == 0)
+    {
+    result = pthread_cond_timedwait(&this->TimerCondition,
+                                    &this->TimerMutex, &timeout);
+    }
+  this->TimerWoken = false;
+  pthread_mutex_unlock(&this->TimerMutex);
+#elif defined(VTK_USE_WIN32_THREADS)
+  WaitForSingleObject(this->TimerEvent,
+                      static_cast<DWORD>(seconds * 1000.0 + 0.5));
+#else
+  // No threads, nothing can wake the wait
+  vtksys::SystemTools::Delay(static_cast<unsigned int>(seconds * 1000.0));
+#endif
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::vtkInternal::WakeTimer()
+{
+#if defined(VTK_USE_PTHREADS)
+  pthread_mutex_lock(&this->TimerMutex);
+  this->TimerWoken = true;
+  pthread_cond_signal(&this->TimerCondition);
+  pthread_mutex_unlock(&this->TimerMutex);
+#elif defined(VTK_USE_WIN32_THREADS)
+  SetEvent(this->TimerEvent);
+#endif
+}
+
+vtkStandardNewMacro(vtkMapTileDownloader)
+
+//----------------------------------------------------------------------------
+namespace
+{
+  // libcurl write callback, collects the response in a string
+  size_t writeBuffer(char *data, size_t size, size_t count, void *userp)
+  {
+    static_cast<std::string*>(userp)->append(data, size * count);
+    return size * count;
+  }
+
+  // Shortest time in seconds a downloaded image stays fresh, so that
+  // tiles marked no-cache are not revalidated on every view update
+  const double minimumMaximumAge = 60.0;
+
+  // Cache headers of a response
+  struct ResponseHeaders
+  {
+    ResponseHeaders() : MaxAge(-1.0), Expires(-1.0) {}
+
+    std::string ETag;
+    std::string LastModified;
+    double MaxAge;
+    double Expires;
+  };
+
+  // libcurl header callback, collects the cache headers
+  size_t readHeader(char *data, size_t size, size_t count, void *userp)
+  {
+    ResponseHeaders *headers = static_cast<ResponseHeaders*>(userp);
+    std::string line(data, size * count);
+    if (line.compare(0, 5, "HTTP/") == 0)
+      {
+      // Status line, forget headers of redirects
+      *headers = ResponseHeaders();
+      return size * count;
+      }
+
+    size_t colon = line.find(':');
+    if (colon == std::string::npos)
+      {
+      return size * count;
+      }
+    std::string name =
+      vtksys::SystemTools::LowerCase(line.substr(0, colon));
+    size_t first = line.find_first_not_of(" \t", colon + 1);
+    size_t last = line.find_last_not_of(" \t\r\n");
+    std::string value = first == std::string::npos || last < first ?
+      std::string() : line.substr(first, last - first + 1);
+
+    if (name == "etag")
+      {
+      headers->ETag = value;
+      }
+    else if (name == "last-modified")
+      {
+      headers->LastModified = value;
+      }
+    else if (name == "expires")
+      {
+      // Invalid dates, like 0, mean already expired
+      time_t expires = curl_getdate(value.c_str(), NULL);
+      headers->Expires = expires > 0 ? static_cast<double>(expires) : 0.0;
+      }
+    else if (name == "cache-control")
+      {
+      std::string directives = vtksys::SystemTools::LowerCase(value);
+      size_t maxAge = directives.find("max-age=");
+      if (maxAge != std::string::npos)
+        {
+        headers->MaxAge = atof(directives.c_str() + maxAge + 8);
+        }
+      else if (directives.find("no-cache") != std::string::npos ||
+               directives.find("no-store") != std::string::npos)
+        {
+        headers->MaxAge = 0.0;
+        }
+      }
+    return size * count;
+  }
+
+  // libcurl progress callback, used to abort transfers on Stop()
+  int abortCallback(void *clientp, curl_off_t, curl_off_t,
+                    curl_off_t, curl_off_t)
+  {
+    return static_cast<vtkMapTileDownloader*>(clientp)->IsStopping() ? 1 : 0;
+  }
+
+  // libcurl share callbacks, the share handle is used by all workers
+  void lockShare(CURL *, curl_lock_data data, curl_lock_access, void *userp)
+  {
+    static_cast<vtkSimpleMutexLock*>(userp)[data].Lock();
+  }
+
+  void unlockShare(CURL *, curl_lock_data data, void *userp)
+  {
+    static_cast<vtkSimpleMutexLock*>(userp)[data].Unlock();
+  }
+
+  bool lessPriority(const vtkMapTileDownloader::Request& a,
+                    const vtkMapTileDownloader::Request& b)
+  {
+    return a.Priority < b.Priority;
+  }
+
+  // Find the request for tile id in requests, or return requests.end()
+  std::vector<vtkMapTileDownloader::Request>::iterator
+  findRequest(std::vector<vtkMapTileDownloader::Request>& requests,
+              vtkTypeUInt64 id)
+  {
+    std::vector<vtkMapTileDownloader::Request>::iterator iter;
+    for (iter = requests.begin(); iter != requests.end(); ++iter)
+      {
+      if (vtkMapTile::ComputeTileId(iter->Zoom, iter->X, iter->Y) == id)
+        {
+        break;
+        }
+      }
+    return iter;
+  }
+
+  // Remove requests not renewed in generation, and forget their tile ids
+  int removeStale(std::vector<vtkMapTileDownloader::Request>& requests,
+                  int generation, std::set<vtkTypeUInt64>& pendingTiles)
+  {
+    int count = 0;
+    std::vector<vtkMapTileDownloader::Request>::iterator iter =
+      requests.begin();
+    while (iter != requests.end())
+      {
+      if (iter->Generation != generation)
+        {
+        pendingTiles.erase(
+          vtkMapTile::ComputeTileId(iter->Zoom, iter->X, iter->Y));
+        iter = requests.erase(iter);
+        ++count;
+        }
+      else
+        {
+        ++iter;
+        }
+      }
+    return count;
+  }
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileDownloader::vtkMapTileDownloader()
+{
+  this->NumberOfThreads = 4;
+  this->MaximumNumberOfRetries = 3;
+  this->RetryDelay = 0.5;
+  this->MaximumRetryDelay = 30.0;
+  this->DefaultMaximumAge = 7 * 24 * 3600.0;
+  this->MaximumRequestRate = 0.0;
+  this->DecodeImages = true;
+  this->UserAgent = NULL;
+  this->SetUserAgent("vtkMap");
+  this->Store = NULL;
+  this->Threader = vtkMultiThreader::New();
+  this->Lock = vtkMutexLock::New();
+  this->QueueCondition = vtkConditionVariable::New();
+  this->WriteCondition = vtkConditionVariable::New();
+  this->Stopping = false;
+  this->Generation = 0;
+  this->NextRequestTime = 0.0;
+
+  // curl_global_init() is not thread safe, so call it here
+  // before any worker thread is started
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  this->Impl = new vtkInternal;
+  this->Impl->Share = curl_share_init();
+  curl_share_setopt(this->Impl->Share, CURLSHOPT_LOCKFUNC, lockShare);
+  curl_share_setopt(this->Impl->Share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+  curl_share_setopt(this->Impl->Share, CURLSHOPT_USERDATA,
+                    this->Impl->ShareLocks);
+  curl_share_setopt(this->Impl->Share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(this->Impl->Share, CURLSHOPT_SHARE,
+                    CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+  // Sharing the connection cache requires libcurl 7.57
+  curl_share_setopt(this->Impl->Share, CURLSHOPT_SHARE,
+                    CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileDownloader::~vtkMapTileDownloader()
+{
+  this->Stop();
+  curl_share_cleanup(this->Impl->Share);
+  delete this->Impl;
+  this->QueueCondition->Delete();
+  this->WriteCondition->Delete();
+  this->Lock->Delete();
+  this->Threader->Delete();
+  this->SetUserAgent(NULL);
+  this->SetStore(NULL);
+  curl_global_cleanup();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::PrintSelf(ostream &os, vtkIndent indent)
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n"
+     << indent << "MaximumNumberOfRetries: "
+     << this->MaximumNumberOfRetries << "\n"
+     << indent << "RetryDelay: " << this->RetryDelay << "\n"
+     << indent << "MaximumRetryDelay: " << this->MaximumRetryDelay << "\n"
+     << indent << "DefaultMaximumAge: " << this->DefaultMaximumAge << "\n"
+     << indent << "MaximumRequestRate: " << this->MaximumRequestRate << "\n"
+     << indent << "DecodeImages: " << this->DecodeImages << "\n"
+     << indent << "UserAgent: "
+     << (this->UserAgent ? this->UserAgent : "(none)") << "\n"
+     << indent << "PendingRequests: " << this->GetNumberOfPendingRequests()
+     << "\n"
+     << indent << "PendingWrites: " << this->GetNumberOfPendingWrites()
+     << std::endl;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::SetStore(vtkMapTileStore *store)
+{
+  if (!this->ThreadIds.empty() && store != this->Store)
+    {
+    vtkErrorMacro("Cannot change the store while downloads are running");
+    return;
+    }
+  if (store == this->Store)
+    {
+    return;
+    }
+  if (store)
+    {
+    store->Register(this);
+    }
+  if (this->Store)
+    {
+    this->Store->UnRegister(this);
+    }
+  this->Store = store;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::RequestTile(int zoom, int x, int y,
+                                       const std::string& url,
+                                       double priority, bool revalidate)
+{
+  if (!this->Store)
+    {
+    vtkErrorMacro("Cannot download tiles without a store");
+    return;
+    }
+
+  Request request;
+  request.Zoom = zoom;
+  request.X = x;
+  request.Y = y;
+  request.Url = url;
+  request.Succeeded = false;
+  request.Attempts = 0;
+  request.RetryTime = 0.0;
+  request.Priority = priority;
+  request.Revalidate = revalidate;
+  request.NotModified = false;
+  request.ExpirationTime = 0.0;
+
+  vtkTypeUInt64 id = vtkMapTile::ComputeTileId(zoom, x, y);
+  this->Lock->Lock();
+  request.Generation = this->Generation;
+  // Tiles waiting to be written were just downloaded. They stay
+  // pending until written, so callers request them from the store
+  // if their decoded image is dropped meanwhile.
+  if (this->PendingWrites.count(id) == 0 &&
+      this->PendingTiles.insert(id).second)
+    {
+    this->Queue.push_back(request);
+    this->QueueCondition->Signal();
+    if (this->Impl->TimerWaiting)
+      {
+      // The other workers may be busy
+      this->Impl->WakeTimer();
+      }
+    }
+  else
+    {
+    // Renew a queued request, or one waiting for its retry.
+    // A tile being downloaded is in neither list.
+    Request *queued = NULL;
+    std::vector<Request>::iterator iter = findRequest(this->Queue, id);
+    if (iter != this->Queue.end())
+      {
+      queued = &(*iter);
+      }
+    else if ((iter = findRequest(this->Retries, id)) != this->Retries.end())
+      {
+      queued = &(*iter);
+      }
+    if (queued)
+      {
+      queued->Priority = priority;
+      queued->Generation = this->Generation;
+      queued->Revalidate = queued->Revalidate && revalidate;
+      }
+    }
+  this->Lock->Unlock();
+
+  if (this->ThreadIds.empty())
+    {
+    this->StartThreads();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::BeginRequests()
+{
+  this->Lock->Lock();
+  ++this->Generation;
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+int vtkMapTileDownloader::EndRequests()
+{
+  this->Lock->Lock();
+  int count = removeStale(this->Queue, this->Generation, this->PendingTiles);
+  count += removeStale(this->Retries, this->Generation, this->PendingTiles);
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileDownloader::IsPending(int zoom, int x, int y)
+{
+  this->Lock->Lock();
+  vtkTypeUInt64 id = vtkMapTile::ComputeTileId(zoom, x, y);
+  bool pending = this->PendingTiles.count(id) > 0 ||
+    this->PendingWrites.count(id) > 0;
+  this->Lock->Unlock();
+  return pending;
+}
+
+//----------------------------------------------------------------------------
+int vtkMapTileDownloader::GetNumberOfPendingRequests()
+{
+  this->Lock->Lock();
+  int count = static_cast<int>(this->PendingTiles.size());
+  // A download queues its write before it completes, count it once
+  std::multiset<vtkTypeUInt64>::const_iterator iter =
+    this->PendingWrites.begin();
+  while (iter != this->PendingWrites.end())
+    {
+    if (this->PendingTiles.count(*iter) == 0)
+      {
+      ++count;
+      }
+    iter = this->PendingWrites.upper_bound(*iter);
+    }
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+int vtkMapTileDownloader::GetNumberOfPendingWrites()
+{
+  this->Lock->Lock();
+  int count = static_cast<int>(this->Writes.size());
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileDownloader::HasCompletedRequests()
+{
+  this->Lock->Lock();
+  bool result = !this->Completed.empty();
+  this->Lock->Unlock();
+  return result;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::
+GetCompletedRequests(std::vector<Request>& completed)
+{
+  this->Lock->Lock();
+  completed.insert(completed.end(),
+                   this->Completed.begin(), this->Completed.end());
+  this->Completed.clear();
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::Stop()
+{
+  this->Lock->Lock();
+  this->Stopping = true;
+  this->Queue.clear();
+  this->Retries.clear();
+  this->QueueCondition->Broadcast();
+  this->WriteCondition->Broadcast();
+  if (this->Impl->TimerWaiting)
+    {
+    this->Impl->WakeTimer();
+    }
+  this->Lock->Unlock();
+
+  // TerminateThread() joins the thread. The writer thread
+  // finishes the queued writes first.
+  for (size_t i = 0; i < this->ThreadIds.size(); ++i)
+    {
+    this->Threader->TerminateThread(this->ThreadIds[i]);
+    }
+  this->ThreadIds.clear();
+
+  // Writes queued by downloads that completed after the writer left
+  while (!this->Writes.empty())
+    {
+    this->PerformWrite(this->Writes.front());
+    this->Writes.pop_front();
+    }
+
+  this->Lock->Lock();
+  this->PendingTiles.clear();
+  this->PendingWrites.clear();
+  this->Stopping = false;
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::StartThreads()
+{
+  int writerId = this->Threader->SpawnThread(
+    vtkMapTileDownloader::WriterMain, this);
+  if (writerId < 0)
+    {
+    vtkErrorMacro("Cannot spawn tile writer thread");
+    return;
+    }
+  this->ThreadIds.push_back(writerId);
+
+  for (int i = 0; i < this->NumberOfThreads; ++i)
+    {
+    int id = this->Threader->SpawnThread(
+      vtkMapTileDownloader::WorkerMain, this);
+    if (id < 0)
+      {
+      vtkErrorMacro("Cannot spawn tile download thread");
+      break;
+      }
+    this->ThreadIds.push_back(id);
+    }
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkMapTileDownloader::WorkerMain(void *arg)
+{
+  vtkMultiThreader::ThreadInfo *info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkMapTileDownloader *self =
+    static_cast<vtkMapTileDownloader*>(info->UserData);
+  self->RunWorker();
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkMapTileDownloader::WriterMain(void *arg)
+{
+  vtkMultiThreader::ThreadInfo *info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkMapTileDownloader *self =
+    static_cast<vtkMapTileDownloader*>(info->UserData);
+  self->RunWriter();
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::RunWriter()
+{
+  this->Lock->Lock();
+  while (true)
+    {
+    while (this->Writes.empty() && !this->Stopping)
+      {
+      this->WriteCondition->Wait(this->Lock);
+      }
+    if (this->Writes.empty())
+      {
+      break;
+      }
+
+    // Keep the request queued while writing, so that
+    // GetNumberOfPendingWrites() covers it. Only this thread removes
+    // requests, and appending to a deque keeps references valid.
+    const WriteRequest& write = this->Writes.front();
+    this->Lock->Unlock();
+    this->PerformWrite(write);
+    this->Lock->Lock();
+
+    this->PendingWrites.erase(this->PendingWrites.find(
+      vtkMapTile::ComputeTileId(write.Zoom, write.X, write.Y)));
+    this->Writes.pop_front();
+    }
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::QueueWrite(WriteRequest& write)
+{
+  this->Lock->Lock();
+  this->Writes.push_back(WriteRequest());
+  WriteRequest& queued = this->Writes.back();
+  queued.Zoom = write.Zoom;
+  queued.X = write.X;
+  queued.Y = write.Y;
+  queued.HasImage = write.HasImage;
+  queued.Image.swap(write.Image);
+  queued.Metadata = write.Metadata;
+  this->PendingWrites.insert(
+    vtkMapTile::ComputeTileId(write.Zoom, write.X, write.Y));
+  this->WriteCondition->Signal();
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::PerformWrite(const WriteRequest& write)
+{
+  if (write.HasImage &&
+      !this->Store->WriteTile(write.Zoom, write.X, write.Y,
+                              write.Image.data(), write.Image.size()))
+    {
+    vtkWarningMacro(<< "Failed to store tile " << write.Zoom << "/"
+                    << write.X << "/" << write.Y);
+    return;
+    }
+  this->Store->SetTileMetadata(write.Zoom, write.X, write.Y, write.Metadata);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::RunWorker()
+{
+  // The handle lives as long as the worker, so that libcurl keeps its
+  // connections open between requests
+  CURL *curl = curl_easy_init();
+  if (!curl)
+    {
+    vtkErrorMacro("Cannot initialize libcurl");
+    return;
+    }
+  curl_easy_setopt(curl, CURLOPT_SHARE, this->Impl->Share);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, this->UserAgent);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  // Signals cannot be used for timeouts in multi-threaded programs
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072F00
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, abortCallback);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
+
+  this->Lock->Lock();
+  while (true)
+    {
+    bool timed = false;
+    double now;
+    while (!this->Stopping)
+      {
+      this->QueueDueRetries();
+      now = vtksys::SystemTools::GetTime();
+      if (!this->Queue.empty() && now >= this->NextRequestTime)
+        {
+        break;
+        }
+
+      // Time of the next retry, or of the next request the rate
+      // limit lets through
+      double wakeTime = this->Queue.empty() ?
+        VTK_DOUBLE_MAX : this->NextRequestTime;
+      for (size_t i = 0; i < this->Retries.size(); ++i)
+        {
+        wakeTime = std::min(wakeTime, this->Retries[i].RetryTime);
+        }
+      if (wakeTime == VTK_DOUBLE_MAX || this->Impl->TimerWaiting)
+        {
+        this->QueueCondition->Wait(this->Lock);
+        }
+      else
+        {
+        // One worker waits until then, or until a new request, a new
+        // retry or Stop() wakes it
+        this->Impl->TimerWaiting = true;
+        this->Lock->Unlock();
+        this->Impl->WaitForTimer(wakeTime - now);
+        this->Lock->Lock();
+        this->Impl->TimerWaiting = false;
+        timed = true;
+        }
+      }
+    if (this->Stopping)
+      {
+      break;
+      }
+    if (this->MaximumRequestRate > 0.0)
+      {
+      this->NextRequestTime = std::max(now, this->NextRequestTime) +
+        1.0 / this->MaximumRequestRate;
+      }
+    if (timed && (this->Queue.size() > 1 || !this->Retries.empty()))
+      {
+      // Hand the remaining requests and retries to an idle worker
+      this->QueueCondition->Signal();
+      }
+
+    // The queue is short and priorities change with every view update,
+    // so a linear search is cheaper than keeping it sorted
+    std::vector<Request>::iterator next = std::min_element(
+      this->Queue.begin(), this->Queue.end(), lessPriority);
+    Request request = *next;
+    this->Queue.erase(next);
+    this->Lock->Unlock();
+
+    DownloadStatus status = this->DownloadImage(curl, request);
+    request.Attempts++;
+
+    this->Lock->Lock();
+    vtkTypeUInt64 id =
+      vtkMapTile::ComputeTileId(request.Zoom, request.X, request.Y);
+    if (status == DownloadAborted)
+      {
+      // Stop() was called. The tile is not reported, neither as failed
+      // nor as downloaded, so that it is requested again later.
+      this->PendingTiles.erase(id);
+      continue;
+      }
+    if (status == DownloadRetry &&
+        request.Attempts <= this->MaximumNumberOfRetries)
+      {
+      // The tile stays pending while it waits for its retry
+      int doublings = std::min(request.Attempts - 1, 16);
+      double delay = std::min(this->RetryDelay * (1 << doublings),
+                              this->MaximumRetryDelay);
+      request.RetryTime = vtksys::SystemTools::GetTime() + delay;
+      // It could not be renewed while in flight, so do not treat it as stale
+      request.Generation = this->Generation;
+      this->Retries.push_back(request);
+      if (this->Impl->TimerWaiting)
+        {
+        // The retry may be due before the one waited for
+        this->Impl->WakeTimer();
+        }
+      continue;
+      }
+
+    request.Succeeded = status == DownloadSucceeded;
+    this->PendingTiles.erase(id);
+    this->Completed.push_back(request);
+    }
+  this->Lock->Unlock();
+
+  curl_easy_cleanup(curl);
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileDownloader::IsStopping()
+{
+  this->Lock->Lock();
+  bool stopping = this->Stopping;
+  this->Lock->Unlock();
+  return stopping;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileDownloader::QueueDueRetries()
+{
+  if (this->Retries.empty())
+    {
+    return;
+    }
+
+  double now = vtksys::SystemTools::GetTime();
+  std::vector<Request>::iterator iter = this->Retries.begin();
+  while (iter != this->Retries.end())
+    {
+    if (iter->RetryTime <= now)
+      {
+      this->Queue.push_back(*iter);
+      iter = this->Retries.erase(iter);
+      this->QueueCondition->Signal();
+      }
+    else
+      {
+      ++iter;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileDownloader::DownloadStatus
+vtkMapTileDownloader::DownloadImage(void *curl, Request& request)
+{
+  // Runs on a worker thread: only touch the request, libcurl, and
+  // the store and the image cache, which are thread safe, here
+  std::string buffer;
+  ResponseHeaders headers;
+  char errorBuffer[CURL_ERROR_SIZE];
+  errorBuffer[0] = '\0';
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
+  curl_easy_setopt(curl, CURLOPT_URL, request.Url.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeBuffer);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, readHeader);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+
+  // Make revalidation conditional on the validators of the stored image
+  vtkMapTileStore::TileMetadata metadata;
+  struct curl_slist *conditions = NULL;
+  if (request.Revalidate &&
+      this->Store->GetTileMetadata(request.Zoom, request.X, request.Y,
+                                   metadata))
+    {
+    if (!metadata.ETag.empty())
+      {
+      conditions = curl_slist_append(
+        conditions, ("If-None-Match: " + metadata.ETag).c_str());
+      }
+    if (!metadata.LastModified.empty())
+      {
+      conditions = curl_slist_append(
+        conditions, ("If-Modified-Since: " + metadata.LastModified).c_str());
+      }
+    }
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, conditions);
+
+  CURLcode res = curl_easy_perform(curl);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+  curl_slist_free_all(conditions);
+
+  // Freshness of the response, the server's Cache-Control max-age
+  // takes precedence over Expires. Without metadata the store could
+  // not revalidate the image, and would only add it again.
+  double now = vtksys::SystemTools::GetTime();
+  if (!this->Store->SupportsMetadata())
+    {
+    request.ExpirationTime = VTK_DOUBLE_MAX;
+    }
+  else if (headers.MaxAge >= 0.0)
+    {
+    request.ExpirationTime = now + std::max(headers.MaxAge, minimumMaximumAge);
+    }
+  else if (headers.Expires >= 0.0)
+    {
+    request.ExpirationTime = std::max(headers.Expires,
+                                      now + minimumMaximumAge);
+    }
+  else
+    {
+    request.ExpirationTime = now + this->DefaultMaximumAge;
+    }
+
+  if (res == CURLE_OK)
+    {
+    // Only publish complete images. Servers and proxies may answer
+    // with error or login pages, and connections may close early.
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t contentLength = -1;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                      &contentLength);
+#else
+    double contentLength = -1.0;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &contentLength);
+#endif
+    if (code == 304 && request.Revalidate)
+      {
+      // The stored image is still valid, a new ETag or Last-Modified
+      // replaces the previous one
+      metadata.ExpirationTime = request.ExpirationTime;
+      if (!headers.ETag.empty())
+        {
+        metadata.ETag = headers.ETag;
+        }
+      if (!headers.LastModified.empty())
+        {
+        metadata.LastModified = headers.LastModified;
+        }
+      WriteRequest write;
+      write.Zoom = request.Zoom;
+      write.X = request.X;
+      write.Y = request.Y;
+      write.HasImage = false;
+      write.Metadata = metadata;
+      this->QueueWrite(write);
+      request.NotModified = true;
+      return DownloadSucceeded;
+      }
+
+    const unsigned char *image =
+      reinterpret_cast<const unsigned char*>(buffer.data());
+    if (code != 200 && code != 0) // 0 for urls other than http
+      {
+      vtkWarningMacro(<< "Failed to download " << request.Url
+                      << ": unexpected HTTP status " << code);
+      return DownloadFailed;
+      }
+    // The length is -1 when the server did not send it
+    if (contentLength >= 0 &&
+        static_cast<size_t>(contentLength) != buffer.size())
+      {
+      vtkWarningMacro(<< "Failed to download " << request.Url
+                      << " (attempt " << request.Attempts + 1 << "): "
+                      << "received " << buffer.size() << " of "
+                      << contentLength << " bytes");
+      return DownloadRetry;
+      }
+    if (!vtkMapTileStore::IsValidImage(image, buffer.size()))
+      {
+      vtkWarningMacro(<< "Failed to download " << request.Url
+                      << ": the response is not a complete PNG image");
+      return DownloadFailed;
+      }
+
+    // Decode from the response, so the tile is drawn without going
+    // through the store, and persist the image in the background
+    if (this->DecodeImages)
+      {
+      vtkSmartPointer<vtkImageData> decoded =
+        vtkMapTileDecoder::Decode(image, buffer.size());
+      if (!decoded)
+        {
+        vtkWarningMacro(<< "Failed to download " << request.Url
+                        << ": the image cannot be decoded");
+        return DownloadFailed;
+        }
+      vtkMapTileImageCache::GetInstance()->AddImage(request.Url, decoded);
+      }
+
+    WriteRequest write;
+    write.Zoom = request.Zoom;
+    write.X = request.X;
+    write.Y = request.Y;
+    write.HasImage = true;
+    write.Image.swap(buffer);
+    write.Metadata.ETag = headers.ETag;
+    write.Metadata.LastModified = headers.LastModified;
+    write.Metadata.ExpirationTime = request.ExpirationTime;
+    this->QueueWrite(write);
+    return DownloadSucceeded;
+    }
+
+  DownloadStatus status = DownloadFailed;
+  switch (res)
+    {
+    case CURLE_HTTP_RETURNED_ERROR:
+      {
+      long code = 0;
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+      if (code == 408 || code == 429 || code >= 500)
+        {
+        status = DownloadRetry;
+        }
+      }
+      break;
+
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+      status = DownloadRetry;
+      break;
+
+    case CURLE_ABORTED_BY_CALLBACK:
+      // Stop() was called, the server is not to blame
+      return DownloadAborted;
+
+    default:
+      break;
+    }
+
+  vtkWarningMacro(<< "Failed to download " << request.Url
+                  << " (attempt " << request.Attempts + 1 << "): "
+                  << errorBuffer);
+  return status;
+}
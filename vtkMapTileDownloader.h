@@ -0,0 +1,277 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapTileDownloader - background download of map tile images
+// .SECTION Description
+// vtkMapTileDownloader owns a bounded pool of worker threads that fetch
+// tile images into a vtkMapTileStore. Requests are queued from the
+// render thread and never block it; finished requests are collected, also
+// on the render thread, with GetCompletedRequests().
+//
+// Downloaded images are decoded in memory right away and added to the
+// vtkMapTileImageCache under their url, so they can be drawn when the
+// request completes. Writing them to the store is left to a separate
+// write-behind thread; a tile stays pending until it is written.
+//
+// Each worker keeps its libcurl handle for its whole lifetime, and all
+// workers share one DNS, TLS session and connection cache, so connections
+// to the tile server stay open and are reused across requests.
+//
+// Transient failures (timeouts, connection errors, HTTP 408, 429 and 5xx)
+// are retried a bounded number of times with capped exponential backoff.
+// Other failures, such as HTTP 404, are reported right away.
+//
+// Queued requests are served lowest Priority first. A caller that
+// re-requests its whole working set between BeginRequests() and
+// EndRequests() gets requests it did not renew cancelled, so work for
+// tiles that scrolled out of view does not delay the visible ones.
+
+#ifndef __vtkMapTileDownloader_h
+#define __vtkMapTileDownloader_h
+
+// VTK Includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+#include <vtkType.h>
+#include "vtkmap_export.h"
+#include "vtkMapTileStore.h"
+
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+class vtkConditionVariable;
+class vtkMutexLock;
+
+class VTKMAP_EXPORT vtkMapTileDownloader : public vtkObject
+{
+public:
+  static vtkMapTileDownloader *New();
+  virtual void PrintSelf(ostream &os, vtkIndent indent);
+  vtkTypeMacro(vtkMapTileDownloader, vtkObject)
+
+  // Description:
+  // A single tile download, identified by its zoom level and x/y index.
+  // Revalidate requests refresh a tile already in the store with a
+  // conditional GET. NotModified is set when the server confirmed the
+  // stored image, and ExpirationTime to the time in seconds since the
+  // epoch after which the downloaded image must be revalidated.
+  class Request
+  {
+  public:
+    int Zoom;
+    int X;
+    int Y;
+    std::string Url;
+    bool Succeeded;
+    int Attempts;
+    double RetryTime;
+    double Priority;
+    int Generation;
+    bool Revalidate;
+    bool NotModified;
+    double ExpirationTime;
+  };
+
+  // Description:
+  // Get/Set the number of worker threads, default is 4.
+  // Must be set before the first request is queued.
+  vtkSetClampMacro(NumberOfThreads, int, 1, 16)
+  vtkGetMacro(NumberOfThreads, int)
+
+  // Description:
+  // Get/Set the store downloaded images are written to.
+  // Must be set before the first request is queued.
+  virtual void SetStore(vtkMapTileStore *store);
+  vtkGetObjectMacro(Store, vtkMapTileStore)
+
+  // Description:
+  // Queue download of the image at url into the store. Requests with a
+  // lower priority value are downloaded first. Requesting a tile that is
+  // already queued only updates its priority. With revalidate, the image
+  // is only downloaded if it differs from the one in the store.
+  void RequestTile(int zoom, int x, int y, const std::string& url,
+                   double priority = 0.0, bool revalidate = false);
+
+  // Description:
+  // Bracket a pass that re-requests every tile still wanted. EndRequests()
+  // cancels queued requests and pending retries that were not renewed
+  // since BeginRequests(); downloads in progress are left to finish.
+  // Returns the number of cancelled requests.
+  void BeginRequests();
+  int EndRequests();
+
+  // Description:
+  // Returns true if the tile is queued, being downloaded, or
+  // waiting to be written to the store
+  bool IsPending(int zoom, int x, int y);
+
+  // Description:
+  // Returns the number of tiles queued, being downloaded, or
+  // waiting to be written to the store
+  int GetNumberOfPendingRequests();
+
+  // Description:
+  // Returns the number of downloaded tiles not written to the store yet
+  int GetNumberOfPendingWrites();
+
+  // Description:
+  // Returns true if finished requests are waiting to be collected
+  bool HasCompletedRequests();
+
+  // Description:
+  // Append finished requests to completed and clear the internal list
+  void GetCompletedRequests(std::vector<Request>& completed);
+
+  // Description:
+  // Get/Set the number of times a transient failure is retried, default 3
+  vtkSetClampMacro(MaximumNumberOfRetries, int, 0, 100)
+  vtkGetMacro(MaximumNumberOfRetries, int)
+
+  // Description:
+  // Get/Set the delay in seconds before the first retry, default 0.5.
+  // The delay doubles with each further retry, up to MaximumRetryDelay.
+  vtkSetClampMacro(RetryDelay, double, 0.0, 3600.0)
+  vtkGetMacro(RetryDelay, double)
+
+  // Description:
+  // Get/Set the upper bound in seconds on the retry delay, default 30
+  vtkSetClampMacro(MaximumRetryDelay, double, 0.0, 3600.0)
+  vtkGetMacro(MaximumRetryDelay, double)
+
+  // Description:
+  // Get/Set the time in seconds images stay fresh when the server does
+  // not send Cache-Control or Expires headers, default is 7 days
+  vtkSetClampMacro(DefaultMaximumAge, double, 0.0, 1.0e9)
+  vtkGetMacro(DefaultMaximumAge, double)
+
+  // Description:
+  // Get/Set the maximum number of requests sent per second, retries
+  // included, or 0 for no limit, the default
+  vtkSetClampMacro(MaximumRequestRate, double, 0.0, 1.0e6)
+  vtkGetMacro(MaximumRequestRate, double)
+
+  // Description:
+  // Get/Set whether downloaded images are decoded into the image cache
+  // so that tiles are drawn without reading them back from the store,
+  // default is on. Tools that only fill the store turn this off.
+  vtkSetMacro(DecodeImages, bool)
+  vtkGetMacro(DecodeImages, bool)
+  vtkBooleanMacro(DecodeImages, bool)
+
+  // Description:
+  // Get/Set the user agent sent with each request, default is "vtkMap"
+  vtkSetStringMacro(UserAgent)
+  vtkGetStringMacro(UserAgent)
+
+  // Description:
+  // Discard queued requests and stop the worker threads.
+  // Downloads in progress are aborted, and the connections closed.
+  // Downloaded tiles are still written to the store.
+  void Stop();
+
+  // Description:
+  // Returns whether Stop() is in progress. Used by the worker threads
+  // to abort their transfers, must not be called with Lock held.
+  bool IsStopping();
+
+protected:
+  vtkMapTileDownloader();
+  ~vtkMapTileDownloader();
+
+  void StartThreads();
+  void RunWorker();
+  void RunWriter();
+
+  // Description:
+  // A downloaded image, or only the metadata of a revalidated one,
+  // waiting to be written to the store
+  class WriteRequest
+  {
+  public:
+    int Zoom;
+    int X;
+    int Y;
+    bool HasImage;
+    std::string Image;
+    vtkMapTileStore::TileMetadata Metadata;
+  };
+
+  // Description:
+  // Queue a write for the writer thread
+  void QueueWrite(WriteRequest& write);
+
+  // Description:
+  // Write to the store. Must be called without Lock held.
+  void PerformWrite(const WriteRequest& write);
+
+  // Description:
+  // Move retries whose delay has expired back to the queue.
+  // Must be called with Lock held.
+  void QueueDueRetries();
+
+  enum DownloadStatus
+    {
+    DownloadSucceeded = 0,
+    DownloadFailed,
+    DownloadRetry,
+    DownloadAborted
+    };
+
+  // Description:
+  // Download using the worker's persistent libcurl handle
+  DownloadStatus DownloadImage(void *curl, Request& request);
+
+  static VTK_THREAD_RETURN_TYPE WorkerMain(void *arg);
+  static VTK_THREAD_RETURN_TYPE WriterMain(void *arg);
+
+  int NumberOfThreads;
+  int MaximumNumberOfRetries;
+  double RetryDelay;
+  double MaximumRetryDelay;
+  double DefaultMaximumAge;
+  double MaximumRequestRate;
+  bool DecodeImages;
+  char *UserAgent;
+  vtkMapTileStore *Store;
+
+  // Description:
+  // libcurl state shared by the workers
+  class vtkInternal;
+  vtkInternal *Impl;
+
+  vtkMultiThreader *Threader;
+  std::vector<int> ThreadIds;
+
+  // Description:
+  // State shared with the worker threads, guarded by Lock
+  vtkMutexLock *Lock;
+  vtkConditionVariable *QueueCondition;
+  vtkConditionVariable *WriteCondition;
+  std::deque<WriteRequest> Writes;
+  std::multiset<vtkTypeUInt64> PendingWrites;
+  std::vector<Request> Queue;
+  std::vector<Request> Retries;
+  std::set<vtkTypeUInt64> PendingTiles;
+  std::vector<Request> Completed;
+  bool Stopping;
+  int Generation;
+  double NextRequestTime;  // earliest start of the next request
+
+private:
+  vtkMapTileDownloader(const vtkMapTileDownloader&);  // Not implemented
+  void operator=(const vtkMapTileDownloader&); // Not implemented
+};
+
+#endif // __vtkMapTileDownloader_h
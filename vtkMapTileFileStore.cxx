@@ -0,0 +1,321 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileFileStore.h"
+#include "vtkMapTileCache.h"
+
+// VTK Includes
+#include <vtkObjectFactory.h>
+#include <vtksys/Directory.hxx>
+#include <vtksys/SystemTools.hxx>
+
+#include <cstdio>  // for rename() and remove()
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+vtkStandardNewMacro(vtkMapTileFileStore)
+
+//----------------------------------------------------------------------------
+namespace
+{
+  const char *metadataHeader = "vtkMapTileMetadata 1";
+
+  // Write a temporary file next to fileName and rename it, which
+  // replaces the file in one step. The downloader has at most one
+  // request per tile, so the temporary name is not shared. Temporary
+  // files left by a crash are removed by the cache when it starts.
+  bool replaceFile(const std::string& fileName, const char *data,
+                   size_t length)
+  {
+    std::string tempName = fileName + ".tmp";
+    FILE *fp = fopen(tempName.c_str(), "wb");
+    if (!fp)
+      {
+      // First tile of its directory
+      vtksys::SystemTools::MakeDirectory(
+        vtksys::SystemTools::GetFilenamePath(fileName).c_str());
+      fp = fopen(tempName.c_str(), "wb");
+      }
+    if (!fp)
+      {
+      return false;
+      }
+
+    bool written = fwrite(data, 1, length, fp) == length;
+    written = fclose(fp) == 0 && written;
+#ifdef _WIN32
+    // rename() does not replace existing files on Windows
+    if (written)
+      {
+      remove(fileName.c_str());
+      }
+#endif
+    if (!written || rename(tempName.c_str(), fileName.c_str()) != 0)
+      {
+      remove(tempName.c_str());
+      return false;
+      }
+    return true;
+  }
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileFileStore::vtkMapTileFileStore()
+{
+  this->Cache = vtkMapTileCache::New();
+  this->VerifyChecksums = true;
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileFileStore::~vtkMapTileFileStore()
+{
+  // Saves the cache index
+  this->Cache->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileFileStore::PrintSelf(ostream &os, vtkIndent indent)
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Directory: " << this->Directory << "\n"
+     << indent << "VerifyChecksums: " << this->VerifyChecksums << "\n"
+     << indent << "Cache:" << "\n";
+  this->Cache->PrintSelf(os, indent.GetNextIndent());
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileFileStore::Open(const std::string& directory)
+{
+  if (!vtksys::SystemTools::FileIsDirectory(directory.c_str()) &&
+      !vtksys::SystemTools::MakeDirectory(directory.c_str()))
+    {
+    vtkErrorMacro("Cannot create tile directory " << directory);
+    return false;
+    }
+
+  this->Directory = directory;
+  this->Cache->SetDirectory(directory);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileFileStore::HasTile(int zoom, int x, int y)
+{
+  return vtksys::SystemTools::FileExists(
+    this->GetTileFileName(zoom, x, y).c_str());
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileFileStore::WriteTile(int zoom, int x, int y,
+                                    const char *data, size_t length)
+{
+  // The new file and its checksum are replaced together, see ReadTile().
+  // Writes of other tiles proceed meanwhile.
+  vtkTypeUInt32 checksum = vtkMapTileStore::ComputeChecksum(
+    reinterpret_cast<const unsigned char*>(data), length);
+  std::string key = this->GetTileKey(zoom, x, y);
+  this->Cache->LockTile(key);
+  bool written =
+    replaceFile(this->GetTileFileName(zoom, x, y), data, length);
+  if (written)
+    {
+    // The sidecar of the previous image counts until it is replaced
+    std::string metadataFileName = this->GetMetadataFileName(zoom, x, y);
+    vtkTypeInt64 size = static_cast<vtkTypeInt64>(length);
+    if (vtksys::SystemTools::FileExists(metadataFileName.c_str()))
+      {
+      size += static_cast<vtkTypeInt64>(
+        vtksys::SystemTools::FileLength(metadataFileName.c_str()));
+      }
+    this->Cache->AddTile(key, size, checksum);
+    }
+  this->Cache->UnlockTile(key);
+  return written;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileFileStore::ReadTile(int zoom, int x, int y, TileData& data)
+{
+  if (!this->ReadTileFile(zoom, x, y, data))
+    {
+    return false;
+    }
+
+  // Drop corrupted tiles, HasTile() is false afterwards so the tile is
+  // downloaded again. The file may have been replaced after it was read
+  // and before its new checksum was recorded, so check again with no
+  // tile being written before removing it.
+  std::string key = this->GetTileKey(zoom, x, y);
+  if (this->IsCorruptedTile(key, data))
+    {
+    this->Cache->LockTile(key);
+    bool read = this->ReadTileFile(zoom, x, y, data);
+    bool corrupted = read && this->IsCorruptedTile(key, data);
+    if (corrupted)
+      {
+      vtkWarningMacro("Removing corrupted tile " << key << " from cache");
+      this->Cache->RemoveTile(key);
+      }
+    this->Cache->UnlockTile(key);
+    if (!read || corrupted)
+      {
+      data.Storage.clear();
+      return false;
+      }
+    }
+
+  data.Data = &data.Storage[0];
+  data.Length = data.Storage.size();
+  this->Cache->TouchTile(key);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileFileStore::ReadTileFile(int zoom, int x, int y,
+                                       TileData& data)
+{
+  std::ifstream in(this->GetTileFileName(zoom, x, y).c_str(),
+                   std::ios::in | std::ios::binary);
+  if (!in)
+    {
+    return false;
+    }
+
+  in.seekg(0, std::ios::end);
+  std::streamoff length = in.tellg();
+  in.seekg(0, std::ios::beg);
+  if (length <= 0)
+    {
+    return false;
+    }
+
+  data.Storage.resize(static_cast<size_t>(length));
+  in.read(reinterpret_cast<char*>(&data.Storage[0]), length);
+  return !in.fail();
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileFileStore::IsCorruptedTile(const std::string& key,
+                                          const TileData& data)
+{
+  vtkTypeUInt32 checksum;
+  return
+    !vtkMapTileStore::IsValidImage(&data.Storage[0], data.Storage.size()) ||
+    (this->VerifyChecksums &&
+     this->Cache->GetTileChecksum(key, checksum) &&
+     checksum != vtkMapTileStore::ComputeChecksum(&data.Storage[0],
+                                                  data.Storage.size()));
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileFileStore::TouchTile(int zoom, int x, int y)
+{
+  this->Cache->TouchTile(this->GetTileKey(zoom, x, y));
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileFileStore::SupportsMetadata()
+{
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileFileStore::GetTileMetadata(int zoom, int x, int y,
+                                          TileMetadata& metadata)
+{
+  std::ifstream in(this->GetMetadataFileName(zoom, x, y).c_str());
+  std::string line;
+  if (!in || !std::getline(in, line) || line != metadataHeader)
+    {
+    return false;
+    }
+
+  metadata = TileMetadata();
+  while (std::getline(in, line))
+    {
+    size_t space = line.find(' ');
+    std::string name = line.substr(0, space);
+    std::string value =
+      space == std::string::npos ? std::string() : line.substr(space + 1);
+    if (name == "expires")
+      {
+      metadata.ExpirationTime = atof(value.c_str());
+      }
+    else if (name == "etag")
+      {
+      metadata.ETag = value;
+      }
+    else if (name == "last-modified")
+      {
+      metadata.LastModified = value;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileFileStore::SetTileMetadata(int zoom, int x, int y,
+                                          const TileMetadata& metadata)
+{
+  std::ostringstream out;
+  out.precision(15);
+  out << metadataHeader << "\n"
+      << "expires " << metadata.ExpirationTime << "\n";
+  if (!metadata.ETag.empty())
+    {
+    out << "etag " << metadata.ETag << "\n";
+    }
+  if (!metadata.LastModified.empty())
+    {
+    out << "last-modified " << metadata.LastModified << "\n";
+    }
+
+  // Count the sidecar against the budget of the cache, with the image
+  std::string text = out.str();
+  std::string key = this->GetTileKey(zoom, x, y);
+  this->Cache->LockTile(key);
+  bool written = replaceFile(this->GetMetadataFileName(zoom, x, y),
+                             text.data(), text.size());
+  std::string fileName = this->GetTileFileName(zoom, x, y);
+  if (written && vtksys::SystemTools::FileExists(fileName.c_str()))
+    {
+    this->Cache->SetTileSize(
+      key, static_cast<vtkTypeInt64>(
+        vtksys::SystemTools::FileLength(fileName.c_str()) + text.size()));
+    }
+  this->Cache->UnlockTile(key);
+  return written;
+}
+
+//----------------------------------------------------------------------------
+std::string vtkMapTileFileStore::GetTileKey(int zoom, int x, int y)
+{
+  // zoom/x/y, with rows counted from the north like the tile server
+  std::ostringstream oss;
+  oss << zoom << "/" << x << "/" << ((1 << zoom) - 1 - y);
+  return oss.str();
+}
+
+//----------------------------------------------------------------------------
+std::string vtkMapTileFileStore::GetTileFileName(int zoom, int x, int y)
+{
+  return this->Directory + "/" + this->GetTileKey(zoom, x, y) + ".png";
+}
+
+//----------------------------------------------------------------------------
+std::string vtkMapTileFileStore::GetMetadataFileName(int zoom, int x, int y)
+{
+  return this->Directory + "/" + this->GetTileKey(zoom, x, y) + ".meta";
+}
@@ -0,0 +1,105 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapTileFileStore - tile images stored as one file per tile
+// .SECTION Description
+// vtkMapTileFileStore keeps each tile image in its own file, as
+// <zoom>/<x>/<y>.png with rows counted from the north like the tile
+// server. The size of the directory is bounded by a vtkMapTileCache.
+// This is the default store of vtkOsmLayer.
+//
+// Tiles are written to a temporary file which is then renamed, so a
+// crash never leaves a partial image under a tile's name. The checksum
+// of each tile is kept in the cache index, and tiles whose file no
+// longer matches it, or is not a valid image, are removed when read
+// so that they are downloaded again.
+//
+// The HTTP cache metadata of a tile is kept in a sidecar file next to
+// its image, <zoom>/<x>/<y>.meta. Tiles cached without one are never
+// revalidated.
+
+#ifndef __vtkMapTileFileStore_h
+#define __vtkMapTileFileStore_h
+
+#include "vtkMapTileStore.h"
+#include "vtkmap_export.h"
+
+class vtkMapTileCache;
+
+class VTKMAP_EXPORT vtkMapTileFileStore : public vtkMapTileStore
+{
+public:
+  static vtkMapTileFileStore *New();
+  virtual void PrintSelf(ostream &os, vtkIndent indent);
+  vtkTypeMacro(vtkMapTileFileStore, vtkMapTileStore)
+
+  // Description:
+  // The manager of the cache directory, which sets its size budget
+  vtkGetObjectMacro(Cache, vtkMapTileCache)
+
+  // Description:
+  // Get/Set whether tiles are checked against their checksum when
+  // read, default is on
+  vtkSetMacro(VerifyChecksums, bool)
+  vtkGetMacro(VerifyChecksums, bool)
+  vtkBooleanMacro(VerifyChecksums, bool)
+
+  // Description:
+  // Returns the file of a tile
+  std::string GetTileFileName(int zoom, int x, int y);
+
+  // Description:
+  // Implement vtkMapTileStore
+  virtual bool Open(const std::string& directory);
+  virtual bool HasTile(int zoom, int x, int y);
+  virtual bool WriteTile(int zoom, int x, int y,
+                         const char *data, size_t length);
+  virtual bool ReadTile(int zoom, int x, int y, TileData& data);
+  virtual void TouchTile(int zoom, int x, int y);
+  virtual bool SupportsMetadata();
+  virtual bool GetTileMetadata(int zoom, int x, int y,
+                               TileMetadata& metadata);
+  virtual bool SetTileMetadata(int zoom, int x, int y,
+                               const TileMetadata& metadata);
+
+protected:
+  vtkMapTileFileStore();
+  ~vtkMapTileFileStore();
+
+  // Description:
+  // Key of a tile in the cache, its file name without extension
+  std::string GetTileKey(int zoom, int x, int y);
+
+  // Description:
+  // Returns the sidecar file holding the HTTP metadata of a tile
+  std::string GetMetadataFileName(int zoom, int x, int y);
+
+  // Description:
+  // Read the file of a tile into data.Storage
+  bool ReadTileFile(int zoom, int x, int y, TileData& data);
+
+  // Description:
+  // Returns true if the data read for a tile is not a valid image, or
+  // does not match the checksum recorded for the tile
+  bool IsCorruptedTile(const std::string& key, const TileData& data);
+
+  std::string Directory;
+  vtkMapTileCache *Cache;
+  bool VerifyChecksums;
+
+private:
+  vtkMapTileFileStore(const vtkMapTileFileStore&);  // Not implemented
+  void operator=(const vtkMapTileFileStore&); // Not implemented
+};
+
+#endif // __vtkMapTileFileStore_h
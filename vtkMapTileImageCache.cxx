@@ -0,0 +1,242 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileImageCache.h"
+
+// VTK Includes
+#include <vtkImageData.h>
+#include <vtkMutexLock.h>
+#include <vtkObjectFactory.h>
+
+vtkStandardNewMacro(vtkMapTileImageCache)
+
+//----------------------------------------------------------------------------
+namespace
+{
+  // The shared cache, created on first use and deleted at exit
+  vtkSimpleMutexLock instanceLock;
+  vtkMapTileImageCache *instance = NULL;
+
+  struct InstanceCleanup
+  {
+    ~InstanceCleanup()
+    {
+      if (instance)
+        {
+        instance->Delete();
+        instance = NULL;
+        }
+    }
+  };
+  InstanceCleanup instanceCleanup;
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileImageCache::vtkMapTileImageCache()
+{
+  this->MaximumSize = 256;
+  this->Lock = vtkMutexLock::New();
+  this->Size = 0;
+  this->NumberOfHits = 0;
+  this->NumberOfMisses = 0;
+  this->NumberOfEvictions = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileImageCache::~vtkMapTileImageCache()
+{
+  this->Lock->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileImageCache::PrintSelf(ostream &os, vtkIndent indent)
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "MaximumSize: " << this->MaximumSize << " MB\n"
+     << indent << "Size: " << this->GetSize() << " bytes\n"
+     << indent << "NumberOfImages: " << this->GetNumberOfImages() << "\n"
+     << indent << "NumberOfHits: " << this->GetNumberOfHits() << "\n"
+     << indent << "NumberOfMisses: " << this->GetNumberOfMisses() << "\n"
+     << indent << "NumberOfEvictions: " << this->GetNumberOfEvictions()
+     << std::endl;
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileImageCache *vtkMapTileImageCache::GetInstance()
+{
+  instanceLock.Lock();
+  if (!instance)
+    {
+    instance = vtkMapTileImageCache::New();
+    }
+  instanceLock.Unlock();
+  return instance;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileImageCache::SetMaximumSize(int megabytes)
+{
+  megabytes = megabytes < 1 ? 1 : (megabytes > 65536 ? 65536 : megabytes);
+  this->Lock->Lock();
+  bool changed = megabytes != this->MaximumSize;
+  this->MaximumSize = megabytes;
+  this->Trim();
+  this->Lock->Unlock();
+  if (changed)
+    {
+    this->Modified();
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkImageData>
+vtkMapTileImageCache::GetImage(const std::string& key)
+{
+  vtkSmartPointer<vtkImageData> image;
+  this->Lock->Lock();
+  std::map<std::string, ImageEntry>::iterator iter = this->Images.find(key);
+  if (iter != this->Images.end())
+    {
+    this->Order.splice(this->Order.begin(), this->Order,
+                       iter->second.Position);
+    image = iter->second.Image;
+    ++this->NumberOfHits;
+    }
+  else
+    {
+    ++this->NumberOfMisses;
+    }
+  this->Lock->Unlock();
+  return image;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileImageCache::HasImage(const std::string& key)
+{
+  this->Lock->Lock();
+  bool found = this->Images.find(key) != this->Images.end();
+  this->Lock->Unlock();
+  return found;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileImageCache::AddImage(const std::string& key,
+                                    vtkImageData *image)
+{
+  if (!image)
+    {
+    return;
+    }
+
+  this->Lock->Lock();
+  this->Erase(key);
+  this->Order.push_front(key);
+  ImageEntry& entry = this->Images[key];
+  entry.Image = image;
+  entry.Size = static_cast<vtkTypeInt64>(image->GetActualMemorySize()) * 1024;
+  entry.Position = this->Order.begin();
+  this->Size += entry.Size;
+  this->Trim();
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileImageCache::RemoveAllImages()
+{
+  this->Lock->Lock();
+  this->Images.clear();
+  this->Order.clear();
+  this->Size = 0;
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkMapTileImageCache::GetSize()
+{
+  this->Lock->Lock();
+  vtkTypeInt64 size = this->Size;
+  this->Lock->Unlock();
+  return size;
+}
+
+//----------------------------------------------------------------------------
+int vtkMapTileImageCache::GetNumberOfImages()
+{
+  this->Lock->Lock();
+  int count = static_cast<int>(this->Images.size());
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkMapTileImageCache::GetNumberOfHits()
+{
+  this->Lock->Lock();
+  vtkTypeInt64 count = this->NumberOfHits;
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkMapTileImageCache::GetNumberOfMisses()
+{
+  this->Lock->Lock();
+  vtkTypeInt64 count = this->NumberOfMisses;
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkMapTileImageCache::GetNumberOfEvictions()
+{
+  this->Lock->Lock();
+  vtkTypeInt64 count = this->NumberOfEvictions;
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileImageCache::ResetCounters()
+{
+  this->Lock->Lock();
+  this->NumberOfHits = 0;
+  this->NumberOfMisses = 0;
+  this->NumberOfEvictions = 0;
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileImageCache::Trim()
+{
+  vtkTypeInt64 budget = this->MaximumSize * vtkTypeInt64(1048576);
+  while (this->Size > budget && !this->Order.empty())
+    {
+    std::string key = this->Order.back();
+    this->Erase(key);
+    ++this->NumberOfEvictions;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileImageCache::Erase(const std::string& key)
+{
+  std::map<std::string, ImageEntry>::iterator iter = this->Images.find(key);
+  if (iter == this->Images.end())
+    {
+    return;
+    }
+  this->Size -= iter->second.Size;
+  this->Order.erase(iter->second.Position);
+  this->Images.erase(iter);
+}
@@ -0,0 +1,128 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapTileImageCache - process wide cache of decoded tile images
+// .SECTION Description
+// vtkMapTileImageCache keeps decoded tile images in memory so that the
+// tiles of every vtkOsmLayer and vtkMap in the process that show the
+// same image share one decoded copy. Images are identified by their
+// key, the url of the tile image, which names both the tile server and
+// the zoom level and x/y index of the tile. Once the images exceed the
+// byte budget, the least recently used ones are dropped from the cache;
+// tiles still drawing them keep their reference.
+//
+// The cache is thread safe. Images in the cache are shared, and must
+// not be modified.
+
+#ifndef __vtkMapTileImageCache_h
+#define __vtkMapTileImageCache_h
+
+// VTK Includes
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+#include "vtkmap_export.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+class vtkImageData;
+class vtkMutexLock;
+
+class VTKMAP_EXPORT vtkMapTileImageCache : public vtkObject
+{
+public:
+  virtual void PrintSelf(ostream &os, vtkIndent indent);
+  vtkTypeMacro(vtkMapTileImageCache, vtkObject)
+
+  // Description:
+  // Returns the cache shared by the process
+  static vtkMapTileImageCache *GetInstance();
+
+  // Description:
+  // Get/Set the budget of the cache in megabytes, default is 256
+  void SetMaximumSize(int megabytes);
+  vtkGetMacro(MaximumSize, int)
+
+  // Description:
+  // Returns the image with the given key, or NULL if it is not cached.
+  // Counts a hit or a miss.
+  vtkSmartPointer<vtkImageData> GetImage(const std::string& key);
+
+  // Description:
+  // Returns true if the image with the given key is cached, without
+  // counting a lookup or marking the image as used
+  bool HasImage(const std::string& key);
+
+  // Description:
+  // Add an image to the cache, replacing any image with the same key
+  void AddImage(const std::string& key, vtkImageData *image);
+
+  // Description:
+  // Drop all images
+  void RemoveAllImages();
+
+  // Description:
+  // Returns the size in bytes, and the number, of cached images
+  vtkTypeInt64 GetSize();
+  int GetNumberOfImages();
+
+  // Description:
+  // Returns the number of lookups that found their image, that did not,
+  // and of images dropped to stay within the budget
+  vtkTypeInt64 GetNumberOfHits();
+  vtkTypeInt64 GetNumberOfMisses();
+  vtkTypeInt64 GetNumberOfEvictions();
+  void ResetCounters();
+
+protected:
+  vtkMapTileImageCache();
+  ~vtkMapTileImageCache();
+
+  static vtkMapTileImageCache *New();
+
+  // Description:
+  // Drop least recently used images until the cache fits its budget.
+  // Must be called with Lock held.
+  void Trim();
+
+  // Description:
+  // Drop an image. Must be called with Lock held.
+  void Erase(const std::string& key);
+
+  int MaximumSize;
+
+  // Description:
+  // Cache state, guarded by Lock. Order holds the keys from
+  // most to least recently used.
+  struct ImageEntry
+  {
+    vtkSmartPointer<vtkImageData> Image;
+    vtkTypeInt64 Size;
+    std::list<std::string>::iterator Position;
+  };
+  vtkMutexLock *Lock;
+  std::list<std::string> Order;
+  std::map<std::string, ImageEntry> Images;
+  vtkTypeInt64 Size;
+  vtkTypeInt64 NumberOfHits;
+  vtkTypeInt64 NumberOfMisses;
+  vtkTypeInt64 NumberOfEvictions;
+
+private:
+  vtkMapTileImageCache(const vtkMapTileImageCache&);  // Not implemented
+  void operator=(const vtkMapTileImageCache&); // Not implemented
+};
+
+#endif // __vtkMapTileImageCache_h
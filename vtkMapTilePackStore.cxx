@@ -0,0 +1,479 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTilePackStore.h"
+#include "vtkMapTile.h"
+
+// VTK Includes
+#include <vtkMutexLock.h>
+#include <vtkObjectFactory.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <cstdio>  // for rename()
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+vtkStandardNewMacro(vtkMapTilePackStore)
+
+//----------------------------------------------------------------------------
+namespace
+{
+  const char indexMagic[8] = { 'v', 't', 'k', 'M', 'a', 'p', 'P', '1' };
+
+  // Layout of tiles.pack.idx: a header followed by Capacity slots,
+  // an open addressing hash table with linear probing
+  struct IndexHeader
+  {
+    char Magic[8];
+    vtkTypeUInt64 Capacity;
+    vtkTypeUInt64 Count;
+    // Bytes of the pack file covered by the index
+    vtkTypeUInt64 PackSize;
+  };
+
+  struct IndexSlot
+  {
+    // Tile id plus one, zero marks an empty slot
+    vtkTypeUInt64 Key;
+    vtkTypeUInt64 Offset;
+    vtkTypeUInt64 Length;
+  };
+
+  // Each image in tiles.pack is preceded by this header
+  struct RecordHeader
+  {
+    vtkTypeUInt64 Id;
+    vtkTypeUInt64 Length;
+  };
+
+  const vtkTypeUInt64 initialCapacity = 1 << 16;
+  const vtkTypeUInt64 maximumTileLength = 16 << 20;
+
+  // Finalizer of MurmurHash3, spreads the packed zoom/x/y bits
+  vtkTypeUInt64 hashTileId(vtkTypeUInt64 id)
+  {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    id *= 0xc4ceb9fe1a85ec53ULL;
+    id ^= id >> 33;
+    return id;
+  }
+}
+
+//----------------------------------------------------------------------------
+class vtkMapTilePackStore::vtkInternal
+{
+public:
+  vtkInternal()
+    : PackFd(-1), IndexFd(-1), Pack(NULL), PackReserve(0),
+      Index(NULL), IndexMapSize(0)
+  {
+  }
+
+  IndexSlot *GetSlots()
+  {
+    return reinterpret_cast<IndexSlot*>(this->Index + 1);
+  }
+
+  // Returns the slot of id, or the empty slot where it would go
+  IndexSlot *Find(vtkTypeUInt64 id)
+  {
+    vtkTypeUInt64 mask = this->Index->Capacity - 1;
+    IndexSlot *slots = this->GetSlots();
+    for (vtkTypeUInt64 i = hashTileId(id) & mask; ; i = (i + 1) & mask)
+      {
+      if (slots[i].Key == id + 1 || slots[i].Key == 0)
+        {
+        return &slots[i];
+        }
+      }
+  }
+
+  bool MapIndex(vtkTypeUInt64 capacity, bool create);
+  bool GrowIndex();
+  bool Insert(vtkTypeUInt64 id, vtkTypeUInt64 offset, vtkTypeUInt64 length);
+  void Recover(vtkTypeUInt64 fileSize);
+
+  // Guards the index, readers of the pack need no lock since the
+  // pack mapping never moves and records are never overwritten
+  vtkSimpleMutexLock Lock;
+  std::string Directory;
+  std::string IndexName;
+  int PackFd;
+  int IndexFd;
+  unsigned char *Pack;
+  size_t PackReserve;
+  IndexHeader *Index;
+  size_t IndexMapSize;
+};
+
+#ifndef _WIN32
+//----------------------------------------------------------------------------
+bool vtkMapTilePackStore::vtkInternal::MapIndex(vtkTypeUInt64 capacity,
+                                                 bool create)
+{
+  if (this->Index)
+    {
+    munmap(this->Index, this->IndexMapSize);
+    this->Index = NULL;
+    }
+
+  size_t size = sizeof(IndexHeader) +
+    static_cast<size_t>(capacity) * sizeof(IndexSlot);
+  if (create && ftruncate(this->IndexFd, 0) != 0)
+    {
+    return false;
+    }
+  // Growing the file fills the new slots with zeros, marking them empty
+  if (ftruncate(this->IndexFd, static_cast<off_t>(size)) != 0)
+    {
+    return false;
+    }
+
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   this->IndexFd, 0);
+  if (map == MAP_FAILED)
+    {
+    return false;
+    }
+  this->Index = static_cast<IndexHeader*>(map);
+  this->IndexMapSize = size;
+
+  if (create)
+    {
+    memcpy(this->Index->Magic, indexMagic, sizeof(indexMagic));
+    this->Index->Capacity = capacity;
+    this->Index->Count = 0;
+    this->Index->PackSize = 0;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTilePackStore::vtkInternal::GrowIndex()
+{
+  // Build the index of twice the capacity in a temporary file and
+  // rename it over the index, so that a crash leaves either the old
+  // or the new index, never one partly rehashed
+  std::string tempName = this->IndexName + ".tmp";
+  int fd = open(tempName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    {
+    return false;
+    }
+
+  IndexHeader *oldIndex = this->Index;
+  IndexSlot *oldSlots = this->GetSlots();
+  size_t oldMapSize = this->IndexMapSize;
+  int oldFd = this->IndexFd;
+  this->Index = NULL;
+  this->IndexFd = fd;
+  bool grown = this->MapIndex(2 * oldIndex->Capacity, true);
+  if (grown)
+    {
+    this->Index->PackSize = oldIndex->PackSize;
+    for (vtkTypeUInt64 i = 0; i < oldIndex->Capacity; ++i)
+      {
+      if (oldSlots[i].Key != 0)
+        {
+        *this->Find(oldSlots[i].Key - 1) = oldSlots[i];
+        }
+      }
+    this->Index->Count = oldIndex->Count;
+    grown = msync(this->Index, this->IndexMapSize, MS_SYNC) == 0 &&
+      rename(tempName.c_str(), this->IndexName.c_str()) == 0;
+    }
+
+  if (!grown)
+    {
+    if (this->Index)
+      {
+      munmap(this->Index, this->IndexMapSize);
+      }
+    close(fd);
+    unlink(tempName.c_str());
+    this->Index = oldIndex;
+    this->IndexMapSize = oldMapSize;
+    this->IndexFd = oldFd;
+    return false;
+    }
+  munmap(oldIndex, oldMapSize);
+  close(oldFd);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTilePackStore::vtkInternal::Insert(vtkTypeUInt64 id,
+                                              vtkTypeUInt64 offset,
+                                              vtkTypeUInt64 length)
+{
+  // Keep the load factor at most one half so that probes stay short
+  if ((this->Index->Count + 1) * 2 > this->Index->Capacity &&
+      !this->GrowIndex())
+    {
+    return false;
+    }
+
+  IndexSlot *slot = this->Find(id);
+  if (slot->Key == 0)
+    {
+    slot->Key = id + 1;
+    ++this->Index->Count;
+    }
+  slot->Offset = offset;
+  slot->Length = length;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTilePackStore::vtkInternal::Recover(vtkTypeUInt64 fileSize)
+{
+  // Index the records appended after the index was last updated.
+  // A record cut short by a crash ends the scan, the next tile
+  // written overwrites it.
+  vtkTypeUInt64 offset = this->Index->PackSize;
+  while (offset + sizeof(RecordHeader) <= fileSize)
+    {
+    RecordHeader header;
+    memcpy(&header, this->Pack + offset, sizeof(header));
+    vtkTypeUInt64 end = offset + sizeof(header) + header.Length;
+    if (header.Length > maximumTileLength || end > fileSize ||
+        !this->Insert(header.Id, offset + sizeof(header), header.Length))
+      {
+      break;
+      }
+    offset = end;
+    }
+  this->Index->PackSize = offset;
+}
+#endif
+
+//----------------------------------------------------------------------------
+vtkMapTilePackStore::vtkMapTilePackStore()
+{
+  this->Impl = new vtkInternal;
+}
+
+//----------------------------------------------------------------------------
+vtkMapTilePackStore::~vtkMapTilePackStore()
+{
+  this->Close();
+  delete this->Impl;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTilePackStore::PrintSelf(ostream &os, vtkIndent indent)
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Directory: " << this->Impl->Directory << "\n"
+     << indent << "NumberOfTiles: " << this->GetNumberOfTiles()
+     << std::endl;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTilePackStore::Open(const std::string& directory)
+{
+  this->Close();
+
+#ifdef _WIN32
+  vtkErrorMacro("vtkMapTilePackStore is not supported on Windows");
+  return false;
+#else
+  if (!vtksys::SystemTools::FileIsDirectory(directory.c_str()) &&
+      !vtksys::SystemTools::MakeDirectory(directory.c_str()))
+    {
+    vtkErrorMacro("Cannot create tile directory " << directory);
+    return false;
+    }
+
+  vtkInternal *impl = this->Impl;
+  std::string packName = directory + "/tiles.pack";
+  std::string indexName = packName + ".idx";
+  impl->IndexName = indexName;
+  impl->PackFd = open(packName.c_str(), O_RDWR | O_CREAT, 0644);
+  impl->IndexFd = open(indexName.c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat packStat, indexStat;
+  if (impl->PackFd < 0 || impl->IndexFd < 0 ||
+      fstat(impl->PackFd, &packStat) != 0 ||
+      fstat(impl->IndexFd, &indexStat) != 0)
+    {
+    vtkErrorMacro("Cannot open tile pack " << packName);
+    this->Close();
+    return false;
+    }
+
+  // Reserve address space for the pack to grow into, so that the
+  // mapping never moves and pointers handed out stay valid
+  impl->PackReserve = sizeof(void*) == 8 ?
+    static_cast<size_t>(1) << 38 : static_cast<size_t>(1) << 30;
+  void *map = mmap(NULL, impl->PackReserve, PROT_READ, MAP_SHARED,
+                   impl->PackFd, 0);
+  if (map == MAP_FAILED)
+    {
+    vtkErrorMacro("Cannot map tile pack " << packName);
+    this->Close();
+    return false;
+    }
+  impl->Pack = static_cast<unsigned char*>(map);
+
+  // Use the existing index if it is consistent with the pack,
+  // otherwise rebuild it from the pack
+  IndexHeader header;
+  bool valid =
+    indexStat.st_size >= static_cast<off_t>(sizeof(header)) &&
+    pread(impl->IndexFd, &header, sizeof(header), 0) ==
+      static_cast<ssize_t>(sizeof(header)) &&
+    memcmp(header.Magic, indexMagic, sizeof(indexMagic)) == 0 &&
+    header.Capacity >= initialCapacity &&
+    (header.Capacity & (header.Capacity - 1)) == 0 &&
+    static_cast<vtkTypeUInt64>(indexStat.st_size) ==
+      sizeof(header) + header.Capacity * sizeof(IndexSlot) &&
+    header.PackSize <= static_cast<vtkTypeUInt64>(packStat.st_size);
+  if (!(valid ? impl->MapIndex(header.Capacity, false) :
+        impl->MapIndex(initialCapacity, true)))
+    {
+    vtkErrorMacro("Cannot map tile pack index " << indexName);
+    this->Close();
+    return false;
+    }
+  impl->Recover(static_cast<vtkTypeUInt64>(packStat.st_size));
+
+  impl->Directory = directory;
+  return true;
+#endif
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTilePackStore::Close()
+{
+#ifndef _WIN32
+  vtkInternal *impl = this->Impl;
+  impl->Lock.Lock();
+  if (impl->Index)
+    {
+    munmap(impl->Index, impl->IndexMapSize);
+    impl->Index = NULL;
+    }
+  if (impl->Pack)
+    {
+    munmap(impl->Pack, impl->PackReserve);
+    impl->Pack = NULL;
+    }
+  if (impl->IndexFd >= 0)
+    {
+    close(impl->IndexFd);
+    impl->IndexFd = -1;
+    }
+  if (impl->PackFd >= 0)
+    {
+    close(impl->PackFd);
+    impl->PackFd = -1;
+    }
+  impl->Directory.clear();
+  impl->Lock.Unlock();
+#endif
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkMapTilePackStore::GetNumberOfTiles()
+{
+  this->Impl->Lock.Lock();
+  vtkTypeUInt64 count = this->Impl->Index ? this->Impl->Index->Count : 0;
+  this->Impl->Lock.Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTilePackStore::HasTile(int zoom, int x, int y)
+{
+  vtkTypeUInt64 id = vtkMapTile::ComputeTileId(zoom, x, y);
+  this->Impl->Lock.Lock();
+  bool found = this->Impl->Index && this->Impl->Find(id)->Key == id + 1;
+  this->Impl->Lock.Unlock();
+  return found;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTilePackStore::ReadTile(int zoom, int x, int y, TileData& data)
+{
+  vtkTypeUInt64 id = vtkMapTile::ComputeTileId(zoom, x, y);
+  vtkInternal *impl = this->Impl;
+  impl->Lock.Lock();
+  IndexSlot *slot = impl->Index ? impl->Find(id) : NULL;
+  bool found = slot && slot->Key == id + 1;
+  if (found)
+    {
+    // Points straight into the mapped pack, no copy is made
+    data.Data = impl->Pack + slot->Offset;
+    data.Length = static_cast<size_t>(slot->Length);
+    }
+  impl->Lock.Unlock();
+  return found;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTilePackStore::WriteTile(int zoom, int x, int y,
+                                    const char *data, size_t length)
+{
+#ifdef _WIN32
+  return false;
+#else
+  if (length > maximumTileLength)
+    {
+    return false;
+    }
+
+  RecordHeader header;
+  header.Id = vtkMapTile::ComputeTileId(zoom, x, y);
+  header.Length = length;
+
+  vtkInternal *impl = this->Impl;
+  impl->Lock.Lock();
+  if (!impl->Index)
+    {
+    impl->Lock.Unlock();
+    return false;
+    }
+
+  // Append the record, then publish it in the index
+  vtkTypeUInt64 offset = impl->Index->PackSize;
+  vtkTypeUInt64 end = offset + sizeof(header) + length;
+  bool written = end <= impl->PackReserve &&
+    pwrite(impl->PackFd, &header, sizeof(header),
+           static_cast<off_t>(offset)) ==
+      static_cast<ssize_t>(sizeof(header)) &&
+    pwrite(impl->PackFd, data, length,
+           static_cast<off_t>(offset + sizeof(header))) ==
+      static_cast<ssize_t>(length) &&
+    impl->Insert(header.Id, offset + sizeof(header), length);
+  if (written)
+    {
+    impl->Index->PackSize = end;
+    }
+  impl->Lock.Unlock();
+
+  if (!written)
+    {
+    vtkErrorMacro("Cannot write tile to pack in " << impl->Directory);
+    }
+  return written;
+#endif
+}
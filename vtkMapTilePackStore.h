@@ -0,0 +1,74 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapTilePackStore - tile images stored in a single pack file
+// .SECTION Description
+// vtkMapTilePackStore appends tile images to one pack file, tiles.pack,
+// and finds them through a hash table on the tile id kept in a second
+// file, tiles.pack.idx. Both files are memory mapped: looking up a tile
+// is a few memory reads with no system call, and ReadTile() returns a
+// pointer into the mapped pack file that can be handed to the decoder
+// without a copy.
+//
+// The pack file only grows. A replaced tile leaves its old image in
+// the pack, and there is no size budget or eviction, so this store
+// suits caches of a bounded area, such as pre-seeded ones. Index
+// entries lost in a crash are recovered from the pack when it is
+// opened again.
+//
+// Memory mapping is implemented for POSIX systems only.
+
+#ifndef __vtkMapTilePackStore_h
+#define __vtkMapTilePackStore_h
+
+#include "vtkMapTileStore.h"
+#include "vtkmap_export.h"
+
+#include <vtkType.h>
+
+class VTKMAP_EXPORT vtkMapTilePackStore : public vtkMapTileStore
+{
+public:
+  static vtkMapTilePackStore *New();
+  virtual void PrintSelf(ostream &os, vtkIndent indent);
+  vtkTypeMacro(vtkMapTilePackStore, vtkMapTileStore)
+
+  // Description:
+  // Close the files of the store. Called on destruction.
+  void Close();
+
+  // Description:
+  // Returns the number of tiles in the store
+  vtkTypeUInt64 GetNumberOfTiles();
+
+  // Description:
+  // Implement vtkMapTileStore
+  virtual bool Open(const std::string& directory);
+  virtual bool HasTile(int zoom, int x, int y);
+  virtual bool WriteTile(int zoom, int x, int y,
+                         const char *data, size_t length);
+  virtual bool ReadTile(int zoom, int x, int y, TileData& data);
+
+protected:
+  vtkMapTilePackStore();
+  ~vtkMapTilePackStore();
+
+  class vtkInternal;
+  vtkInternal *Impl;
+
+private:
+  vtkMapTilePackStore(const vtkMapTilePackStore&);  // Not implemented
+  void operator=(const vtkMapTilePackStore&); // Not implemented
+};
+
+#endif // __vtkMapTilePackStore_h
@@ -0,0 +1,114 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileStore.h"
+
+#include <cstring>
+
+//----------------------------------------------------------------------------
+namespace
+{
+  const unsigned char pngSignature[8] =
+    { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+  // Last chunk of every PNG image: empty IEND chunk and its CRC
+  const unsigned char pngTrailer[12] =
+    { 0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82 };
+
+  // Table of the CRC-32 used by zip and png, filled in before main()
+  // so that the download threads can share it
+  struct ChecksumTable
+  {
+    ChecksumTable()
+    {
+      for (vtkTypeUInt32 n = 0; n < 256; ++n)
+        {
+        vtkTypeUInt32 c = n;
+        for (int k = 0; k < 8; ++k)
+          {
+          c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+          }
+        this->Values[n] = c;
+        }
+    }
+
+    vtkTypeUInt32 Values[256];
+  };
+  const ChecksumTable checksumTable;
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileStore::vtkMapTileStore()
+{
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileStore::~vtkMapTileStore()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileStore::PrintSelf(ostream &os, vtkIndent indent)
+{
+  Superclass::PrintSelf(os, indent);
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileStore::TouchTile(int vtkNotUsed(zoom), int vtkNotUsed(x),
+                                int vtkNotUsed(y))
+{
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileStore::SupportsMetadata()
+{
+  return false;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileStore::GetTileMetadata(int vtkNotUsed(zoom), int vtkNotUsed(x),
+                                      int vtkNotUsed(y),
+                                      TileMetadata& vtkNotUsed(metadata))
+{
+  return false;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileStore::SetTileMetadata(int vtkNotUsed(zoom), int vtkNotUsed(x),
+                                      int vtkNotUsed(y),
+                                      const TileMetadata& vtkNotUsed(metadata))
+{
+  return false;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileStore::IsValidImage(const unsigned char *data, size_t length)
+{
+  return data && length >= sizeof(pngSignature) + sizeof(pngTrailer) &&
+    memcmp(data, pngSignature, sizeof(pngSignature)) == 0 &&
+    memcmp(data + length - sizeof(pngTrailer), pngTrailer,
+           sizeof(pngTrailer)) == 0;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt32 vtkMapTileStore::ComputeChecksum(const unsigned char *data,
+                                               size_t length)
+{
+  vtkTypeUInt32 crc = 0xffffffffu;
+  for (size_t i = 0; i < length; ++i)
+    {
+    crc = checksumTable.Values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+  return crc ^ 0xffffffffu;
+}
@@ -0,0 +1,126 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapTileStore - abstract storage of cached tile images
+// .SECTION Description
+// vtkMapTileStore is the interface between vtkOsmLayer and the storage
+// of the encoded tile images it downloads. Tiles are identified by
+// zoom level and x/y index, with y counted from the south as in
+// vtkOsmLayer. WriteTile() is called from the download threads,
+// the other methods from the render thread, so stores must be thread
+// safe. Stores must never return a partially written image, and should
+// not return images that fail IsValidImage().
+// .SECTION See Also
+// vtkMapTileFileStore vtkMapTilePackStore
+
+#ifndef __vtkMapTileStore_h
+#define __vtkMapTileStore_h
+
+// VTK Includes
+#include <vtkObject.h>
+#include <vtkType.h>
+#include "vtkmap_export.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class VTKMAP_EXPORT vtkMapTileStore : public vtkObject
+{
+public:
+  vtkTypeMacro(vtkMapTileStore, vtkObject)
+  virtual void PrintSelf(ostream &os, vtkIndent indent);
+
+  // Description:
+  // Encoded image of a tile. Data points either into Storage, or
+  // directly into memory owned by the store that stays valid as
+  // long as the store is open.
+  class TileData
+  {
+  public:
+    TileData() : Data(NULL), Length(0) {}
+
+    const unsigned char *Data;
+    size_t Length;
+    std::vector<unsigned char> Storage;
+  };
+
+  // Description:
+  // HTTP cache metadata of a tile image: its validators, and the time
+  // in seconds since the epoch after which it must be revalidated
+  class TileMetadata
+  {
+  public:
+    TileMetadata() : ExpirationTime(0.0) {}
+
+    std::string ETag;
+    std::string LastModified;
+    double ExpirationTime;
+  };
+
+  // Description:
+  // Open the store in the given directory, creating it if needed
+  virtual bool Open(const std::string& directory) = 0;
+
+  // Description:
+  // Returns true if the store holds an image of the tile
+  virtual bool HasTile(int zoom, int x, int y) = 0;
+
+  // Description:
+  // Store the encoded image of a tile, replacing any previous one
+  virtual bool WriteTile(int zoom, int x, int y,
+                         const char *data, size_t length) = 0;
+
+  // Description:
+  // Get the encoded image of a tile, returns false if there is none
+  virtual bool ReadTile(int zoom, int x, int y, TileData& data) = 0;
+
+  // Description:
+  // Report a tile in use, for stores that evict unused tiles
+  virtual void TouchTile(int zoom, int x, int y);
+
+  // Description:
+  // Returns true if the store keeps the HTTP cache metadata of its
+  // tiles. Tiles of stores without metadata never expire, so they are
+  // never revalidated or downloaded again. The default returns false.
+  virtual bool SupportsMetadata();
+
+  // Description:
+  // Get/Set the HTTP cache metadata of a tile. Stores that do not keep
+  // metadata return false.
+  virtual bool GetTileMetadata(int zoom, int x, int y,
+                               TileMetadata& metadata);
+  virtual bool SetTileMetadata(int zoom, int x, int y,
+                               const TileMetadata& metadata);
+
+  // Description:
+  // Returns true if the data is a complete PNG image: it starts with
+  // the PNG signature and ends with the IEND chunk. This catches error
+  // pages served in place of tiles, and truncated downloads or files.
+  static bool IsValidImage(const unsigned char *data, size_t length);
+
+  // Description:
+  // Returns the CRC-32 of the data, used to detect corrupted tiles
+  static vtkTypeUInt32 ComputeChecksum(const unsigned char *data,
+                                       size_t length);
+
+protected:
+  vtkMapTileStore();
+  ~vtkMapTileStore();
+
+private:
+  vtkMapTileStore(const vtkMapTileStore&);  // Not implemented
+  void operator=(const vtkMapTileStore&); // Not implemented
+};
+
+#endif // __vtkMapTileStore_h
@@ -0,0 +1,113 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+
+#include "vtkMapTileTable.h"
+
+//----------------------------------------------------------------------------
+namespace
+{
+  const size_t initialCapacity = 256;
+
+  // Zoom level of a tile id, see vtkMapTile::ComputeTileId()
+  size_t tileZoom(vtkTypeUInt64 id)
+  {
+    return static_cast<size_t>(id >> 48);
+  }
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileTable::vtkMapTileTable()
+  : Tiles(initialCapacity)
+{
+}
+
+//----------------------------------------------------------------------------
+vtkMapTileTable::~vtkMapTileTable()
+{
+}
+
+//----------------------------------------------------------------------------
+vtkMapTile* vtkMapTileTable::Find(vtkTypeUInt64 id) const
+{
+  vtkMapTile* const *tile = this->Tiles.Find(id);
+  return tile ? *tile : NULL;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMapTileTable::Insert(vtkTypeUInt64 id, vtkMapTile* tile)
+{
+  if (!this->Tiles.Insert(id, tile).second)
+    {
+    return false;
+    }
+
+  size_t zoom = tileZoom(id);
+  if (zoom >= this->LevelCounts.size())
+    {
+    this->LevelCounts.resize(zoom + 1, 0);
+    }
+  ++this->LevelCounts[zoom];
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkMapTile* vtkMapTileTable::Erase(vtkTypeUInt64 id)
+{
+  vtkMapTile* tile = NULL;
+  if (this->Tiles.Erase(id, &tile))
+    {
+    --this->LevelCounts[tileZoom(id)];
+    }
+  return tile;
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileTable::Clear()
+{
+  this->LevelCounts.clear();
+  this->Tiles.Clear();
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileTable::GetTiles(std::vector<vtkMapTile*>& tiles) const
+{
+  tiles.reserve(tiles.size() + this->Tiles.GetNumberOfEntries());
+  for (size_t i = 0; i < this->Tiles.GetNumberOfSlots(); ++i)
+    {
+    if (this->Tiles.IsSlotUsed(i))
+      {
+      tiles.push_back(this->Tiles.GetSlotValue(i));
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkMapTileTable::GetTiles(int zoom, std::vector<vtkMapTile*>& tiles) const
+{
+  if (zoom < 0 || static_cast<size_t>(zoom) >= this->LevelCounts.size() ||
+      this->LevelCounts[zoom] == 0)
+    {
+    return;
+    }
+
+  tiles.reserve(tiles.size() + this->LevelCounts[zoom]);
+  for (size_t i = 0; i < this->Tiles.GetNumberOfSlots(); ++i)
+    {
+    if (this->Tiles.IsSlotUsed(i) &&
+        tileZoom(this->Tiles.GetSlotKey(i)) == static_cast<size_t>(zoom))
+      {
+      tiles.push_back(this->Tiles.GetSlotValue(i));
+      }
+    }
+}
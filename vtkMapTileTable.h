@@ -0,0 +1,83 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+   This software is distributed WITHOUT ANY WARRANTY; without even
+   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkMapTileTable - hash table of map tiles keyed on their tile id
+// .SECTION Description
+// vtkMapTileTable finds tiles by the id vtkMapTile::ComputeTileId()
+// packs from their zoom level and x/y index. It is a vtkMapHashTable,
+// so that the lookups done for every visible tile on every update touch
+// one or two cache lines, that also counts the tiles of each zoom
+// level. The table does not own the tiles.
+
+#ifndef __vtkMapTileTable_h
+#define __vtkMapTileTable_h
+
+// VTK Includes
+#include <vtkType.h>
+#include "vtkMapHashTable.h"
+#include "vtkmap_export.h"
+
+#include <vector>
+
+class vtkMapTile;
+
+class VTKMAP_EXPORT vtkMapTileTable
+{
+public:
+  vtkMapTileTable();
+  ~vtkMapTileTable();
+
+  // Description:
+  // Returns the tile with the given id, or NULL
+  vtkMapTile* Find(vtkTypeUInt64 id) const;
+
+  // Description:
+  // Add a tile. Returns false, and leaves the table unchanged,
+  // if a tile with the same id is already in the table.
+  bool Insert(vtkTypeUInt64 id, vtkMapTile* tile);
+
+  // Description:
+  // Remove the tile with the given id. Returns the removed tile,
+  // or NULL if there was none.
+  vtkMapTile* Erase(vtkTypeUInt64 id);
+
+  // Description:
+  // Remove all tiles
+  void Clear();
+
+  // Description:
+  // Returns the number of tiles in the table
+  size_t GetNumberOfTiles() const
+  {
+    return this->Tiles.GetNumberOfEntries();
+  }
+
+  // Description:
+  // Append the tiles of the table, or of a single zoom level, to tiles.
+  // The order is unspecified.
+  void GetTiles(std::vector<vtkMapTile*>& tiles) const;
+  void GetTiles(int zoom, std::vector<vtkMapTile*>& tiles) const;
+
+protected:
+  vtkMapHashTable<vtkMapTile*> Tiles;
+
+  // Description:
+  // Number of tiles per zoom level, so that empty levels are not scanned
+  std::vector<size_t> LevelCounts;
+
+private:
+  vtkMapTileTable(const vtkMapTileTable&);  // Not implemented
+  void operator=(const vtkMapTileTable&); // Not implemented
+};
+
+#endif // __vtkMapTileTable_h
@@ -16,44 +16,116 @@
 
 #include "vtkMercator.h"
 #include "vtkMapTile.h"
-
+#include "vtkMapTileAtlas.h"
+#include "vtkMapTileDecoder.h"
+#include "vtkMapTileDownloader.h"
+#include "vtkMapTileFileStore.h"
+#include "vtkMapTileImageCache.h"
+
+#include <vtkActor.h>
+#include <vtkCamera.h>
+#include <vtkImageData.h>
 #include <vtkObjectFactory.h>
+#include <vtkPropAssembly.h>
+#include <vtkPropCollection.h>
 #include <vtksys/SystemTools.hxx>
 
 #include <algorithm>
+#include <cstdlib>
 #include <iomanip>
 #include <iterator>
 #include <math.h>
+#include <set>
 #include <sstream>
+#include <utility>
 
 vtkStandardNewMacro(vtkOsmLayer)
+vtkCxxSetObjectMacro(vtkOsmLayer, Store, vtkMapTileStore)
 
 //----------------------------------------------------------------------------
-struct sortTiles
+namespace
 {
-  inline bool operator() (vtkMapTile* tile1,  vtkMapTile* tile2)
+  // Prefetched tiles rank behind every visible tile
+  const double prefetchPriority = 1.0e6;
+
+  // Revalidation of expired tiles, which stay drawn meanwhile,
+  // ranks behind prefetching
+  const double revalidationPriority = 2.0e6;
+
+  // How far ahead, in seconds of pan motion, tiles are prefetched
+  const double prefetchLookAhead = 1.0;
+
+  // Deepest zoom level served by the tile server
+  const int maximumTileZoom = 19;
+
+  struct PrefetchCandidate
   {
-    return (tile1->GetBin() < tile2->GetBin());
-  }
-};
+    int Zoom;
+    int X;
+    int Y;
+    double Priority;
+
+    bool operator<(const PrefetchCandidate& other) const
+    {
+      return this->Priority < other.Priority;
+    }
+  };
+}
 
 //----------------------------------------------------------------------------
 vtkOsmLayer::vtkOsmLayer() : vtkFeatureLayer()
 {
   this->BaseOn();
   this->CacheDirectory = NULL;
+  this->Downloader = vtkMapTileDownloader::New();
+  this->Decoder = vtkMapTileDecoder::New();
+  this->Atlas = vtkMapTileAtlas::New();
+  this->TileAssembly = vtkPropAssembly::New();
+  this->TileAssembly->PickableOff();
+  this->Store = NULL;
+  this->FailedTileTimeout = 300.0;
+  this->ViewCenter[0] = this->ViewCenter[1] = 0.0;
+  this->ViewZoom = 0;
+  this->Prefetch = true;
+  this->PrefetchRingWidth = 1;
+  this->MaximumNumberOfPrefetchTiles = 64;
+  this->MaximumNumberOfResidentTiles = 256;
+  this->BatchTiles = false;
+  std::fill(this->ViewSignature, this->ViewSignature + 12, 0.0);
+  std::fill(this->ViewTileRange, this->ViewTileRange + 5, -1);
+  this->NextTileDeadline = 0.0;
 }
 
 //----------------------------------------------------------------------------
 vtkOsmLayer::~vtkOsmLayer()
 {
- //The entries in the CachedTilesMap and also the CachedTiles are also
- //part of a vector held by our derived parent. The Caches are just for quick
- //lookup and the pointers inside of them don't need to be deleted, as our
- //derived parent owns them
+ //The entries in the CachedTiles are also part of a vector held by our
+ //derived parent. The Cache is just for quick lookup and the pointers
+ //inside of it don't need to be deleted, as our derived parent owns them.
+ //Tiles that were never built were never added to the parent, and are
+ //deleted here.
+  std::vector<vtkMapTile*> tiles;
+  this->CachedTiles.GetTiles(tiles);
+  for (size_t i = 0; i < tiles.size(); ++i)
+    {
+    if (!tiles[i]->GetActor())
+      {
+      tiles[i]->Delete();
+      }
+    }
+  this->CachedTiles.Clear();
 
-  this->CachedTiles.clear();
-  this->CachedTilesMap.clear();
+  // Stops the worker threads
+  this->Downloader->Delete();
+  this->Decoder->Delete();
+  this->Atlas->Delete();
+  if (this->Renderer)
+    {
+    this->Renderer->RemoveViewProp(this->TileAssembly);
+    }
+  this->TileAssembly->Delete();
+  this->SetStore(NULL);
+  this->SetCacheDirectory(NULL);
 }
 
 //----------------------------------------------------------------------------
@@ -88,6 +160,16 @@ void vtkOsmLayer::SetCacheSubDirectory(const char *relativePath)
     vtksys::SystemTools::MakeDirectory(fullPath.c_str());
     }
   this->SetCacheDirectory(fullPath.c_str());
+
+  if (!this->Store)
+    {
+    vtkMapTileFileStore *store = vtkMapTileFileStore::New();
+    this->SetStore(store);
+    store->Delete();
+    }
+  this->Store->Open(fullPath);
+  this->Downloader->SetStore(this->Store);
+  this->Decoder->SetStore(this->Store);
 }
 
 //----------------------------------------------------------------------------
@@ -104,25 +186,201 @@ void vtkOsmLayer::Update()
     this->SetCacheSubDirectory("osm");
     }
 
-  this->AddTiles();
+  // Tiles are built once their images are decoded. Downloads are
+  // decoded by the downloader, AddTiles() queues the decode of images
+  // found in the store. Failed tiles go to the negative cache.
+  std::vector<vtkMapTileDownloader::Request> completed;
+  this->Downloader->GetCompletedRequests(completed);
+  double now = vtksys::SystemTools::GetTime();
+  for (size_t i = 0; i < completed.size(); ++i)
+    {
+    const vtkMapTileDownloader::Request& request = completed[i];
+    vtkTypeUInt64 id =
+      vtkMapTile::ComputeTileId(request.Zoom, request.X, request.Y);
+    if (!request.Succeeded)
+      {
+      this->FailedTiles[id] = now + this->FailedTileTimeout;
+      continue;
+      }
+
+    this->FailedTiles.erase(id);
+    vtkMapTile *tile = this->GetCachedTile(request.Zoom, request.X, request.Y);
+    if (!tile)
+      {
+      continue;
+      }
+    tile->SetExpirationTime(request.ExpirationTime);
+    if (!request.NotModified)
+      {
+      // The new image is in the image cache already
+      tile->Modified();
+      }
+    }
+
+  std::vector<vtkMapTileDecoder::Request> decoded;
+  this->Decoder->GetCompletedRequests(decoded);
+  for (size_t i = 0; i < decoded.size(); ++i)
+    {
+    const vtkMapTileDecoder::Request& request = decoded[i];
+    vtkMapTile *tile = this->GetCachedTile(request.Zoom, request.X, request.Y);
+    if (!tile)
+      {
+      continue;
+      }
+    // A failed decode drops the tile: the store removes images it
+    // finds corrupted, and the next update queues their download
+    // again. An image the store keeps but that cannot be decoded goes
+    // to the negative cache, so it is not decoded on every update.
+    if (request.Succeeded)
+      {
+      tile->Modified();
+      }
+    else if (tile->IsImageDownloaded())
+      {
+      this->FailedTiles[vtkMapTile::ComputeTileId(
+          request.Zoom, request.X, request.Y)] = now + this->FailedTileTimeout;
+      }
+    }
+
+  // Tiles are worked on only when the view moved, or when the tiles,
+  // the settings or the renderer props changed, or a failed or expired
+  // tile is due. Applications may draw the map on every data refresh.
+  bool tilesChanged = !completed.empty() || !decoded.empty() ||
+    this->GetMTime() > this->TilePassTime.GetMTime() ||
+    now >= this->NextTileDeadline ||
+    (this->Renderer && !this->Renderer->HasViewProp(this->TileAssembly));
+  if (this->HasViewChanged() || tilesChanged)
+    {
+    this->AddTiles(tilesChanged);
+    }
 
   this->Superclass::Update();
 }
 
 //----------------------------------------------------------------------------
-void vtkOsmLayer::RemoveTiles()
+bool vtkOsmLayer::HasViewChanged()
 {
-  // TODO
   if (!this->Renderer)
+    {
+    return false;
+    }
+
+  // Compare values rather than the camera modification time, which
+  // changes whenever the clipping range is reset
+  double signature[12];
+  vtkCamera *camera = this->Renderer->GetActiveCamera();
+  camera->GetPosition(signature);
+  camera->GetFocalPoint(signature + 3);
+  signature[6] = camera->GetViewAngle();
+  signature[7] = camera->GetParallelScale();
+  int size[2], origin[2];
+  this->Renderer->GetTiledSizeAndOrigin(&size[0], &size[1],
+                                        &origin[0], &origin[1]);
+  signature[8] = size[0];
+  signature[9] = size[1];
+  signature[10] = origin[0];
+  signature[11] = origin[1];
+
+  if (std::equal(signature, signature + 12, this->ViewSignature))
+    {
+    return false;
+    }
+  std::copy(signature, signature + 12, this->ViewSignature);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkOsmLayer::HasPendingRequests()
+{
+  return this->Downloader->GetNumberOfPendingRequests() > 0 ||
+    this->Decoder->GetNumberOfPendingRequests() > 0;
+}
+
+//----------------------------------------------------------------------------
+bool vtkOsmLayer::HasCompletedRequests()
+{
+  return this->Downloader->HasCompletedRequests() ||
+    this->Decoder->HasCompletedRequests();
+}
+
+//----------------------------------------------------------------------------
+void vtkOsmLayer::RemoveTiles(const std::vector<vtkMapTile*>& visibleTiles)
+{
+  // Forget failures that timed out, IsFailedTile() only drops those
+  // it is asked about
+  double now = vtksys::SystemTools::GetTime();
+  std::map<vtkTypeUInt64, double>::iterator failed = this->FailedTiles.begin();
+  while (failed != this->FailedTiles.end())
+    {
+    if (failed->second < now)
+      {
+      this->FailedTiles.erase(failed++);
+      }
+    else
+      {
+      ++failed;
+      }
+    }
+
+  int budget = std::max(this->MaximumNumberOfResidentTiles,
+                        static_cast<int>(visibleTiles.size()));
+  if (static_cast<int>(this->CachedTiles.GetNumberOfTiles()) <= budget)
     {
     return;
     }
+
+  // Rank the tiles out of view like their downloads, so that tiles
+  // close to the view, and of the neighbouring zoom levels, are kept
+  std::set<vtkMapTile*> visible(visibleTiles.begin(), visibleTiles.end());
+  std::vector<vtkMapTile*> tiles;
+  this->CachedTiles.GetTiles(tiles);
+  std::vector<std::pair<double, vtkMapTile*> > candidates;
+  for (size_t i = 0; i < tiles.size(); ++i)
+    {
+    vtkMapTile *tile = tiles[i];
+    if (visible.count(tile) == 0)
+      {
+      int *index = tile->GetTileIndex();
+      candidates.push_back(std::make_pair(
+        this->ComputeTilePriority(index[0], index[1], index[2]), tile));
+      }
+    }
+
+  int keep = budget - static_cast<int>(visible.size());
+  std::sort(candidates.begin(), candidates.end());
+  for (size_t i = static_cast<size_t>(keep); i < candidates.size(); ++i)
+    {
+    this->ReleaseTile(candidates[i].second);
+    }
 }
 
 //----------------------------------------------------------------------------
-void vtkOsmLayer::AddTiles()
+void vtkOsmLayer::ReleaseTile(vtkMapTile* tile)
 {
-  if (!this->Renderer)
+  int *index = tile->GetTileIndex();
+  this->CachedTiles.Erase(
+    vtkMapTile::ComputeTileId(index[0], index[1], index[2]));
+
+  // Only built tiles were added to the layer, which then owns them.
+  // The image stays in the image cache and the store.
+  if (tile->GetActor())
+    {
+    if (this->TileProps.erase(tile->GetActor()))
+      {
+      this->TileAssembly->RemovePart(tile->GetActor());
+      }
+    this->RemoveFeature(tile);
+    }
+  else
+    {
+    tile->Delete();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkOsmLayer::AddTiles(bool tilesChanged)
+{
+  if (!this->Renderer || !this->Store)
     {
     return;
     }
@@ -216,7 +474,29 @@ void vtkOsmLayer::AddTiles()
   //std::cerr << "tile1x " << tile1x << " tile2x " << tile2x << std::endl;
   //std::cerr << "tile1y " << tile1y << " tile2y " << tile2y << std::endl;
 
+  // Moving the view within the same tiles changes nothing
+  int tileRange[5] = { zoomLevel, tile1x, tile2x, tile1y, tile2y };
+  if (!tilesChanged &&
+      std::equal(tileRange, tileRange + 5, this->ViewTileRange))
+    {
+    return;
+    }
+  std::copy(tileRange, tileRange + 5, this->ViewTileRange);
+
+  // Requests are prioritized from the view center outwards
+  this->ViewCenter[0] = 0.5 * (bottomLeft[0] + topRight[0]);
+  this->ViewCenter[1] = 0.5 * (bottomLeft[1] + topRight[1]);
+  this->ViewZoom = zoomLevel;
+
+  // Every tile still wanted is requested again below, so that requests
+  // for tiles that left the view, or for other zoom levels, are cancelled
+  this->Downloader->BeginRequests();
+  this->Decoder->BeginRequests();
+  double now = vtksys::SystemTools::GetTime();
+
   std::vector<vtkMapTile*> pendingTiles;
+  std::vector<vtkMapTile*> viewTiles;
+  double deadline = VTK_DOUBLE_MAX;
   int xIndex, yIndex;
   for (int i = tile1x; i <= tile2x; ++i)
     {
@@ -236,88 +516,469 @@ void vtkOsmLayer::AddTiles()
 
         tile->SetCorners(llx, lly, urx, ury);
 
-        std::ostringstream oss;
-        oss << zoomLevel;
-        std::string zoom = oss.str();
-        oss.str("");
+        // Set tile texture source
+        tile->SetImageKey(this->GetTileKey(zoomLevel, xIndex, yIndex));
+        tile->SetImageSource(this->GetTileUrl(zoomLevel, xIndex, yIndex));
+        tile->SetStore(this->Store);
+        tile->SetTileIndex(zoomLevel, xIndex, yIndex);
+        this->AddTileToCache(zoomLevel, xIndex, yIndex, tile);
 
-        oss << i;
-        std::string row = oss.str();
-        oss.str("");
+        // Released tiles may still be drawn from the atlas
+        if (this->BatchTiles && this->Atlas->HasTile(
+              vtkMapTile::ComputeTileId(zoomLevel, xIndex, yIndex)))
+          {
+          tile->UpdateExpirationTime();
+          }
+      }
+    viewTiles.push_back(tile);
 
-        oss << (static_cast<int>(std::pow(2.0, zoomLevel)) - 1 - yIndex);
-        std::string col = oss.str();
-        oss.str("");
+    // Tiles are only drawn once their image is decoded, otherwise queue
+    // a download or a decode and check again next update. Tiles that
+    // failed recently are drawn as placeholders and not requested again.
+    if (!this->IsTileLoaded(tile))
+      {
+      bool waiting = false;
+      double priority = this->ComputeTilePriority(zoomLevel, xIndex, yIndex);
+      if (this->IsFailedTile(zoomLevel, xIndex, yIndex))
+        {
+        // Drawn as a placeholder until the failure times out
+        }
+      else if (tile->IsImageDecoded())
+        {
+        // Decoded for another layer or map, or while downloading
+        tile->Modified();
+        }
+      else if (this->Downloader->IsPending(zoomLevel, xIndex, yIndex) ||
+               !tile->IsImageDownloaded())
+        {
+        this->Downloader->RequestTile(zoomLevel, xIndex, yIndex,
+                                      tile->GetImageSource(), priority);
+        waiting = true;
+        }
+      else
+        {
+        this->Decoder->RequestImage(zoomLevel, xIndex, yIndex,
+                                    tile->GetImageSource(), priority);
+        waiting = true;
+        }
+
+      // Meanwhile draw the part of the closest loaded ancestor
+      // covering the tile, so that zooming in leaves no holes. The
+      // atlas looks up the ancestor itself when drawing.
+      vtkMapTile *ancestor =
+        this->FindLoadedAncestor(zoomLevel, xIndex, yIndex);
+      if (ancestor && !this->BatchTiles)
+        {
+        tile->SetPlaceholderTexture(ancestor->GetActor()->GetTexture(),
+                                    ancestor->GetCorners());
+        }
+      else if (!ancestor && waiting && !tile->GetActor())
+        {
+        continue;
+        }
+      }
+    else
+      {
+      // Keep the images in view at the front of the cache
+      this->Store->TouchTile(zoomLevel, xIndex, yIndex);
 
-        // Set tile texture source
-        oss << zoom << row << col;
-        tile->SetImageKey(oss.str());
-        tile->SetImageSource("http://tile.openstreetmap.org/" + zoom + "/" + row +
-                             "/" + col + ".png");
-        this->AddTileToCache(zoomLevel, xIndex, yIndex, tile);
+      // Check expired images with the server in the background
+      if (tile->GetExpirationTime() > now)
+        {
+        deadline = std::min(deadline, tile->GetExpirationTime());
+        }
+      else if (!this->IsFailedTile(zoomLevel, xIndex, yIndex))
+        {
+        this->Downloader->RequestTile(
+          zoomLevel, xIndex, yIndex, tile->GetImageSource(),
+          revalidationPriority +
+          this->ComputeTilePriority(zoomLevel, xIndex, yIndex), true);
+        }
       }
+
     pendingTiles.push_back(tile);
     tile->SetVisible(true);
     }
   }
 
-  if (pendingTiles.size() > 0)
+  int visibleRange[4];
+  visibleRange[0] = tile1x;
+  visibleRange[1] = tile2x;
+  visibleRange[2] = static_cast<int>(std::pow(2.0, zoomLevel)) - 1 - tile1y;
+  visibleRange[3] = static_cast<int>(std::pow(2.0, zoomLevel)) - 1 - tile2y;
+  this->PrefetchTiles(zoomLevel, visibleRange);
+
+  this->Downloader->EndRequests();
+  this->Decoder->EndRequests();
+
+  // Only actors that start or stop being drawn change the assembly.
+  // Without any tile to draw yet, the previous tiles stay.
+  std::vector<vtkProp*> tileProps;
+  if (this->BatchTiles)
+    {
+    this->DrawBatchedTiles(pendingTiles);
+    for (int i = 0; i < this->Atlas->GetNumberOfActors(); ++i)
+      {
+      tileProps.push_back(this->Atlas->GetActor(i));
+      }
+    this->UpdateTileAssembly(tileProps);
+    }
+  else if (pendingTiles.size() > 0)
     {
-    // Remove the old tiles first
-    std::vector<vtkMapTile*>::iterator itr = this->CachedTiles.begin();
-    for (; itr != this->CachedTiles.end(); ++itr)
+    for (std::size_t i = 0; i < pendingTiles.size(); ++i)
       {
-      this->Renderer->RemoveActor((*itr)->GetActor());
+      vtkMapTile *tile = pendingTiles[i];
+      if (!tile->GetActor())
+        {
+        // Builds the tile and hands it to the layer
+        this->AddFeature(tile);
+        }
+      else
+        {
+        // Rebuilds the tile if its image or placeholder changed
+        tile->Init();
+        }
+      tileProps.push_back(tile->GetActor());
       }
+    this->UpdateTileAssembly(tileProps);
+    }
 
-    vtkPropCollection* props = this->Renderer->GetViewProps();
+  this->RemoveTiles(viewTiles);
 
-    props->InitTraversal();
-    vtkProp* prop = props->GetNextProp();
+  // The next pass is due when a tile in view expires or a failure
+  // times out, even if nothing else changes
+  std::map<vtkTypeUInt64, double>::iterator failed = this->FailedTiles.begin();
+  for (; failed != this->FailedTiles.end(); ++failed)
+    {
+    deadline = std::min(deadline, failed->second);
+    }
+  this->NextTileDeadline = deadline;
+  this->TilePassTime.Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkOsmLayer::UpdateTileAssembly(const std::vector<vtkProp*>& props)
+{
+  // The assembly goes in front of the props of every other layer once,
+  // so that tiles are drawn first
+  if (!this->Renderer->HasViewProp(this->TileAssembly))
+    {
+    vtkPropCollection* viewProps = this->Renderer->GetViewProps();
     std::vector<vtkProp*> otherProps;
-    while (prop)
+    viewProps->InitTraversal();
+    for (vtkProp* prop = viewProps->GetNextProp(); prop;
+         prop = viewProps->GetNextProp())
       {
+      prop->Register(this);
       otherProps.push_back(prop);
-      prop = props->GetNextProp();
       }
-
     this->Renderer->RemoveAllViewProps();
+    this->Renderer->AddViewProp(this->TileAssembly);
+    for (size_t i = 0; i < otherProps.size(); ++i)
+      {
+      this->Renderer->AddViewProp(otherProps[i]);
+      otherProps[i]->UnRegister(this);
+      }
+    }
 
-    std::sort(pendingTiles.begin(),
-              pendingTiles.end(),
-              sortTiles());
+  std::set<vtkProp*> drawn(props.begin(), props.end());
+  std::set<vtkProp*>::iterator iter = this->TileProps.begin();
+  while (iter != this->TileProps.end())
+    {
+    if (drawn.count(*iter) == 0)
+      {
+      this->TileAssembly->RemovePart(*iter);
+      this->TileProps.erase(iter++);
+      }
+    else
+      {
+      ++iter;
+      }
+    }
+  for (size_t i = 0; i < props.size(); ++i)
+    {
+    if (this->TileProps.insert(props[i]).second)
+      {
+      this->TileAssembly->AddPart(props[i]);
+      }
+    }
+}
 
-    for (std::size_t i = 0; i < pendingTiles.size(); ++i)
+//----------------------------------------------------------------------------
+void vtkOsmLayer::DrawBatchedTiles(const std::vector<vtkMapTile*>& tiles)
+{
+  vtkMapTileImageCache *images = vtkMapTileImageCache::GetInstance();
+  this->Atlas->BeginFrame();
+  for (size_t i = 0; i < tiles.size(); ++i)
+    {
+    vtkMapTile *tile = tiles[i];
+    int *index = tile->GetTileIndex();
+    vtkMapTile *source = this->IsTileLoaded(tile) ? tile :
+      this->FindLoadedAncestor(index[0], index[1], index[2]);
+
+    bool drawn = false;
+    if (source)
+      {
+      int *sourceIndex = source->GetTileIndex();
+      vtkTypeUInt64 id = vtkMapTile::ComputeTileId(
+        sourceIndex[0], sourceIndex[1], sourceIndex[2]);
+      bool added = !this->Atlas->HasTile(id);
+
+      // Passing the image lets the atlas notice a new image after a
+      // revalidation. It may be NULL if the image cache dropped it.
+      vtkSmartPointer<vtkImageData> image =
+        images->GetImage(source->GetImageSource());
+      drawn = this->Atlas->AddQuad(id, image, source->GetCorners(),
+                                   tile->GetCorners());
+      if (drawn && added)
+        {
+        source->UpdateExpirationTime();
+        }
+      }
+    if (!drawn)
+      {
+      this->Atlas->AddPlaceholder(tile->GetCorners());
+      }
+    }
+  this->Atlas->EndFrame();
+}
+
+//----------------------------------------------------------------------------
+bool vtkOsmLayer::IsTileLoaded(vtkMapTile* tile)
+{
+  if (this->BatchTiles)
+    {
+    int *index = tile->GetTileIndex();
+    return tile->IsImageDecoded() || this->Atlas->HasTile(
+      vtkMapTile::ComputeTileId(index[0], index[1], index[2]));
+    }
+  return tile->GetActor() && !tile->GetPlaceholder();
+}
+
+//----------------------------------------------------------------------------
+void vtkOsmLayer::PrefetchTiles(int zoomLevel, const int range[4])
+{
+  if (!this->Prefetch || this->MaximumNumberOfPrefetchTiles == 0)
+    {
+    return;
+    }
+
+  // While panning, widen the ring ahead of the motion and rank the
+  // tiles by their distance to where the view is heading
+  double velocity[2];
+  this->Map->GetPanVelocity(velocity);
+  double heading[2];
+  heading[0] = this->ViewCenter[0] + prefetchLookAhead * velocity[0];
+  heading[1] = this->ViewCenter[1] + prefetchLookAhead * velocity[1];
+
+  double tilesPerDegree = std::pow(2.0, zoomLevel) / 360.0;
+  int lead[2];
+  for (int k = 0; k < 2; ++k)
+    {
+    lead[k] = static_cast<int>(std::ceil(
+      std::fabs(velocity[k]) * prefetchLookAhead * tilesPerDegree));
+    lead[k] = std::min(lead[k], 4);
+    }
+
+  int ring = this->PrefetchRingWidth;
+  int xmin = range[0] - ring - (velocity[0] < 0.0 ? lead[0] : 0);
+  int xmax = range[1] + ring + (velocity[0] > 0.0 ? lead[0] : 0);
+  int ymin = range[2] - ring - (velocity[1] < 0.0 ? lead[1] : 0);
+  int ymax = range[3] + ring + (velocity[1] > 0.0 ? lead[1] : 0);
+
+  // The level the user zoomed towards last is fetched before the other
+  // one. At rest the parent level comes first, it has a quarter of the
+  // tiles and covers the whole view.
+  int zoomDirection = this->Map->GetZoomDirection();
+  double parentRank = zoomDirection > 0 ? 2.0 : 1.0;
+  double childRank = zoomDirection > 0 ? 1.0 : 2.0;
+
+  std::vector<PrefetchCandidate> candidates;
+  PrefetchCandidate candidate;
+  candidate.Zoom = zoomLevel;
+  for (int x = xmin; x <= xmax; ++x)
+    {
+    for (int y = ymin; y <= ymax; ++y)
+      {
+      if (x >= range[0] && x <= range[1] && y >= range[2] && y <= range[3])
+        {
+        continue;
+        }
+      candidate.X = x;
+      candidate.Y = y;
+      candidate.Priority = prefetchPriority +
+        this->ComputeTileDistance(zoomLevel, x, y, heading);
+      candidates.push_back(candidate);
+      }
+    }
+
+  if (zoomLevel > 0)
+    {
+    candidate.Zoom = zoomLevel - 1;
+    for (int x = range[0] / 2; x <= range[1] / 2; ++x)
+      {
+      for (int y = range[2] / 2; y <= range[3] / 2; ++y)
+        {
+        candidate.X = x;
+        candidate.Y = y;
+        candidate.Priority = prefetchPriority + parentRank * 1.0e4 +
+          this->ComputeTileDistance(zoomLevel - 1, x, y, this->ViewCenter);
+        candidates.push_back(candidate);
+        }
+      }
+    }
+
+  if (zoomLevel < maximumTileZoom)
+    {
+    candidate.Zoom = zoomLevel + 1;
+    for (int x = 2 * range[0]; x <= 2 * range[1] + 1; ++x)
       {
-      // Add tile to the renderer
-      this->AddFeature(pendingTiles[i]);
+      for (int y = 2 * range[2]; y <= 2 * range[3] + 1; ++y)
+        {
+        candidate.X = x;
+        candidate.Y = y;
+        candidate.Priority = prefetchPriority + childRank * 1.0e4 +
+          this->ComputeTileDistance(zoomLevel + 1, x, y, this->ViewCenter);
+        candidates.push_back(candidate);
+        }
       }
+    }
+
+  // Spend the budget on the most useful tiles
+  std::sort(candidates.begin(), candidates.end());
+  int requested = 0;
+  for (size_t i = 0; i < candidates.size() &&
+         requested < this->MaximumNumberOfPrefetchTiles; ++i)
+    {
+    const PrefetchCandidate& c = candidates[i];
+    if (this->PrefetchTile(c.Zoom, c.X, c.Y, c.Priority))
+      {
+      ++requested;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkOsmLayer::PrefetchTile(int zoom, int x, int y, double priority)
+{
+  int noOfTiles = 1 << zoom;
+  if (x < 0 || y < 0 || x >= noOfTiles || y >= noOfTiles)
+    {
+    return false;
+    }
+
+  if (this->IsFailedTile(zoom, x, y))
+    {
+    return false;
+    }
+
+  // Tiles already drawn, or in the store, need nothing
+  vtkMapTile *tile = this->GetCachedTile(zoom, x, y);
+  if (tile && this->IsTileLoaded(tile))
+    {
+    return false;
+    }
+  if (!this->Downloader->IsPending(zoom, x, y) &&
+      this->Store->HasTile(zoom, x, y))
+    {
+    return false;
+    }
+
+  this->Downloader->RequestTile(zoom, x, y, this->GetTileUrl(zoom, x, y),
+                                priority);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+std::string vtkOsmLayer::GetTileKey(int zoom, int x, int y)
+{
+  // zoom/x/y, with rows counted from the north like the tile server
+  std::ostringstream oss;
+  oss << zoom << "/" << x << "/" << ((1 << zoom) - 1 - y);
+  return oss.str();
+}
+
+//----------------------------------------------------------------------------
+std::string vtkOsmLayer::GetTileUrl(int zoom, int x, int y)
+{
+  // Tile servers count rows from the north
+  std::ostringstream oss;
+  oss << "http://tile.openstreetmap.org/" << zoom << "/" << x << "/"
+      << ((1 << zoom) - 1 - y) << ".png";
+  return oss.str();
+}
+
+//----------------------------------------------------------------------------
+double vtkOsmLayer::ComputeTilePriority(int zoom, int x, int y)
+{
+  // Each zoom level away from the displayed one ranks behind
+  // any tile of a closer level
+  int levels = std::abs(zoom - this->ViewZoom);
+  return levels * 1.0e4 +
+    this->ComputeTileDistance(zoom, x, y, this->ViewCenter);
+}
+
+//----------------------------------------------------------------------------
+double vtkOsmLayer::ComputeTileDistance(int zoom, int x, int y,
+                                        const double point[2])
+{
+  // Both are in tile units of the tile's level, with y counted
+  // from the south like the tile y index
+  double tilesPerDegree = std::pow(2.0, zoom) / 360.0;
+  double dx = (x + 0.5) - (point[0] + 180.0) * tilesPerDegree;
+  double dy = (y + 0.5) - (point[1] + 180.0) * tilesPerDegree;
+  return std::sqrt(dx * dx + dy * dy);
+}
 
-    std::vector<vtkProp*>::iterator itr2 = otherProps.begin();
-    while (itr2 != otherProps.end())
+//----------------------------------------------------------------------------
+vtkMapTile *vtkOsmLayer::FindLoadedAncestor(int zoom, int x, int y)
+{
+  // Both tile indices of the parent are halved, since the y index
+  // is counted from the south
+  for (int levels = 1; levels <= zoom; ++levels)
+    {
+    vtkMapTile *ancestor =
+      this->GetCachedTile(zoom - levels, x >> levels, y >> levels);
+    if (ancestor && this->IsTileLoaded(ancestor))
       {
-      this->Renderer->AddViewProp(*itr2);
-      ++itr2;
+      return ancestor;
       }
     }
+  return NULL;
 }
 
 //----------------------------------------------------------------------------
 void vtkOsmLayer::AddTileToCache(int zoom, int x, int y, vtkMapTile* tile)
 {
-  this->CachedTilesMap[zoom][x][y] = tile;
-  this->CachedTiles.push_back(tile);
+  this->CachedTiles.Insert(vtkMapTile::ComputeTileId(zoom, x, y), tile);
 }
 
 //----------------------------------------------------------------------------
-vtkMapTile *vtkOsmLayer::GetCachedTile(int zoom, int x, int y)
+bool vtkOsmLayer::IsFailedTile(int zoom, int x, int y)
 {
-  if (this->CachedTilesMap.find(zoom) == this->CachedTilesMap.end() &&
-      this->CachedTilesMap[zoom].find(x) == this->CachedTilesMap[zoom].end() &&
-      this->CachedTilesMap[zoom][x].find(y) == this->CachedTilesMap[zoom][x].end())
+  if (this->FailedTiles.empty())
+    {
+    return false;
+    }
+
+  std::map<vtkTypeUInt64, double>::iterator iter =
+    this->FailedTiles.find(vtkMapTile::ComputeTileId(zoom, x, y));
+  if (iter == this->FailedTiles.end())
     {
-    return NULL;
+    return false;
     }
 
-  return this->CachedTilesMap[zoom][x][y];
+  if (iter->second < vtksys::SystemTools::GetTime())
+    {
+    // Expired, the tile may be requested again
+    this->FailedTiles.erase(iter);
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkMapTile *vtkOsmLayer::GetCachedTile(int zoom, int x, int y)
+{
+  return this->CachedTiles.Find(vtkMapTile::ComputeTileId(zoom, x, y));
 }
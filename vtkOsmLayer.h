@@ -20,6 +20,7 @@
 
 #include "vtkFeatureLayer.h"
 #include "vtkMapTile.h"
+#include "vtkMapTileTable.h"
 #include "vtkmap_export.h"
 
 // VTK Includes
@@ -27,8 +28,17 @@
 #include <vtkRenderer.h>
 
 #include <map>
+#include <set>
+#include <string>
 #include <vector>
 
+class vtkMapTileAtlas;
+class vtkMapTileDecoder;
+class vtkMapTileDownloader;
+class vtkMapTileStore;
+class vtkProp;
+class vtkPropAssembly;
+
 class VTKMAP_EXPORT vtkOsmLayer : public vtkFeatureLayer
 {
 public:
@@ -45,25 +55,196 @@ public:
   // The full path to the directory used for caching OSM image files.
   vtkGetStringMacro(CacheDirectory);
 
+  // Description:
+  // The downloader used to fetch tile images in the background
+  vtkGetObjectMacro(Downloader, vtkMapTileDownloader)
+
+  // Description:
+  // The decoder used to decode tile images in the background
+  vtkGetObjectMacro(Decoder, vtkMapTileDecoder)
+
+  // Description:
+  // Get/Set the store of the tile images, which is opened in the cache
+  // directory. Must be set before the layer is first updated. Default
+  // is a vtkMapTileFileStore.
+  virtual void SetStore(vtkMapTileStore *store);
+  vtkGetObjectMacro(Store, vtkMapTileStore)
+
+  // Description:
+  // Get/Set the time in seconds during which a tile whose download
+  // failed is drawn as a placeholder and not requested again.
+  // Default is 300.
+  vtkSetClampMacro(FailedTileTimeout, double, 0.0, 86400.0)
+  vtkGetMacro(FailedTileTimeout, double)
+
+  // Description:
+  // Get/Set whether tiles around the view, and of the parent and child
+  // zoom levels, are downloaded ahead of time. Prefetched tiles are
+  // requested behind all visible tiles. Default is on.
+  vtkSetMacro(Prefetch, bool)
+  vtkGetMacro(Prefetch, bool)
+  vtkBooleanMacro(Prefetch, bool)
+
+  // Description:
+  // Get/Set the width, in tiles, of the ring around the view that is
+  // prefetched. While panning the ring is widened ahead of the motion.
+  // Default is 1.
+  vtkSetClampMacro(PrefetchRingWidth, int, 0, 8)
+  vtkGetMacro(PrefetchRingWidth, int)
+
+  // Description:
+  // Get/Set the maximum number of tiles prefetched for a view,
+  // default is 64
+  vtkSetClampMacro(MaximumNumberOfPrefetchTiles, int, 0, 4096)
+  vtkGetMacro(MaximumNumberOfPrefetchTiles, int)
+
+  // Description:
+  // Get/Set the maximum number of tiles kept with their actor and
+  // texture. Once exceeded, the tiles farthest from the view are
+  // released, and built again from the image cache or the store when
+  // they come back into view. Tiles in view are always kept.
+  // Default is 256.
+  vtkSetClampMacro(MaximumNumberOfResidentTiles, int, 16, 65536)
+  vtkGetMacro(MaximumNumberOfResidentTiles, int)
+
+  // Description:
+  // Get/Set whether the visible tiles are drawn as quads of a few meshes
+  // sharing atlas textures, see vtkMapTileAtlas, rather than with a
+  // pipeline and an actor each. Default is off: a frame in which new
+  // tiles arrive uploads each changed texture page whole, 16 MB for
+  // the default page size, so this suits views that mostly redraw
+  // tiles already loaded, rather than panning through new ones.
+  vtkSetMacro(BatchTiles, bool)
+  vtkGetMacro(BatchTiles, bool)
+  vtkBooleanMacro(BatchTiles, bool)
+
+  // Description:
+  // The atlas drawing the tiles when BatchTiles is on
+  vtkGetObjectMacro(Atlas, vtkMapTileAtlas)
+
   // Description:
   virtual void Update();
 
+  // Description:
+  // Report tile downloads in progress or finished, so that vtkMap
+  // can redraw once the images arrive
+  virtual bool HasPendingRequests();
+  virtual bool HasCompletedRequests();
+
 protected:
   vtkOsmLayer();
   virtual ~vtkOsmLayer();
 
   vtkSetStringMacro(CacheDirectory);
 
-  void AddTiles();
-  void RemoveTiles();
+  // Description:
+  // Update the tiles drawn for the view. Unless tilesChanged, nothing
+  // is done if the view shows the same tiles as in the last pass.
+  void AddTiles(bool tilesChanged);
+
+  // Description:
+  // Returns true if the camera or the viewport changed since the last
+  // call
+  bool HasViewChanged();
+
+  // Description:
+  // Draw the given tiles with the atlas. Tiles without their image are
+  // drawn with the part of their closest loaded ancestor they cover.
+  void DrawBatchedTiles(const std::vector<vtkMapTile*>& tiles);
+
+  // Description:
+  // Make props the parts of the tile assembly, adding and removing only
+  // the props that changed
+  void UpdateTileAssembly(const std::vector<vtkProp*>& props);
+
+  // Description:
+  // Returns true if the tile can be drawn with its own image
+  bool IsTileLoaded(vtkMapTile* tile);
+
+  // Description:
+  // Release the tiles farthest from the view until at most
+  // MaximumNumberOfResidentTiles remain, keeping visibleTiles
+  void RemoveTiles(const std::vector<vtkMapTile*>& visibleTiles);
+
+  // Description:
+  // Drop a tile from the tile cache, and from the layer if it was built
+  void ReleaseTile(vtkMapTile* tile);
+
+  // Description:
+  // Request tiles likely to be shown next. range holds the visible
+  // tiles of zoomLevel as xmin, xmax, ymin, ymax. PrefetchTile()
+  // returns false if the tile needs no download.
+  void PrefetchTiles(int zoomLevel, const int range[4]);
+  bool PrefetchTile(int zoom, int x, int y, double priority);
+
+  // Description:
+  // Image key and download url of a tile
+  std::string GetTileKey(int zoom, int x, int y);
+  std::string GetTileUrl(int zoom, int x, int y);
+
+  // Description:
+  // Returns the closest lower zoom tile covering the given tile
+  // that has its image loaded, or NULL
+  vtkMapTile* FindLoadedAncestor(int zoom, int x, int y);
 
   void AddTileToCache(int zoom, int x, int y, vtkMapTile* tile);
   vtkMapTile* GetCachedTile(int zoom, int x, int y);
 
+  // Description:
+  // Returns true if the tile download failed less than
+  // FailedTileTimeout seconds ago
+  bool IsFailedTile(int zoom, int x, int y);
+
+  // Description:
+  // Returns the download priority of a tile, lower values first.
+  // Tiles of the displayed zoom level closest to the view center
+  // come first.
+  double ComputeTilePriority(int zoom, int x, int y);
+
+  // Description:
+  // Distance in tiles between the tile center and a world point
+  double ComputeTileDistance(int zoom, int x, int y, const double point[2]);
+
 protected:
   char *CacheDirectory;
-  std::map< int, std::map< int, std::map <int, vtkMapTile*> > > CachedTilesMap;
-  std::vector<vtkMapTile*> CachedTiles;
+  vtkMapTileDownloader *Downloader;
+  vtkMapTileDecoder *Decoder;
+  vtkMapTileAtlas *Atlas;
+  vtkMapTileStore *Store;
+  double FailedTileTimeout;
+  bool Prefetch;
+  int PrefetchRingWidth;
+  int MaximumNumberOfPrefetchTiles;
+  int MaximumNumberOfResidentTiles;
+  bool BatchTiles;
+
+  // Description:
+  // View center and zoom level of the last AddTiles() pass
+  double ViewCenter[2];
+  int ViewZoom;
+
+  // Description:
+  // Camera and viewport seen by the last HasViewChanged(), tile range of
+  // the last AddTiles() pass as zoom level, xmin, xmax, and the
+  // row range, time of that pass, and time the next pass is due
+  double ViewSignature[12];
+  int ViewTileRange[5];
+  vtkTimeStamp TilePassTime;
+  double NextTileDeadline;
+
+  // Description:
+  // Negative cache, maps tile id to the time its failure expires
+  std::map<vtkTypeUInt64, double> FailedTiles;
+
+  // Description:
+  // Tiles created by the layer, by tile id
+  vtkMapTileTable CachedTiles;
+
+  // Description:
+  // Holds the actors drawing the tiles, in front of the props of the
+  // other layers so that tiles are drawn first. TileProps lists its parts.
+  vtkPropAssembly *TileAssembly;
+  std::set<vtkProp*> TileProps;
 
 private:
   vtkOsmLayer(const vtkOsmLayer&);    // Not implemented